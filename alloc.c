@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+static SlabPool *POOLS[ALLOC_MAX_POOLS];
+static Arena *ARENAS[ALLOC_MAX_ARENAS];
+
+typedef struct {
+  int len;
+  void *objs[SLAB_CACHE_LEN];
+} SlabCache;
+
+static _Thread_local SlabCache CACHES[ALLOC_MAX_POOLS];
+
+static size_t align_up(size_t n) {
+  return (n + ALLOC_ALIGN - 1) & ~(size_t) (ALLOC_ALIGN - 1);
+}
+
+// BEGIN: slab pool
+void
+slab_init(SlabPool *pool, const char *name, size_t obj_size, size_t capacity)
+{
+  int id = 0;
+  while (id < ALLOC_MAX_POOLS && POOLS[id] != NULL) id++;
+  if (id == ALLOC_MAX_POOLS) {
+    LOG_FATAL("too many slab pools, raise ALLOC_MAX_POOLS\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(pool, 0, sizeof(*pool));
+  pool->name     = name;
+  pool->id       = id;
+  pool->obj_size = align_up(obj_size < sizeof(void *)
+                            ? sizeof(void *) : obj_size);
+  pool->capacity = capacity;
+  pool->slab     = aligned_alloc(ALLOC_ALIGN, pool->obj_size * capacity);
+  if (pool->slab == NULL) {
+    LOG_FATAL("null pointer allocating slab `%s`\n", name);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+
+  // thread the free list through the objects themselves
+  for (size_t o = capacity; o-- > 0;) {
+    void *obj = pool->slab + o * pool->obj_size;
+    *(void **) obj = pool->free_list;
+    pool->free_list = obj;
+  }
+  POOLS[id] = pool;
+}
+
+void *slab_alloc(SlabPool *pool) {
+  SlabCache *cache = &CACHES[pool->id];
+  if (cache->len == 0) {
+    pthread_mutex_lock(&pool->lock);
+    pool->refills++;
+    while (cache->len < SLAB_CACHE_BATCH && pool->free_list != NULL) {
+      void *obj = pool->free_list;
+      pool->free_list = *(void **) obj;
+      cache->objs[cache->len++] = obj;
+    }
+    pool->reserved += (size_t) cache->len;
+    if (cache->len == 0) pool->failures++;
+    pthread_mutex_unlock(&pool->lock);
+    if (cache->len == 0) return NULL;
+  }
+  uint64_t live = atomic_fetch_add_explicit(&pool->allocs, 1,
+                                            memory_order_relaxed) + 1
+                - atomic_load_explicit(&pool->frees, memory_order_relaxed);
+  if (live > atomic_load_explicit(&pool->high_water, memory_order_relaxed))
+    atomic_store_explicit(&pool->high_water, live, memory_order_relaxed);
+  return cache->objs[--cache->len];
+}
+
+void slab_free(SlabPool *pool, void *obj) {
+  if (obj == NULL) return;
+  SlabCache *cache = &CACHES[pool->id];
+  atomic_fetch_add_explicit(&pool->frees, 1, memory_order_relaxed);
+  if (cache->len == SLAB_CACHE_LEN) {
+    pthread_mutex_lock(&pool->lock);
+    while (cache->len > SLAB_CACHE_LEN - SLAB_CACHE_BATCH) {
+      void *spill = cache->objs[--cache->len];
+      *(void **) spill = pool->free_list;
+      pool->free_list = spill;
+      pool->reserved--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  cache->objs[cache->len++] = obj;
+}
+
+// whether obj was carved from the pool's slab, for buffers that may also
+// come from malloc()
+bool slab_owns(const SlabPool *pool, const void *obj) {
+  const uint8_t *p = obj;
+  return p >= pool->slab && p < pool->slab + pool->obj_size * pool->capacity;
+}
+
+void slab_destroy(SlabPool *pool) {
+  LOG_FROM_SUCC("freeing slab `%s` ...\n", pool->name);
+  CACHES[pool->id].len = 0; // other threads must be done with the pool
+  POOLS[pool->id] = NULL;
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->slab);
+  pool->slab = NULL;
+}
+// END: slab pool
+
+// BEGIN: arena
+void arena_init(Arena *arena, const char *name, size_t cap) {
+  int slot = 0;
+  while (slot < ALLOC_MAX_ARENAS && ARENAS[slot] != NULL) slot++;
+  if (slot == ALLOC_MAX_ARENAS) {
+    LOG_FATAL("too many arenas, raise ALLOC_MAX_ARENAS\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(arena, 0, sizeof(*arena));
+  arena->name = name;
+  arena->cap  = align_up(cap);
+  arena->base = aligned_alloc(ALLOC_ALIGN, arena->cap);
+  if (arena->base == NULL) {
+    LOG_FATAL("null pointer allocating arena `%s`\n", name);
+    exit(EXIT_FAILURE);
+  }
+  ARENAS[slot] = arena;
+}
+
+void *arena_alloc(Arena *arena, size_t len) {
+  len = align_up(len);
+  if (len > arena->cap - arena->used) {
+    arena->overflows++;
+    return NULL;
+  }
+  void *ptr = arena->base + arena->used;
+  arena->used += len;
+  if (arena->used > arena->high_water) arena->high_water = arena->used;
+  return ptr;
+}
+
+void arena_reset(Arena *arena) {
+  arena->used = 0;
+  arena->resets++;
+}
+
+void arena_destroy(Arena *arena) {
+  LOG_FROM_SUCC("freeing arena `%s` ...\n", arena->name);
+  for (int a = 0; a < ALLOC_MAX_ARENAS; a++) {
+    if (ARENAS[a] == arena) ARENAS[a] = NULL;
+  }
+  free(arena->base);
+  arena->base = NULL;
+}
+// END: arena
+
+static void prefault(uint8_t *base, size_t len) {
+  volatile uint8_t *byte = base; // write back what is there, keep free lists
+  for (size_t off = 0; off < len; off += 4096) byte[off] = byte[off];
+}
+
+// touch every page of every pool and arena so steady state never faults
+void alloc_prefault_all(void) {
+  for (int p = 0; p < ALLOC_MAX_POOLS; p++) {
+    if (POOLS[p] == NULL) continue;
+    prefault(POOLS[p]->slab, POOLS[p]->obj_size * POOLS[p]->capacity);
+  }
+  for (int a = 0; a < ALLOC_MAX_ARENAS; a++) {
+    if (ARENAS[a] == NULL) continue;
+    prefault(ARENAS[a]->base, ARENAS[a]->cap);
+  }
+}
+
+void alloc_stats_log(void) {
+  LOG_FROM_SUCC("allocator usage\n");
+  for (int p = 0; p < ALLOC_MAX_POOLS; p++) {
+    SlabPool *pool = POOLS[p];
+    if (pool == NULL) continue;
+    uint64_t allocs = atomic_load(&pool->allocs);
+    uint64_t frees  = atomic_load(&pool->frees);
+    pthread_mutex_lock(&pool->lock);
+    LOG_APPEND("slab %-8s %lu/%zu live (high %lu, cached %zu) x %zuB, "
+               "allocs %lu frees %lu refills %lu failures %lu\n",
+               pool->name, (unsigned long) (allocs - frees), pool->capacity,
+               (unsigned long) atomic_load(&pool->high_water),
+               pool->reserved - (size_t) (allocs - frees), pool->obj_size,
+               (unsigned long) allocs, (unsigned long) frees,
+               (unsigned long) pool->refills,
+               (unsigned long) pool->failures);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  for (int a = 0; a < ALLOC_MAX_ARENAS; a++) {
+    Arena *arena = ARENAS[a];
+    if (arena == NULL) continue;
+    LOG_APPEND("arena %-8s %zu/%zuB (high %zuB), resets %lu overflows %lu\n",
+               arena->name, arena->used, arena->cap, arena->high_water,
+               (unsigned long) arena->resets,
+               (unsigned long) arena->overflows);
+  }
+}
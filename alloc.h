@@ -0,0 +1,75 @@
+/*
+  Allocator layer of the host.
+
+  SlabPool hands out fixed-size objects carved from a single up-front slab, so
+  the memory held by connection state and the first outbound queue buffer of
+  each slot is bounded from startup on (bursts beyond that buffer still go to
+  malloc(), see OutQueue in host.h). Each thread keeps a small cache per pool
+  and only touches the shared free list (under a lock) in batches.
+
+  Arena is a bump allocator for transient data that dies with the current
+  event-loop iteration, it is reset wholesale instead of freed piecemeal.
+
+  Every pool and arena registers itself so alloc_stats_log() can report usage.
+ */
+
+#ifndef ALLOC_H_
+#define ALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define ALLOC_ALIGN       16
+#define ALLOC_MAX_POOLS   8
+#define ALLOC_MAX_ARENAS  4
+#define SLAB_CACHE_LEN    32 // per-thread cached objects, per pool
+#define SLAB_CACHE_BATCH  16 // objects moved between cache and free list
+
+// BEGIN: slab pool
+typedef struct {
+  const char *name;
+  int id; // index into the per-thread caches
+  size_t obj_size;
+  size_t capacity;
+  uint8_t *slab;
+  void *free_list;
+  pthread_mutex_t lock;
+  size_t reserved;   // guarded by lock, out of the free list incl. caches
+  uint64_t failures; // exhausted, caller got NULL
+  uint64_t refills;  // trips to the shared free list
+  _Atomic uint64_t allocs;
+  _Atomic uint64_t frees;
+  _Atomic uint64_t high_water; // most objects live at once
+} SlabPool;
+
+void slab_init(SlabPool *, const char *, size_t, size_t);
+void *slab_alloc(SlabPool *);
+void slab_free(SlabPool *, void *);
+bool slab_owns(const SlabPool *, const void *);
+void slab_destroy(SlabPool *);
+// END: slab pool
+
+// BEGIN: arena
+typedef struct {
+  const char *name;
+  uint8_t *base;
+  size_t cap;
+  size_t used;
+  size_t high_water;
+  uint64_t resets;
+  uint64_t overflows; // caller got NULL
+} Arena;
+
+void arena_init(Arena *, const char *, size_t);
+void *arena_alloc(Arena *, size_t);
+void arena_reset(Arena *);
+void arena_destroy(Arena *);
+// END: arena
+
+void alloc_prefault_all(void);
+void alloc_stats_log(void);
+
+#endif // ALLOC_H_
@@ -0,0 +1,93 @@
+/*
+  Throughput of filter.h over chat-like text as the pattern count grows,
+  the cost per byte should stay flat. Patterns are random lowercase words,
+  so a few of them occur in the text, plus a set of link patterns whose
+  first bytes are rare enough for the SIMD prefilter to skip ahead. The
+  text is screened in 4 KiB frames like the host reads them.
+
+    make bench && ./build/filter_bench [MB per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_IMPLEMENTATION
+#include "../log.h"
+#include "../filter.h"
+
+#define MB_DEFAULT  64
+#define FRAME_LEN   4096
+#define TEXT_LEN    (1024 * 1024)
+#define PATH        "build/bench.filter"
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// n random words after the fixed ones
+static void write_patterns(size_t n, const char *fixed, unsigned *seed) {
+  FILE *file = fopen(PATH, "w");
+  if (file == NULL) {
+    perror(PATH);
+    exit(EXIT_FAILURE);
+  }
+  if (fixed != NULL) fputs(fixed, file);
+  for (size_t p = 0; p < n; p++) {
+    int len = 5 + rand_r(seed) % 8;
+    for (int c = 0; c < len; c++) fputc('a' + rand_r(seed) % 26, file);
+    fputc('\n', file);
+  }
+  fclose(file);
+}
+
+static void run(const char *isa, size_t n_patterns, const char *fixed,
+                const char *text, size_t total)
+{
+  unsigned seed = 7;
+  write_patterns(n_patterns, fixed, &seed);
+  Filter *f = filter_load(PATH);
+  if (f == NULL) exit(EXIT_FAILURE);
+  size_t frames = total / FRAME_LEN, hits = 0;
+  double start = now_sec();
+  for (size_t i = 0; i < frames; i++) {
+    size_t at = (i * FRAME_LEN) % (TEXT_LEN - FRAME_LEN);
+    hits += filter_match(f, text + at, FRAME_LEN);
+  }
+  double secs = now_sec() - start;
+  printf("  %-6s %7zu patterns %8u states %2d first bytes  %6.2f GB/s  "
+         "%zu of %zu frames hit\n", isa, f->n_patterns, f->n_states,
+         f->n_first, (double) (frames * FRAME_LEN) / secs / 1e9, hits,
+         frames);
+  filter_free(f);
+}
+
+int main(int argc, char **argv) {
+  size_t total = (size_t) (argc > 1 ? atoi(argv[1]) : MB_DEFAULT) << 20;
+  static char text[TEXT_LEN];
+  const char *words[] = { "hey ", "how ", "is ", "it ", "going? ", "lunch ",
+                          "at ", "noon\n", "sure, ", "see ", "you ",
+                          "there\n" };
+  unsigned seed = 1;
+  for (size_t at = 0; at < TEXT_LEN;) {
+    const char *w = words[(size_t) rand_r(&seed) % 12];
+    size_t l = strlen(w);
+    if (at + l > TEXT_LEN) l = TEXT_LEN - at;
+    memcpy(text + at, w, l);
+    at += l;
+  }
+
+  const char *isas[] = { "scalar", "avx2" };
+  const size_t counts[] = { 1, 3, 100, 10000, 100000 };
+  for (size_t k = 0; k < 2; k++) {
+    if (!scan_init(isas[k])) continue;
+    run(isas[k], 0, "://\nwww.\n@everyone\n", text, total);
+    for (size_t c = 0; c < sizeof(counts) / sizeof(*counts); c++)
+      run(isas[k], counts[c], NULL, text, total);
+  }
+  remove(PATH);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+/*
+  Contention benchmark for queue.h, reports ops/sec (items moved from
+  producers to the consumer) across producer counts and batch sizes.
+
+    make bench && ./build/queue_bench [items per producer]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../queue.h"
+
+#define QUEUE_CAP     4096
+#define ITEMS_DEFAULT 2000000
+#define MAX_BATCH     32
+
+typedef struct {
+  void *queue;
+  bool mpsc;
+  size_t items;
+  size_t batch;
+} Producer;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void *produce(void *raw) {
+  Producer *p = raw;
+  void *items[MAX_BATCH];
+  for (size_t b = 0; b < MAX_BATCH; b++) items[b] = (void *) (uintptr_t) 1;
+  size_t left = p->items;
+  while (left > 0) {
+    size_t want = left < p->batch ? left : p->batch;
+    size_t done = p->mpsc
+      ? mpsc_push_batch(p->queue, items, want)
+      : spsc_push_batch(p->queue, items, want);
+    if (done == 0) sched_yield(); // full, let the consumer catch up
+    left -= done;
+  }
+  return NULL;
+}
+
+static void run(bool mpsc, int n_producers, size_t items, size_t batch) {
+  SpscQueue spsc;
+  MpscQueue mq;
+  void *queue = mpsc ? (void *) &mq : (void *) &spsc;
+  if (!(mpsc ? mpsc_init(&mq, QUEUE_CAP) : spsc_init(&spsc, QUEUE_CAP))) {
+    fprintf(stderr, "%s(): queue allocation failed\n", __func__);
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_t threads[16];
+  Producer producers[16];
+  double start = now_sec();
+  for (int t = 0; t < n_producers; t++) {
+    producers[t] = (Producer) { queue, mpsc, items, batch };
+    pthread_create(&threads[t], NULL, produce, &producers[t]);
+  }
+
+  void *out[MAX_BATCH];
+  size_t total = items * (size_t) n_producers, seen = 0;
+  while (seen < total) {
+    size_t got = mpsc
+      ? mpsc_pop_batch(&mq, out, batch)
+      : spsc_pop_batch(&spsc, out, batch);
+    for (size_t o = 0; o < got; o++) {
+      if (out[o] != (void *) (uintptr_t) 1) {
+        fprintf(stderr, "%s(): corrupted item\n", __func__);
+        exit(EXIT_FAILURE);
+      }
+    }
+    seen += got;
+  }
+  for (int t = 0; t < n_producers; t++) pthread_join(threads[t], NULL);
+  double elapsed = now_sec() - start;
+
+  printf("%-4s producers %2d  batch %2zu  %8.2f Mops/s\n",
+         mpsc ? "mpsc" : "spsc", n_producers, batch,
+         (double) total / elapsed / 1e6);
+  if (mpsc) mpsc_destroy(&mq);
+  else spsc_destroy(&spsc);
+}
+
+int main(int argc, char **argv) {
+  size_t items = argc > 1 ? (size_t) atol(argv[1]) : ITEMS_DEFAULT;
+  const size_t batches[] = { 1, 8, 32 };
+  const int producers[] = { 1, 2, 4, 8 };
+
+  for (size_t b = 0; b < 3; b++) run(false, 1, items, batches[b]);
+  for (size_t b = 0; b < 3; b++) {
+    for (size_t p = 0; p < 4; p++) run(true, producers[p], items, batches[b]);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/*
+  Throughput of the scan.h kernels, GB/s per kernel for delimiter counting
+  and UTF-8 validation over ASCII, mixed (mostly ASCII with accents and
+  emoji) and non-latin text. Before timing, every kernel is checked against
+  the scalar one on random mutations of the inputs.
+
+    make bench && ./build/scan_bench [MB per run]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../scan.h"
+
+#define MB_DEFAULT    64
+#define BUF_LEN       (64 * 1024) // about one read budget
+#define FUZZ_ROUNDS   20000
+#define FUZZ_LEN      512         // longest fuzzed input
+
+static const char *isas[] = { "scalar", "sse2", "avx2" };
+#define N_ISAS (sizeof(isas) / sizeof(*isas))
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// fills buf with whole characters drawn from pieces, cycling through them
+static void fill(char *buf, size_t len, const char **pieces, size_t n) {
+  size_t at = 0;
+  for (size_t p = 0;; p = (p + 1) % n) {
+    size_t l = strlen(pieces[p]);
+    if (at + l > len) break;
+    memcpy(buf + at, pieces[p], l);
+    at += l;
+  }
+  memset(buf + at, ' ', len - at);
+}
+
+// the vector kernels must agree with the scalar one on every input
+static int fuzz(const char *base, size_t len) {
+  char buf[FUZZ_LEN];
+  unsigned seed = 1;
+  for (int round = 0; round < FUZZ_ROUNDS; round++) {
+    size_t n = (size_t) rand_r(&seed) % FUZZ_LEN;
+    memcpy(buf, base + (size_t) rand_r(&seed) % (len - n), n);
+    for (int flips = rand_r(&seed) % 3; flips > 0 && n > 0; flips--)
+      buf[(size_t) rand_r(&seed) % n] = (char) rand_r(&seed);
+    scan_init("scalar");
+    bool valid = utf8_valid(buf, n);
+    size_t lines = scan_count(buf, n, '\n');
+    size_t first = scan_find(buf, n, '\n');
+    size_t any = scan_find_any(buf, n, (const uint8_t *) "\n\xc3", 2);
+    for (size_t k = 1; k < N_ISAS; k++) {
+      if (!scan_init(isas[k])) continue;
+      if (utf8_valid(buf, n) != valid || scan_count(buf, n, '\n') != lines ||
+          scan_find(buf, n, '\n') != first ||
+          scan_find_any(buf, n, (const uint8_t *) "\n\xc3", 2) != any)
+      {
+        fprintf(stderr, "%s disagrees with scalar, round %d length %zu\n",
+                isas[k], round, n);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void run(const char *label, const char *buf, size_t total) {
+  printf("%s\n", label);
+  for (size_t k = 0; k < N_ISAS; k++) {
+    if (!scan_init(isas[k])) {
+      printf("  %-6s not supported\n", isas[k]);
+      continue;
+    }
+    size_t reps = total / BUF_LEN, sink = 0;
+    double start = now_sec();
+    for (size_t r = 0; r < reps; r++) sink += scan_count(buf, BUF_LEN, '\n');
+    double count_s = now_sec() - start;
+    start = now_sec();
+    for (size_t r = 0; r < reps; r++) sink += utf8_valid(buf, BUF_LEN);
+    double utf8_s = now_sec() - start;
+    double gb = (double) (reps * BUF_LEN) / 1e9;
+    printf("  %-6s count %6.2f GB/s  utf8 %6.2f GB/s  (%zu)\n", isas[k],
+           gb / count_s, gb / utf8_s, sink);
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t total = (size_t) (argc > 1 ? atoi(argv[1]) : MB_DEFAULT) << 20;
+  static char ascii[BUF_LEN], mixed[BUF_LEN], cjk[BUF_LEN];
+  const char *ascii_p[] = { "hello there, ", "how are you?\n" };
+  const char *mixed_p[] = { "caf\xc3\xa9 ", "na\xc3\xafve ", "ok ",
+                            "\xf0\x9f\x98\x80\n", "see you soon " };
+  const char *cjk_p[] = { "\xe4\xbd\xa0\xe5\xa5\xbd", "\xe4\xb8\x96",
+                          "\xe7\x95\x8c\n" };
+  fill(ascii, BUF_LEN, ascii_p, 2);
+  fill(mixed, BUF_LEN, mixed_p, 5);
+  fill(cjk, BUF_LEN, cjk_p, 3);
+
+  if (fuzz(ascii, BUF_LEN) < 0 || fuzz(mixed, BUF_LEN) < 0 ||
+      fuzz(cjk, BUF_LEN) < 0)
+  {
+    return EXIT_FAILURE;
+  }
+  printf("kernels agree on %d fuzzed inputs per text\n", FUZZ_ROUNDS);
+  run("ascii", ascii, total);
+  run("mixed", mixed, total);
+  run("cjk", cjk, total);
+  return EXIT_SUCCESS;
+}
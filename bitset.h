@@ -0,0 +1,63 @@
+/*
+  Fixed-size bitsets over client slots, one bit per slot in uint64_t words.
+  The fan-out masks of block.h are built from these; the whole-set
+  operations go 128 bits at a time with SSE2 where it exists. All functions
+  are static inline, there is nothing to link:
+
+    uint64_t to[BITSET_WORDS(64)];
+    bitset_andnot(to, connected, blocked_by, BITSET_WORDS(64));
+    if (bitset_test(to, slot)) ...
+ */
+
+#ifndef BITSET_H_
+#define BITSET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define BITSET_WORDS(bits) (((size_t) (bits) + 63) / 64)
+
+static inline void bitset_set(uint64_t *set, int bit) {
+  set[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static inline void bitset_clear(uint64_t *set, int bit) {
+  set[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+static inline bool bitset_test(const uint64_t *set, int bit) {
+  return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void bitset_zero(uint64_t *set, size_t words) {
+  memset(set, 0, words * sizeof(uint64_t));
+}
+
+// dst = a & ~b
+static inline void bitset_andnot(uint64_t *dst, const uint64_t *a,
+                                 const uint64_t *b, size_t words)
+{
+  size_t w = 0;
+#ifdef __SSE2__
+  for (; w + 2 <= words; w += 2) {
+    __m128i va = _mm_loadu_si128((const __m128i *) (a + w));
+    __m128i vb = _mm_loadu_si128((const __m128i *) (b + w));
+    _mm_storeu_si128((__m128i *) (dst + w), _mm_andnot_si128(vb, va));
+  }
+#endif
+  for (; w < words; w++) dst[w] = a[w] & ~b[w];
+}
+
+static inline size_t bitset_count(const uint64_t *set, size_t words) {
+  size_t n = 0;
+  for (size_t w = 0; w < words; w++) n += (size_t) __builtin_popcountll(set[w]);
+  return n;
+}
+
+#endif // BITSET_H_
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "block.h"
+#include "bitset.h"
+#include "host.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+static const struct {
+  const char *prefix;
+  block_cmd_t cmd;
+} commands[] = {
+  { "/nick ",    BLOCK_NICK },
+  { "/mute ",    BLOCK_MUTE },
+  { "/block ",   BLOCK_BLOCK },
+  { "/unmute ",  BLOCK_LIFT },
+  { "/unblock ", BLOCK_LIFT },
+};
+
+// `/<command> <name>\n` -> the command and name (NICK_MAX + 1 bytes), or
+// BLOCK_NONE for anything else, which is then an ordinary message
+block_cmd_t block_parse(const char *msg, size_t len, char *name) {
+  if (len < 2 || msg[0] != '/' || msg[len - 1] != '\n') return BLOCK_NONE;
+  len--;
+  if (msg[len - 1] == '\r') len--;
+  for (size_t k = 0; k < sizeof(commands) / sizeof(*commands); k++) {
+    size_t cmd_len = strlen(commands[k].prefix);
+    if (len <= cmd_len || memcmp(msg, commands[k].prefix, cmd_len) != 0)
+      continue;
+    size_t name_len = len - cmd_len;
+    if (name_len > NICK_MAX) return BLOCK_NONE;
+    for (size_t i = cmd_len; i < len; i++) {
+      if (msg[i] <= ' ' || msg[i] > '~') return BLOCK_NONE;
+    }
+    memcpy(name, msg + cmd_len, name_len);
+    name[name_len] = '\0';
+    return commands[k].cmd;
+  }
+  return BLOCK_NONE;
+}
+
+static bool is_user(const ClientPool *pool, int c) {
+  return pool->clients[c].is_connected &&
+         pool->clients[c].kind == CLIENT_USER;
+}
+
+static int find_nick(const ClientPool *pool, const char *name) {
+  for (int c = 0; c < pool->max; c++) {
+    if (is_user(pool, c) && strcmp(pool->clients[c].name, name) == 0)
+      return c;
+  }
+  return -1;
+}
+
+static int list_find(const BlockList *list, const char *name) {
+  for (int e = 0; list != NULL && e < list->n; e++) {
+    if (strcmp(list->entries[e].name, name) == 0) return e;
+  }
+  return -1;
+}
+
+// carries out a command of user c; -1 (logged) when it was refused
+int block_apply(ClientPool *pool, int c, block_cmd_t cmd, const char *name) {
+  Client *client = &pool->clients[c];
+  int fd = pool->pfds[c].fd;
+  int e = list_find(client->blocks, name);
+  switch (cmd) {
+  case BLOCK_NONE:
+    return 0;
+  case BLOCK_NICK: {
+    int holder = find_nick(pool, name);
+    if (holder >= 0 && holder != c) {
+      LOG_FROM_WARN("socket %d asked for `%s`, already taken\n", fd, name);
+      return -1;
+    }
+    strcpy(client->name, name);
+  } break;
+  case BLOCK_MUTE:
+  case BLOCK_BLOCK:
+    if (client->blocks == NULL &&
+        (client->blocks = calloc(1, sizeof(BlockList))) == NULL)
+    {
+      LOG_FROM_ERR("null pointer allocating %s\n", "(BlockList *)");
+      return -1;
+    }
+    if (e < 0) {
+      if (client->blocks->n == BLOCK_MAX) {
+        LOG_FROM_WARN("socket %d has %d names listed already\n", fd,
+                      BLOCK_MAX);
+        return -1;
+      }
+      e = client->blocks->n++;
+      strcpy(client->blocks->entries[e].name, name);
+    }
+    client->blocks->entries[e].both_ways = cmd == BLOCK_BLOCK;
+    break;
+  case BLOCK_LIFT:
+    if (e < 0) return 0;
+    client->blocks->entries[e] = client->blocks->entries[--client->blocks->n];
+    break;
+  }
+  block_compile(pool);
+  return 0;
+}
+
+// rebuilds every blocked_by row from the lists and current names
+void block_compile(ClientPool *pool) {
+  const size_t words = pool->mask_words;
+  bitset_zero(pool->blocked_by, (size_t) pool->max * words);
+  for (int r = 0; r < pool->max; r++) {
+    const BlockList *list = pool->clients[r].blocks;
+    if (!is_user(pool, r) || list == NULL) continue;
+    for (int e = 0; e < list->n; e++) {
+      int s = find_nick(pool, list->entries[e].name);
+      if (s < 0 || s == r) continue;
+      bitset_set(pool->blocked_by + (size_t) s * words, r);
+      if (list->entries[e].both_ways)
+        bitset_set(pool->blocked_by + (size_t) r * words, s);
+    }
+  }
+}
+
+// whether user receiver must not get a message from whoever is named sender:
+// its own list names them, or the current holder of the name blocked it
+bool block_hides(const ClientPool *pool, const char *sender, int receiver) {
+  if (list_find(pool->clients[receiver].blocks, sender) >= 0) return true;
+  int s = find_nick(pool, sender);
+  return s >= 0 && s != receiver &&
+         bitset_test(pool->blocked_by + (size_t) s * pool->mask_words,
+                     receiver);
+}
+
+// users that get a message from slot sender (-1: from no user, everyone)
+void block_recipients(const ClientPool *pool, int sender, uint64_t *dst) {
+  const size_t words = pool->mask_words;
+  if (sender < 0) {
+    memcpy(dst, pool->user_mask, words * sizeof(uint64_t));
+    return;
+  }
+  bitset_andnot(dst, pool->user_mask,
+                pool->blocked_by + (size_t) sender * words, words);
+  bitset_clear(dst, sender);
+}
@@ -0,0 +1,69 @@
+/*
+  Muting and blocking between users. A user takes a name, then lists the
+  names it does not want to hear from:
+
+    /nick alice
+    /mute bob        alice stops receiving bob's messages
+    /block carol     ... and carol stops receiving alice's as well
+    /unmute bob      lifts a mute or a block, as does /unblock
+
+  Lists belong to the connection that made them and hold names, so they
+  apply to whoever has that name now or takes it later. Fan-out never walks
+  them: block_compile() turns all lists into one bitset per sender slot,
+  blocked_by, with a bit for every slot that must not receive from it. The
+  recipients of a message are computed once when it is queued,
+
+    recipients = users & ~blocked_by[sender] & ~sender
+
+  an SSE2 AND-NOT over the slot words (bitset.h), after which each
+  recipient costs one bit test, the same as the sender check it replaces.
+  Lists change rarely (a command, a rename, a connection coming or going),
+  only then are the masks compiled again, O(users * list length * users).
+
+  Messages replayed from the history on /sync are checked one by one with
+  block_hides() against the lists as they are at replay time, by the name
+  the sender had.
+
+  Limitation: lists live and die with the connection. Nothing ties them to
+  a name or an account, so a user who reconnects starts with an empty list,
+  and a list set on one connection does not follow the same person to
+  another one (or to another host over a relay link).
+ */
+
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define NICK_MAX  32 // bytes of a name, printable ASCII without spaces
+#define BLOCK_MAX 32 // names on one connection's list
+
+typedef enum {
+  BLOCK_NONE,  // not a block command
+  BLOCK_NICK,
+  BLOCK_MUTE,
+  BLOCK_BLOCK,
+  BLOCK_LIFT,  // /unmute and /unblock
+} block_cmd_t;
+
+typedef struct {
+  char name[NICK_MAX + 1];
+  bool both_ways; // /block rather than /mute
+} BlockEntry;
+
+typedef struct {
+  int n;
+  BlockEntry entries[BLOCK_MAX];
+} BlockList;
+
+typedef struct ClientPool ClientPool;
+
+block_cmd_t block_parse(const char *, size_t, char *);
+int block_apply(ClientPool *, int, block_cmd_t, const char *);
+void block_compile(ClientPool *);
+void block_recipients(const ClientPool *, int, uint64_t *);
+bool block_hides(const ClientPool *, const char *, int);
+
+#endif // BLOCK_H_
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define RECORD_HEADER_LEN (sizeof(uint64_t) + sizeof(uint32_t))
+
+// draws every stored message and finds the last seq, without a read() copy
+static off_t replay_log(FeedCache *cache, cache_msg_fn on_msg, void *arg) {
+  struct stat st;
+  if (fstat(cache->fd, &st) < 0 || st.st_size == 0) return 0;
+  const char *log = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                         cache->fd, 0);
+  if (log == MAP_FAILED) return -1;
+
+  size_t off = 0, size = (size_t) st.st_size;
+  while (size - off >= RECORD_HEADER_LEN) {
+    uint64_t seq;
+    uint32_t len;
+    memcpy(&seq, log + off, sizeof(seq));
+    memcpy(&len, log + off + sizeof(seq), sizeof(len));
+    if (size - off - RECORD_HEADER_LEN < len) break; // torn record
+    on_msg(log + off + RECORD_HEADER_LEN, len, arg);
+    cache->last_seq = seq;
+    off += RECORD_HEADER_LEN + len;
+  }
+  munmap((void *) log, size);
+  return (off_t) off;
+}
+
+int cache_open(FeedCache *cache, const char *path,
+               cache_msg_fn on_msg, void *arg)
+{
+  cache->last_seq = 0;
+  cache->rx_len = 0;
+  cache->in_body = false;
+  cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (cache->fd < 0) return -1;
+  off_t good = replay_log(cache, on_msg, arg);
+  if (good < 0) {
+    close(cache->fd);
+    cache->fd = -1;
+    return -1;
+  }
+  // drop a torn tail so new records line up, then only ever append
+  if (ftruncate(cache->fd, good) < 0 ||
+      lseek(cache->fd, 0, SEEK_END) < 0)
+  {
+    close(cache->fd);
+    cache->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+static void store(FeedCache *cache, uint64_t seq, const char *msg, size_t len)
+{
+  char header[RECORD_HEADER_LEN];
+  uint32_t len32 = (uint32_t) len;
+  memcpy(header, &seq, sizeof(seq));
+  memcpy(header + sizeof(seq), &len32, sizeof(len32));
+  // a failed write only costs the message on the next startup's fast path
+  if (write(cache->fd, header, sizeof(header)) == (ssize_t) sizeof(header))
+    (void) !write(cache->fd, msg, len);
+  cache->last_seq = seq;
+}
+
+// consumes frames from the front of rx, returns false when it needs more
+static bool next_frame(FeedCache *cache, cache_msg_fn on_msg, void *arg) {
+  if (!cache->in_body) {
+    char *nl = memchr(cache->rx, '\n', cache->rx_len);
+    if (nl == NULL) {
+      if (cache->rx_len == CACHE_RX_CAP) cache->rx_len = 0; // not our framing
+      return false;
+    }
+    size_t line_len = (size_t) (nl - cache->rx) + 1;
+    unsigned long long seq;
+    size_t len;
+    *nl = '\0';
+    if (sscanf(cache->rx, "#%llu %zu", &seq, &len) == 2) {
+      cache->in_body = true;
+      cache->body_seq = (uint64_t) seq;
+      cache->body_left = len;
+    } else { // a host without history, show the line as it is
+      *nl = '\n';
+      on_msg(cache->rx, line_len, arg);
+    }
+    cache->rx_len -= line_len;
+    memmove(cache->rx, cache->rx + line_len, cache->rx_len);
+    return true;
+  }
+
+  size_t take;
+  if (cache->body_left <= CACHE_RX_CAP) { // whole message at once
+    if (cache->rx_len < cache->body_left) return false;
+    take = cache->body_left;
+    if (cache->body_seq == 0) {
+      on_msg(cache->rx, take, arg); // not retained by the host either
+    } else if (cache->body_seq > cache->last_seq) {
+      store(cache, cache->body_seq, cache->rx, take);
+      on_msg(cache->rx, take, arg);
+    } // else: seen it already, e.g. replayed and then flushed again
+  } else { // bulk payload bigger than rx, passed through in pieces
+    if (cache->rx_len == 0) return false;
+    take = cache->rx_len < cache->body_left ? cache->rx_len : cache->body_left;
+    on_msg(cache->rx, take, arg);
+  }
+  cache->body_left -= take;
+  if (cache->body_left == 0) cache->in_body = false;
+  cache->rx_len -= take;
+  memmove(cache->rx, cache->rx + take, cache->rx_len);
+  return true;
+}
+
+void cache_feed(FeedCache *cache, const char *data, size_t len,
+                cache_msg_fn on_msg, void *arg)
+{
+  while (len > 0) {
+    size_t room = CACHE_RX_CAP - cache->rx_len;
+    size_t chunk = len < room ? len : room;
+    memcpy(cache->rx + cache->rx_len, data, chunk);
+    cache->rx_len += chunk;
+    data += chunk;
+    len -= chunk;
+    while (next_frame(cache, on_msg, arg)) {}
+  }
+}
+
+void cache_close(FeedCache *cache) {
+  if (cache->fd >= 0) close(cache->fd);
+  cache->fd = -1;
+}
@@ -0,0 +1,43 @@
+/*
+  On-disk feed cache of the ncurses client. Every message the host sends
+  with a sequence number (see history.h) is appended to a log file, at
+  startup the log is mmap()ed and drawn right away, then only the messages
+  newer than its last seq are asked for:
+
+    FeedCache cache;
+    cache_open(&cache, "saves/feed.log", draw, win); // draw(msg, len, win)
+    dprintf(sockfd, "/sync %llu\n", (unsigned long long) cache.last_seq);
+    ...
+    cache_feed(&cache, buf, n, draw, win); // whatever recv() returned
+
+  Records are <8 byte seq><4 byte len><len bytes>, native endian since the
+  file never leaves the machine. A torn record at the end (crash while
+  writing) is cut off when the log is opened.
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CACHE_RX_CAP (2 * 4096 + 64) // two frames of MAX_DATA_LEN_CEIL
+
+typedef void (*cache_msg_fn)(const char *, size_t, void *);
+
+typedef struct {
+  int fd;            // log, appended to
+  uint64_t last_seq; // highest seq stored, 0 when empty
+  bool in_body;      // past a `#seq len` header, body_left bytes to go
+  uint64_t body_seq;
+  size_t body_left;
+  size_t rx_len;     // partial frame carried over between recv() calls
+  char rx[CACHE_RX_CAP];
+} FeedCache;
+
+int cache_open(FeedCache *, const char *, cache_msg_fn, void *);
+void cache_feed(FeedCache *, const char *, size_t, cache_msg_fn, void *);
+void cache_close(FeedCache *);
+
+#endif // CACHE_H_
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void put_le(unsigned char *dst, uint64_t val, int bytes) {
+  for (int b = 0; b < bytes; b++) dst[b] = (unsigned char) (val >> (8 * b));
+}
+
+static uint64_t get_le(const unsigned char *src, int bytes) {
+  uint64_t val = 0;
+  for (int b = bytes - 1; b >= 0; b--) val = (val << 8) | src[b];
+  return val;
+}
+
+// truncates path and writes the magic, -1 with errno set on failure
+int capture_create(Capture *cap, const char *path) {
+  cap->file = fopen(path, "wb");
+  if (cap->file == NULL) return -1;
+  setvbuf(cap->file, NULL, _IOFBF, CAPTURE_BUF_LEN);
+  if (fwrite(CAPTURE_MAGIC, 1, 8, cap->file) != 8) {
+    fclose(cap->file);
+    cap->file = NULL;
+    return -1;
+  }
+  cap->start_ns = now_ns();
+  cap->records = 0;
+  cap->bytes = 0;
+  return 0;
+}
+
+int capture_write(Capture *cap, uint32_t conn, capture_kind_t kind,
+                  const char *data, size_t len)
+{
+  unsigned char header[CAPTURE_HEADER_LEN];
+  put_le(header, now_ns() - cap->start_ns, 8);
+  put_le(header + 8, conn, 4);
+  header[12] = (unsigned char) kind;
+  put_le(header + 13, len, 4);
+  if (fwrite(header, 1, sizeof(header), cap->file) != sizeof(header))
+    return -1;
+  if (len > 0 && fwrite(data, 1, len, cap->file) != len) return -1;
+  cap->records++;
+  cap->bytes += len;
+  return 0;
+}
+
+void capture_flush(Capture *cap) {
+  fflush(cap->file);
+}
+
+// opens a capture for reading, -1 when it cannot be read or is not one
+int capture_open(Capture *cap, const char *path) {
+  char magic[8];
+  cap->file = fopen(path, "rb");
+  if (cap->file == NULL) return -1;
+  if (fread(magic, 1, 8, cap->file) != 8 ||
+      memcmp(magic, CAPTURE_MAGIC, 8) != 0)
+  {
+    fclose(cap->file);
+    cap->file = NULL;
+    return -1;
+  }
+  cap->start_ns = 0;
+  cap->records = 0;
+  cap->bytes = 0;
+  return 0;
+}
+
+// next record and its payload (up to cap_len bytes) into data; 1 for a
+// record, 0 at the end (or a torn tail), -1 for a payload larger than data
+int capture_next(Capture *cap, CaptureRecord *rec, char *data, size_t cap_len)
+{
+  unsigned char header[CAPTURE_HEADER_LEN];
+  if (fread(header, 1, sizeof(header), cap->file) != sizeof(header))
+    return 0;
+  rec->ts_ns = get_le(header, 8);
+  rec->conn = (uint32_t) get_le(header + 8, 4);
+  rec->kind = (capture_kind_t) header[12];
+  rec->len = (uint32_t) get_le(header + 13, 4);
+  if (rec->len > cap_len) return -1;
+  if (rec->len > 0 && fread(data, 1, rec->len, cap->file) != rec->len)
+    return 0;
+  cap->records++;
+  cap->bytes += rec->len;
+  return 1;
+}
+
+void capture_close(Capture *cap) {
+  if (cap->file != NULL) fclose(cap->file);
+  cap->file = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+  Traffic capture for reproducible benchmarks. With `--capture <file>` the
+  host records every inbound frame (whatever one recv() returned) together
+  with the id of its connection and its arrival time, plus when connections
+  open and close. build/replay plays a capture back at a host:
+
+    ./build/run 9001 --capture prod.cap
+    ./build/replay prod.cap 127.0.0.1 9001          # original timing
+    ./build/replay prod.cap 127.0.0.1 9001 --fast   # as fast as possible
+
+  File: the 8 byte magic, then records of a 17 byte header followed by len
+  payload bytes (0 for open and close):
+
+    <u64 ns since the capture started><u32 conn id><u8 kind><u32 len>
+
+  All integers little endian, so a capture can move between machines.
+  Records are buffered and written out about once a second, a crash loses
+  at most that much; a torn record at the end is ignored when reading.
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC      "CHATCAP1"
+#define CAPTURE_HEADER_LEN 17
+#define CAPTURE_BUF_LEN    (1024 * 1024) // stdio buffer of the writer
+
+typedef enum {
+  CAPTURE_OPEN,
+  CAPTURE_FRAME,
+  CAPTURE_CLOSE,
+} capture_kind_t;
+
+typedef struct {
+  uint64_t ts_ns;
+  uint32_t conn;
+  capture_kind_t kind;
+  uint32_t len;
+} CaptureRecord;
+
+typedef struct {
+  FILE *file;
+  uint64_t start_ns; // writer: CLOCK_MONOTONIC at open
+  uint64_t records;
+  uint64_t bytes;    // payload bytes
+} Capture;
+
+int capture_create(Capture *, const char *);
+int capture_write(Capture *, uint32_t, capture_kind_t, const char *, size_t);
+void capture_flush(Capture *);
+int capture_open(Capture *, const char *);
+int capture_next(Capture *, CaptureRecord *, char *, size_t);
+void capture_close(Capture *);
+
+#endif // CAPTURE_H_
@@ -6,15 +6,35 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/stat.h>
 
 #define EXIT_CLIENT_IMPL
 #include "exit_handlers.h"
 #include "ui.h"
+#include "cache.h"
+#include "shm.h"
 
 #define PORT     9001
 #define BUF_SIZE 1024
+#define CACHE_PATH_DEFAULT "saves/feed.log"
+
+static int feed_row = 1;
+
+// one message per row, the oldest scroll off the top
+static void draw_received(const char *msg, size_t len, void *arg) {
+  WINDOW *win = arg;
+  int bottom = getmaxy(win) - 2;
+  if (len > 0 && msg[len - 1] == '\n') len--;
+  if (feed_row > bottom) {
+    wscrl(win, feed_row - bottom);
+    feed_row = bottom;
+  }
+  mvwprintw(win, feed_row++, 1, "%.*s", (int) len, msg);
+  wrefresh(win);
+}
 
 void set_non_blocking(int sock) {
   int opts;
@@ -24,28 +44,43 @@ void set_non_blocking(int sock) {
   if (fcntl(sock, F_SETFL, opts) < 0) EXIT_WITH(EXIT_CLIENT_F_SETFL);
 }
 
-int main() {
+int main(int argc, char **argv) {
   int sockfd;
-  struct sockaddr_in serv_addr;
-  struct hostent *server;
   char buffer[BUF_SIZE];
+  const char *cache_path = CACHE_PATH_DEFAULT;
+  for (int a = 1; a + 1 < argc; a++) {
+    if (strcmp(argv[a], "--cache") == 0) cache_path = argv[a + 1];
+  }
 
   on_exit(client_exit_handler, &sockfd);
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0) EXIT_WITH(EXIT_CLIENT_SOCKET_OPEN_FAIL);
+  if (argc > 2 && strcmp(argv[1], "--unix") == 0) {
+    // local sidecars skip the TCP/IP stack through the host's --unix-path
+    sockfd = unix_connect(argv[2]);
+    if (sockfd < 0)
+      EXIT_WITH(errno == ENAMETOOLONG ? EXIT_CLIENT_NO_HOST
+                                      : EXIT_CLIENT_CONNECT_FAIL);
+  } else {
+    struct sockaddr_in serv_addr;
+    struct hostent *server;
 
-  server = gethostbyname("localhost");
-  if (server == NULL) EXIT_WITH(EXIT_CLIENT_NO_HOST);
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) EXIT_WITH(EXIT_CLIENT_SOCKET_OPEN_FAIL);
 
-  memset(&serv_addr, 0, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  memcpy(&serv_addr.sin_addr.s_addr,
-         server->h_addr, (size_t) server->h_length);
-  serv_addr.sin_port = htons(PORT);
+    server = gethostbyname("localhost");
+    if (server == NULL) EXIT_WITH(EXIT_CLIENT_NO_HOST);
 
-  if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-    EXIT_WITH(EXIT_CLIENT_CONNECT_FAIL);
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    memcpy(&serv_addr.sin_addr.s_addr,
+           server->h_addr, (size_t) server->h_length);
+    serv_addr.sin_port = htons(PORT);
+
+    if (connect(sockfd, (struct sockaddr *) &serv_addr,
+                sizeof(serv_addr)) < 0)
+    {
+      EXIT_WITH(EXIT_CLIENT_CONNECT_FAIL);
+    }
   }
 
   set_non_blocking(sockfd);
@@ -61,24 +96,40 @@ int main() {
   init_colors();
   stdscr_border();
   WINDOW *w_master = create_master_win();
+  scrollok(w_master, TRUE);
+
+  // draw what we have on disk right away, then ask only for the rest
+  FeedCache cache;
+  if (strcmp(cache_path, CACHE_PATH_DEFAULT) == 0) mkdir("saves", 0700);
+  if (cache_open(&cache, cache_path, draw_received, w_master) < 0) {
+    cache.fd = -1; // runs without a cache, the host replays what it has
+    cache.last_seq = 0;
+  }
+  char sync[48];
+  int sync_len = snprintf(sync, sizeof(sync), "/sync %llu\n",
+                          (unsigned long long) cache.last_seq);
+  send(sockfd, sync, (size_t) sync_len, 0);
 
   #define POLL_FOREVER -1
-  int msg_id = 1;
   while (TRUE) {
     if (poll(fds, 2, POLL_FOREVER) < 0) EXIT_WITH(EXIT_CLIENT_POLL_ERROR);
     if (fds[1].revents & POLLIN) {
-      memset(buffer, 0, BUF_SIZE);
-      int n = (int) recv(sockfd, buffer, BUF_SIZE - 1, 0);
-      if (n > 0) mvwprintw(w_master, 1, 1, buffer);
-      else if (n == 0) EXIT_WITH(EXIT_CLIENT_SERVER_CLOSE);
+      int n = (int) recv(sockfd, buffer, BUF_SIZE, 0);
+      if (n > 0) {
+        cache_feed(&cache, buffer, (size_t) n, draw_received, w_master);
+      } else if (n == 0) {
+        EXIT_WITH(EXIT_CLIENT_SERVER_CLOSE);
+      }
     }
     switch (wgetch(w_master)) {
     case 'q': case KEY_ESC: exit(EXIT_SUCCESS);
     case KEY_F(1): {
+      char input_buffer[INPUT_MAX_LEN];
       WINDOW *w_input     = create_input_box(6, 50);
-      const char *msg_txt = handle_input(w_input);
+      const char *msg_txt = handle_input(w_input, input_buffer,
+                                         sizeof(input_buffer));
       if (msg_txt != NULL) {
-        msg_post_to_feed(w_master, msg_txt, ++msg_id);
+        msg_post_to_feed(w_master, msg_txt, feed_row++);
         if (fds[0].revents & POLLIN) {
           memset(buffer, 0, BUF_SIZE);
           if (fgets(buffer, BUF_SIZE, stdin) == NULL) break;
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+#include "host.h"
+#include "trace.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+void config_defaults(HostConfig *cfg) {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->port         = PORT_DEFAULT;
+  cfg->max_clients  = MAX_CLIENTS;
+  cfg->max_data_len = MAX_DATA_LEN;
+  cfg->timeout      = TIMEOUT;
+  cfg->profile      = PROFILE_DEFAULT;
+  cfg->queue_high   = QUEUE_HIGH_DEFAULT;
+  cfg->queue_low    = QUEUE_LOW_DEFAULT;
+  cfg->queue_client_max = QUEUE_CLIENT_MAX_DEFAULT;
+  cfg->read_frames  = READ_FRAMES_DEFAULT;
+  cfg->read_budget  = READ_BUDGET_DEFAULT;
+  strcpy(cfg->spool_dir, SPOOL_DIR_DEFAULT);
+  strcpy(cfg->trace_path, TRACE_PATH_DEFAULT);
+  strcpy(cfg->simd, SIMD_DEFAULT);
+  cfg->validate_utf8 = true;
+}
+
+const char *profile_name(profile_t profile) {
+  switch (profile) {
+  case PROFILE_DEFAULT:    return "default";
+  case PROFILE_LATENCY:    return "latency";
+  case PROFILE_THROUGHPUT: return "throughput";
+  }
+  return "unknown"; // unreachable
+}
+
+static void apply_profile(HostConfig *cfg, profile_t profile) {
+  cfg->profile = profile;
+  switch (profile) {
+  case PROFILE_DEFAULT:
+    cfg->nodelay   = false;
+    cfg->cork      = false;
+    cfg->sndbuf    = 0;
+    cfg->rcvbuf    = 0;
+    cfg->busy_poll = 0;
+    break;
+  case PROFILE_LATENCY: // chat lines are tiny, never let Nagle hold them
+    cfg->nodelay   = true;
+    cfg->cork      = false;
+    cfg->sndbuf    = 16 * 1024;
+    cfg->rcvbuf    = 16 * 1024;
+    cfg->busy_poll = 50;
+    break;
+  case PROFILE_THROUGHPUT: // full segments, one flush per loop iteration
+    cfg->nodelay   = false;
+    cfg->cork      = true;
+    cfg->sndbuf    = 1024 * 1024;
+    cfg->rcvbuf    = 1024 * 1024;
+    cfg->busy_poll = 0;
+    break;
+  }
+}
+
+static bool parse_bool(const char *key, const char *val, bool *out) {
+  if (strcmp(val, "1") == 0 || strcmp(val, "true") == 0 ||
+      strcmp(val, "yes") == 0 || strcmp(val, "on") == 0)
+  {
+    *out = true;
+  } else if (strcmp(val, "0") == 0 || strcmp(val, "false") == 0 ||
+             strcmp(val, "no") == 0 || strcmp(val, "off") == 0)
+  {
+    *out = false;
+  } else {
+    LOG_FROM_ERR("`%s` expects on or off, got `%s`\n", key, val);
+    return false;
+  }
+  return true;
+}
+
+static bool parse_long(const char *key, const char *val,
+                       long min, long max, long *out)
+{
+  char *end;
+  long n = strtol(val, &end, 10);
+  if (*val == '\0' || *end != '\0' || n < min || n > max) {
+    LOG_FROM_ERR("`%s` expects a number in [%ld, %ld], got `%s`\n",
+                 key, min, max, val);
+    return false;
+  }
+  *out = n;
+  return true;
+}
+
+// `0,2,4-7` -> bit mask, CPUs above 63 are not supported
+static int parse_cpu_list(const char *list, uint64_t *mask) {
+  *mask = 0;
+  const char *cur = list;
+  while (*cur != '\0') {
+    char *end;
+    long lo = strtol(cur, &end, 10), hi = lo;
+    if (end == cur) return -1;
+    if (*end == '-') {
+      cur = end + 1;
+      hi = strtol(cur, &end, 10);
+      if (end == cur) return -1;
+    }
+    if (lo < 0 || hi > 63 || lo > hi) return -1;
+    for (long cpu = lo; cpu <= hi; cpu++) *mask |= 1ull << cpu;
+    if (*end == ',') end++;
+    else if (*end != '\0') return -1;
+    cur = end;
+  }
+  return *mask == 0 ? -1 : 0;
+}
+
+static bool set_path(char *dst, const char *key, const char *val) {
+  if (strlen(val) >= CONFIG_MAX_PATH) {
+    LOG_FROM_ERR("`%s` path too long: %s\n", key, val);
+    return false;
+  }
+  strcpy(dst, val);
+  return true;
+}
+
+// returns false for keys that are not ours or values that do not parse,
+// both logged
+bool config_set(HostConfig *cfg, const char *key, const char *val) {
+  long n;
+  if (strcmp(key, "profile") == 0) {
+    for (profile_t p = PROFILE_DEFAULT; p <= PROFILE_THROUGHPUT; p++) {
+      if (strcmp(val, profile_name(p)) == 0) {
+        apply_profile(cfg, p);
+        return true;
+      }
+    }
+    LOG_FROM_ERR("unknown profile `%s`\n", val);
+    return false;
+  }
+  if (strcmp(key, "port") == 0) {
+    if (!parse_long(key, val, 1, UINT16_MAX, &n)) return false;
+    cfg->port = (uint16_t) n;
+  } else if (strcmp(key, "max-clients") == 0) {
+    if (!parse_long(key, val, 2, MAX_CLIENTS_CEIL, &n)) return false;
+    cfg->max_clients = (uint16_t) n;
+  } else if (strcmp(key, "max-data-len") == 0) {
+    if (!parse_long(key, val, 16, MAX_DATA_LEN_CEIL, &n)) return false;
+    cfg->max_data_len = (size_t) n;
+  } else if (strcmp(key, "timeout") == 0) {
+    if (!parse_long(key, val, -1, INT32_MAX, &n)) return false;
+    cfg->timeout = (int) n;
+  } else if (strcmp(key, "unix-path") == 0) {
+    return set_path(cfg->unix_path, key, val);
+  } else if (strcmp(key, "shm-path") == 0) {
+    return set_path(cfg->shm_path, key, val);
+  } else if (strcmp(key, "transfer-port") == 0) {
+    if (!parse_long(key, val, 0, UINT16_MAX, &n)) return false;
+    cfg->transfer_port = (uint16_t) n;
+  } else if (strcmp(key, "spool-dir") == 0) {
+    return set_path(cfg->spool_dir, key, val);
+  } else if (strcmp(key, "nodelay") == 0) {
+    return parse_bool(key, val, &cfg->nodelay);
+  } else if (strcmp(key, "cork") == 0) {
+    return parse_bool(key, val, &cfg->cork);
+  } else if (strcmp(key, "sndbuf") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->sndbuf = (int) n;
+  } else if (strcmp(key, "rcvbuf") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->rcvbuf = (int) n;
+  } else if (strcmp(key, "busy-poll") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->busy_poll = (int) n;
+  } else if (strcmp(key, "splice-threshold") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->splice_threshold = (size_t) n;
+  } else if (strcmp(key, "rate-msgs") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->rate_msgs = (int) n;
+  } else if (strcmp(key, "rate-bytes") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->rate_bytes = (int) n;
+  } else if (strcmp(key, "queue-high") == 0) {
+    if (!parse_long(key, val, 4096, INT32_MAX, &n)) return false;
+    cfg->queue_high = (size_t) n;
+  } else if (strcmp(key, "queue-low") == 0) {
+    if (!parse_long(key, val, 0, INT32_MAX, &n)) return false;
+    cfg->queue_low = (size_t) n;
+  } else if (strcmp(key, "queue-client-max") == 0) {
+    if (!parse_long(key, val, 4096, INT32_MAX, &n)) return false;
+    cfg->queue_client_max = (size_t) n;
+  } else if (strcmp(key, "read-frames") == 0) {
+    if (!parse_long(key, val, 1, 1024, &n)) return false;
+    cfg->read_frames = (int) n;
+  } else if (strcmp(key, "read-budget") == 0) {
+    if (!parse_long(key, val, 16, INT32_MAX, &n)) return false;
+    cfg->read_budget = (size_t) n;
+  } else if (strcmp(key, "trace") == 0) {
+    return parse_bool(key, val, &cfg->trace);
+  } else if (strcmp(key, "trace-path") == 0) {
+    return set_path(cfg->trace_path, key, val);
+  } else if (strcmp(key, "capture") == 0) {
+    return set_path(cfg->capture_path, key, val);
+  } else if (strcmp(key, "filter") == 0) {
+    return set_path(cfg->filter_path, key, val);
+  } else if (strcmp(key, "simd") == 0) {
+    if (strcmp(val, "auto") != 0 && strcmp(val, "avx2") != 0 &&
+        strcmp(val, "sse2") != 0 && strcmp(val, "scalar") != 0)
+    {
+      LOG_FROM_ERR("`%s` expects auto, avx2, sse2 or scalar, got `%s`\n",
+                   key, val);
+      return false;
+    }
+    strcpy(cfg->simd, val);
+  } else if (strcmp(key, "validate-utf8") == 0) {
+    return parse_bool(key, val, &cfg->validate_utf8);
+  } else if (strcmp(key, "timestamps") == 0) {
+    return parse_bool(key, val, &cfg->timestamps);
+  } else if (strcmp(key, "watchdog-ms") == 0) {
+    if (!parse_long(key, val, 0, 60000, &n)) return false;
+    cfg->watchdog_ms = (int) n;
+  } else if (strcmp(key, "low-latency") == 0) {
+    if (!parse_bool(key, val, &cfg->low_latency)) return false;
+    if (cfg->low_latency && cfg->spin_us == 0) cfg->spin_us = SPIN_US_DEFAULT;
+  } else if (strcmp(key, "cpus") == 0) {
+    if (parse_cpu_list(val, &cfg->cpu_mask) < 0) {
+      LOG_FROM_ERR("`%s` expects a cpu list like 0,2-3, got `%s`\n", key, val);
+      return false;
+    }
+  } else if (strcmp(key, "spin-us") == 0) {
+    if (!parse_long(key, val, 0, 1000000, &n)) return false;
+    cfg->spin_us = (int) n;
+  } else {
+    LOG_FROM_ERR("unknown setting `%s`\n", key);
+    return false;
+  }
+  return true;
+}
+
+static char *trim(char *str) {
+  while (isspace((unsigned char) *str)) str++;
+  char *end = str + strlen(str);
+  while (end > str && isspace((unsigned char) end[-1])) *--end = '\0';
+  return str;
+}
+
+// `key = value` per line, `#` starts a comment
+int config_load_file(HostConfig *cfg, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    LOG_FROM_ERR("cannot open config file %s\n", path);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+  char line[CONFIG_MAX_LINE];
+  int line_no = 0, errors = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_no++;
+    char *hash = strchr(line, '#');
+    if (hash != NULL) *hash = '\0';
+    char *key = trim(line);
+    if (*key == '\0') continue;
+    char *eq = strchr(key, '=');
+    if (eq == NULL) {
+      LOG_FROM_ERR("%s:%d: expected `key = value`\n", path, line_no);
+      errors++;
+      continue;
+    }
+    *eq = '\0';
+    key = trim(key);
+    if (!config_set(cfg, key, trim(eq + 1))) {
+      LOG_FROM_ERR("%s:%d: bad setting `%s`\n", path, line_no, key);
+      errors++;
+    }
+  }
+  fclose(file);
+  return errors == 0 ? 0 : -1;
+}
+
+// flags read by other modules (relay_setup_from_args()), each with a value
+static const char *foreign_flags[] = { "relay-id", "relay-port", "peer" };
+
+static bool is_foreign(const char *key) {
+  for (size_t f = 0; f < sizeof(foreign_flags) / sizeof(*foreign_flags); f++)
+    if (strcmp(key, foreign_flags[f]) == 0) return true;
+  return false;
+}
+
+// --config is read first wherever it appears, flags then override the file.
+// Like the file, any unknown flag, bad value or stray argument (argv[1] is
+// the port) is an error, all of them are logged before -1 is returned.
+int config_from_args(HostConfig *cfg, int argc, char **argv) {
+  const char *file = arg_value(argc, argv, "--config");
+  if (file != NULL && config_load_file(cfg, file) < 0) {
+    LOG_FROM_ERR("invalid config file %s\n", file);
+    return -1;
+  }
+  int errors = 0;
+  for (int a = argc > 1 && argv[1][0] != '-' ? 2 : 1; a < argc; a++) {
+    if (strncmp(argv[a], "--", 2) != 0) {
+      LOG_FROM_ERR("unexpected argument `%s`\n", argv[a]);
+      errors++;
+      continue;
+    }
+    const char *key = argv[a] + 2;
+    // valueless flags are booleans switched on
+    bool has_val = a + 1 < argc && strncmp(argv[a + 1], "--", 2) != 0;
+    if (strcmp(key, "config") == 0 || is_foreign(key)) {
+      if (has_val) {
+        a++;
+      } else {
+        LOG_FROM_ERR("`--%s` expects a value\n", key);
+        errors++;
+      }
+      continue;
+    }
+    if (!config_set(cfg, key, has_val ? argv[a + 1] : "1")) {
+      LOG_FROM_ERR("bad flag `--%s`\n", key);
+      errors++;
+    }
+    if (has_val) a++;
+  }
+  return errors == 0 ? 0 : -1;
+}
+
+void config_log(const HostConfig *cfg) {
+  LOG_FROM_SUCC("port %u, profile `%s`\n", cfg->port,
+                profile_name(cfg->profile));
+  LOG_APPEND("max clients %u, max data len %zu, timeout %d ms\n",
+             cfg->max_clients, cfg->max_data_len, cfg->timeout);
+  if (cfg->transfer_port != 0)
+    LOG_APPEND("file transfers on port %u, spool %s\n",
+               cfg->transfer_port, cfg->spool_dir);
+  LOG_APPEND("nodelay %d, cork %d, sndbuf %d, rcvbuf %d, busy poll %d us\n",
+             cfg->nodelay, cfg->cork, cfg->sndbuf, cfg->rcvbuf,
+             cfg->busy_poll);
+  LOG_APPEND("splice threshold %zu bytes\n", cfg->splice_threshold);
+  LOG_APPEND("rate limit per client %d msgs/s, %d bytes/s (0: none)\n",
+             cfg->rate_msgs, cfg->rate_bytes);
+  LOG_APPEND("outbound queues hold producers at %zu, release at %zu, "
+             "%zu per receiver\n",
+             cfg->queue_high, cfg->queue_low, cfg->queue_client_max);
+  LOG_APPEND("read budget per client and pass %d reads, %zu bytes\n",
+             cfg->read_frames, cfg->read_budget);
+  if (cfg->capture_path[0] != '\0')
+    LOG_APPEND("capturing inbound traffic to %s\n", cfg->capture_path);
+  if (cfg->filter_path[0] != '\0')
+    LOG_APPEND("filtering messages with the patterns in %s\n",
+               cfg->filter_path);
+  if (cfg->trace) LOG_APPEND("tracing messages to %s\n", cfg->trace_path);
+  LOG_APPEND("scan kernels %s, utf-8 validation %d\n",
+             cfg->simd, cfg->validate_utf8);
+  if (cfg->watchdog_ms > 0)
+    LOG_APPEND("watchdog threshold %d ms\n", cfg->watchdog_ms);
+  if (cfg->timestamps)
+    LOG_APPEND("kernel socket timestamps on TCP clients\n");
+  LOG_APPEND("low latency %d, cpu mask %#lx, spin %d us\n",
+             cfg->low_latency, (unsigned long) cfg->cpu_mask, cfg->spin_us);
+}
@@ -0,0 +1,84 @@
+/*
+  Runtime configuration of the host, replaces rebuilding with different
+  macros. Settings are resolved in order: compiled defaults, then the file
+  given by --config, then command line flags. Both use the same keys:
+
+    # host.conf
+    profile      = throughput
+    max-clients  = 64
+    sndbuf       = 1048576
+
+    ./build/run 9001 --config host.conf --profile latency --rcvbuf 65536
+
+  Selecting a profile overwrites the socket settings with its preset, keys
+  that come after it still override single values. Unknown keys and values
+  that do not parse are errors in the file and on the command line alike,
+  the host does not start with a half-applied configuration.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CONFIG_MAX_LINE 256
+#define CONFIG_MAX_PATH 108 // sizeof(sun_path)
+#define SPIN_US_DEFAULT 100 // what --low-latency spins unless told otherwise
+#define SPOOL_DIR_DEFAULT "spool"
+#define SIMD_DEFAULT "auto"
+
+typedef enum {
+  PROFILE_DEFAULT,    // leave the kernel alone
+  PROFILE_LATENCY,    // nodelay, busy polling, small buffers
+  PROFILE_THROUGHPUT, // corked sockets flushed once per loop iteration
+} profile_t;
+
+typedef struct HostConfig {
+  uint16_t port;
+  uint16_t max_clients;  // includes the TCP listener, like MAX_CLIENTS
+  size_t max_data_len;   // bytes read per recv, at most MAX_DATA_LEN_CEIL
+  int timeout;           // ms without any traffic before the host gives up
+  char unix_path[CONFIG_MAX_PATH]; // empty: no AF_UNIX listener
+  char shm_path[CONFIG_MAX_PATH];  // empty: no shared-memory listener
+  uint16_t transfer_port;          // 0: no file transfers, see transfer.h
+  char spool_dir[CONFIG_MAX_PATH]; // where uploads are kept
+
+  profile_t profile;
+  bool nodelay;          // TCP_NODELAY
+  bool cork;             // TCP_CORK, uncorked at the end of each iteration
+  int sndbuf;            // SO_SNDBUF, 0 keeps the kernel default
+  int rcvbuf;            // SO_RCVBUF, 0 keeps the kernel default
+  int busy_poll;         // SO_BUSY_POLL in usec, 0 disables
+  size_t splice_threshold; // pending bytes that switch a sender to
+                           // splice()/tee() fan-out, 0 disables
+  int rate_msgs;         // per-client messages/sec, 0: unlimited
+  int rate_bytes;        // per-client bytes/sec, 0: unlimited
+  size_t queue_high;     // queued outbound bytes that hold producers
+  size_t queue_low;      // ... and that release them again
+  size_t queue_client_max; // outbound bytes queued for one receiver at most
+  int read_frames;       // reads per client per loop pass at most
+  size_t read_budget;    // bytes per client per loop pass at most
+  bool trace;            // per-message stage tracing, see trace.h
+  char trace_path[CONFIG_MAX_PATH]; // written on SIGUSR2
+  char capture_path[CONFIG_MAX_PATH]; // empty: no capture, see capture.h
+  char filter_path[CONFIG_MAX_PATH];  // empty: no filter, see filter.h
+  char simd[8];          // scan kernels: auto, avx2, sse2 or scalar
+  bool validate_utf8;    // drop user frames that are not UTF-8, see scan.h
+  int watchdog_ms;       // loop passes busy longer get reported, 0: off
+  bool timestamps;       // kernel RX/TX stamps on TCP clients, see tstamp.h
+
+  bool low_latency;      // see lowlat.h
+  uint64_t cpu_mask;     // CPUs for the event loop and helpers, 0: any
+  int spin_us;           // busy-poll budget before blocking in poll()
+} HostConfig;
+
+void config_defaults(HostConfig *);
+bool config_set(HostConfig *, const char *, const char *);
+int config_load_file(HostConfig *, const char *);
+int config_from_args(HostConfig *, int, char **);
+const char *profile_name(profile_t);
+void config_log(const HostConfig *);
+
+#endif // CONFIG_H_
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coro.h"
+
+#define CORO_CAP_INITIAL 64
+
+int64_t coro_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int coro_sched_init(CoroSched *sched) {
+  sched->n = 0;
+  sched->cap = CORO_CAP_INITIAL;
+  sched->resumes = 0;
+  sched->coros = malloc((size_t) sched->cap * sizeof(Coro *));
+  sched->pfds = malloc((size_t) sched->cap * sizeof(struct pollfd));
+  if (sched->coros == NULL || sched->pfds == NULL) {
+    free(sched->coros);
+    free(sched->pfds);
+    return -1;
+  }
+  return 0;
+}
+
+// handlers still suspended are dropped without running to the end, their
+// state is the caller's to free
+void coro_sched_destroy(CoroSched *sched) {
+  for (int i = 0; i < sched->n; i++) free(sched->coros[i]);
+  free(sched->coros);
+  free(sched->pfds);
+  sched->coros = NULL;
+  sched->pfds = NULL;
+  sched->n = sched->cap = 0;
+}
+
+void coro_wait_fd(Coro *co, int fd, short events) {
+  co->fd = fd;
+  co->events = events;
+}
+
+void coro_wait_us(Coro *co, int64_t us) {
+  co->wake_us = coro_now_us() + (us > 0 ? us : 0);
+}
+
+static bool waiting(const Coro *co) {
+  return co->fd >= 0 || co->wake_us != 0 || co->ready;
+}
+
+// runs co up to its next suspension; false once it finished
+static bool step(CoroSched *sched, Coro *co) {
+  co->fd = -1;
+  co->events = 0;
+  co->wake_us = 0;
+  co->ready = false;
+  sched->resumes++;
+  return co->fn(co) == CORO_PENDING;
+}
+
+// starts fn(arg) right away, up to its first suspension; NULL when out of
+// memory or when it already finished (nothing to keep then)
+Coro *coro_spawn(CoroSched *sched, coro_fn fn, void *arg) {
+  if (sched->n == sched->cap) {
+    int cap = sched->cap * 2;
+    Coro **coros = realloc(sched->coros, (size_t) cap * sizeof(Coro *));
+    if (coros == NULL) return NULL;
+    sched->coros = coros;
+    struct pollfd *pfds = realloc(sched->pfds,
+                                  (size_t) cap * sizeof(struct pollfd));
+    if (pfds == NULL) return NULL;
+    sched->pfds = pfds;
+    sched->cap = cap;
+  }
+  Coro *co = calloc(1, sizeof(Coro));
+  if (co == NULL) return NULL;
+  co->fn = fn;
+  co->arg = arg;
+  co->sched = sched;
+  if (!step(sched, co) || !waiting(co)) {
+    free(co);
+    return NULL;
+  }
+  sched->coros[sched->n++] = co;
+  return co;
+}
+
+// one poll() over every suspended handler, waiting at most timeout_ms (-1:
+// until something happens), then resumes those whose wait is over. Returns
+// how many were resumed, -1 when poll() failed
+int coro_sched_run_once(CoroSched *sched, int timeout_ms) {
+  int n = sched->n; // handlers spawned during this pass wait for the next
+  if (n == 0) return 0;
+  int64_t now = coro_now_us(), next_wake = 0;
+  for (int i = 0; i < n; i++) {
+    Coro *co = sched->coros[i];
+    sched->pfds[i].fd = co->fd;
+    sched->pfds[i].events = co->events;
+    sched->pfds[i].revents = 0;
+    if (co->ready) next_wake = now;
+    if (co->wake_us != 0 && (next_wake == 0 || co->wake_us < next_wake))
+      next_wake = co->wake_us;
+  }
+  if (next_wake != 0) {
+    int64_t ms = next_wake > now ? (next_wake - now + 999) / 1000 : 0;
+    if (timeout_ms < 0 || ms < timeout_ms) timeout_ms = (int) ms;
+  }
+  if (poll(sched->pfds, (nfds_t) n, timeout_ms) < 0 && errno != EINTR)
+    return -1;
+
+  now = coro_now_us();
+  int resumed = 0;
+  for (int i = 0; i < n; i++) {
+    Coro *co = sched->coros[i];
+    bool due = co->ready || sched->pfds[i].revents != 0 ||
+               (co->wake_us != 0 && co->wake_us <= now);
+    if (!due) continue;
+    resumed++;
+    if (step(sched, co) && waiting(co)) continue;
+    free(co); // finished, or suspended on nothing and never coming back
+    sched->coros[i] = NULL;
+  }
+  // close the gaps, keeping the order so nobody is starved
+  int kept = 0;
+  for (int i = 0; i < sched->n; i++) {
+    if (sched->coros[i] != NULL) sched->coros[kept++] = sched->coros[i];
+  }
+  sched->n = kept;
+  return resumed;
+}
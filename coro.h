@@ -0,0 +1,150 @@
+/*
+  Stackless coroutines on a poll() loop: connection handlers written as
+  straight-line code, the way a thread per client would run them, at the
+  cost of one small struct per handler instead of a thread and its stack.
+
+    typedef struct { int fd; size_t len; char buf[256]; } Echo;
+
+    static int echo(Coro *co) {
+      Echo *e = co->arg;
+      CORO_BEGIN(co);
+      for (;;) {
+        CORO_RECV(co, e->fd, e->buf, sizeof(e->buf));
+        if (co->result <= 0) break;
+        e->len = (size_t) co->result;
+        CORO_SEND(co, e->fd, e->buf, e->len);
+        if (co->result < 0) break;
+      }
+      close(e->fd);
+      free(e);
+      CORO_END(co);
+    }
+
+    CoroSched sched;
+    coro_sched_init(&sched);
+    coro_spawn(&sched, echo, e);
+    while (sched.n > 0) coro_sched_run_once(&sched, -1);
+
+  A handler returns whenever it would block and is called again where it
+  left off (a switch on the line it stopped at, like Duff's device), once
+  its descriptor is ready or its sleep is over. Consequences:
+
+  - locals do not survive a suspension, keep state in *arg
+  - buffers and lengths given to CORO_RECV/CORO_SEND are evaluated again
+    after every suspension, they must live in *arg as well
+  - at most one CORO_* await per source line, no awaits inside a switch
+  - a handler must not return any other way than through CORO_END
+
+  The awaits pass MSG_DONTWAIT, descriptors may stay blocking. Handlers
+  may spawn others (an accept loop spawning one per connection).
+  coro.c is free of log.h so standalone tools can link it.
+ */
+
+#ifndef CORO_H_
+#define CORO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define CORO_PENDING 0 // suspended, waiting for what it asked for
+#define CORO_DONE    1
+
+typedef struct Coro Coro;
+typedef struct CoroSched CoroSched;
+typedef int (*coro_fn)(Coro *);
+
+struct Coro {
+  coro_fn fn;
+  void *arg;        // the handler's state
+  int resume;       // line to continue at, 0: from the top
+  ssize_t result;   // of the last CORO_RECV/CORO_SEND
+  size_t sent;      // progress of a CORO_SEND across suspensions
+  int fd;           // waiting for events on it, -1: on no descriptor
+  short events;
+  int64_t wake_us;  // CLOCK_MONOTONIC deadline of a sleep, 0: none
+  bool ready;       // CORO_YIELD: run again on the next pass
+  CoroSched *sched;
+};
+
+struct CoroSched {
+  Coro **coros;
+  struct pollfd *pfds; // [i] belongs to coros[i], rebuilt every pass
+  int n;
+  int cap;
+  uint64_t resumes;    // handler calls, for stats
+};
+
+int coro_sched_init(CoroSched *);
+void coro_sched_destroy(CoroSched *);
+Coro *coro_spawn(CoroSched *, coro_fn, void *);
+int coro_sched_run_once(CoroSched *, int);
+int64_t coro_now_us(void);
+void coro_wait_fd(Coro *, int, short);
+void coro_wait_us(Coro *, int64_t);
+
+#define CORO_BEGIN(co) switch ((co)->resume) { case 0:
+
+#define CORO_END(co) } (co)->resume = -1; return CORO_DONE
+
+// suspends and comes back here after the wait set up right before
+#define CORO_SUSPEND_(co) \
+  (co)->resume = __LINE__; return CORO_PENDING; case __LINE__:
+
+// lets the others run, continues on the next pass
+#define CORO_YIELD(co)   \
+  do {                   \
+    (co)->ready = true;  \
+    CORO_SUSPEND_(co);   \
+  } while (0)
+
+#define CORO_SLEEP_MS(co, ms)                  \
+  do {                                         \
+    coro_wait_us(co, (int64_t) (ms) * 1000);   \
+    CORO_SUSPEND_(co);                         \
+  } while (0)
+
+// waits for events on fd without doing the I/O, e.g. before accept()
+#define CORO_AWAIT(co, fd, ev)   \
+  do {                           \
+    coro_wait_fd(co, fd, ev);    \
+    CORO_SUSPEND_(co);           \
+  } while (0)
+
+// co->result: bytes read, 0 on hang up, -1 on error (errno set)
+#define CORO_RECV(co, fd, buf, len)                                      \
+  do {                                                                   \
+    while (((co)->result = recv(fd, buf, len, MSG_DONTWAIT)) < 0 &&      \
+           (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))  \
+    {                                                                    \
+      coro_wait_fd(co, fd, POLLIN);                                      \
+      CORO_SUSPEND_(co);                                                 \
+    }                                                                    \
+  } while (0)
+
+// sends all len bytes; co->result: len, or -1 on error (errno set)
+#define CORO_SEND(co, fd, buf, len)                                      \
+  do {                                                                   \
+    (co)->sent = 0;                                                      \
+    (co)->result = 0;                                                    \
+    while ((co)->sent < (size_t) (len)) {                                \
+      (co)->result = send(fd, (const char *) (buf) + (co)->sent,         \
+                          (size_t) (len) - (co)->sent,                   \
+                          MSG_DONTWAIT | MSG_NOSIGNAL);                  \
+      if ((co)->result >= 0) {                                           \
+        (co)->sent += (size_t) (co)->result;                             \
+        continue;                                                        \
+      }                                                                  \
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)     \
+        break;                                                           \
+      coro_wait_fd(co, fd, POLLOUT);                                     \
+      CORO_SUSPEND_(co);                                                 \
+    }                                                                    \
+    if ((co)->result >= 0) (co)->result = (ssize_t) (co)->sent;          \
+  } while (0)
+
+#endif // CORO_H_
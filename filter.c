@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include "filter.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+typedef struct {
+  char **lines;
+  size_t n;
+  size_t cap;
+  size_t bytes;
+} Patterns;
+
+static void patterns_free(Patterns *pats) {
+  for (size_t p = 0; p < pats->n; p++) free(pats->lines[p]);
+  free(pats->lines);
+}
+
+static int patterns_read(Patterns *pats, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    LOG_FROM_ERR("cannot open filter file %s\n", path);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+  char line[FILTER_MAX_LINE + 2]; // room for the newline and the NUL
+  int line_no = 0, rv = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_no++;
+    size_t len = strcspn(line, "\r\n");
+    if (line[len] == '\0' && !feof(file)) {
+      LOG_FROM_ERR("%s:%d: pattern longer than %d bytes\n", path, line_no,
+                   FILTER_MAX_LINE);
+      rv = -1;
+      break;
+    }
+    line[len] = '\0';
+    if (len == 0 || line[0] == '#') continue;
+    if (pats->n == pats->cap) {
+      size_t cap = pats->cap > 0 ? pats->cap * 2 : 64;
+      char **lines = realloc(pats->lines, cap * sizeof(char *));
+      if (lines == NULL) {
+        LOG_FROM_ERR("null pointer allocating %zu patterns\n", cap);
+        rv = -1;
+        break;
+      }
+      pats->lines = lines;
+      pats->cap = cap;
+    }
+    if ((pats->lines[pats->n] = strdup(line)) == NULL) {
+      LOG_FROM_ERR("null pointer copying pattern\n");
+      rv = -1;
+      break;
+    }
+    pats->n++;
+    pats->bytes += len;
+  }
+  fclose(file);
+  return rv;
+}
+
+static uint8_t fold(unsigned char b) {
+  return (uint8_t) tolower(b);
+}
+
+// trie of the patterns in next, then every missing edge is replaced by the
+// one its failure state takes, breadth first, so each state has all of them
+static void build_automaton(Filter *f, const Patterns *pats, uint8_t *accept,
+                            uint32_t *fail, uint32_t *queue)
+{
+  const uint32_t k = f->n_classes;
+  for (size_t p = 0; p < pats->n; p++) {
+    uint32_t s = 0;
+    for (const unsigned char *b = (const unsigned char *) pats->lines[p];
+         *b != '\0'; b++)
+    {
+      uint32_t *edge = &f->next[s * k + f->classes[*b]];
+      if (*edge == 0) *edge = f->n_states++;
+      s = *edge;
+    }
+    accept[s] = 1;
+  }
+
+  uint32_t head = 0, tail = 0;
+  fail[0] = 0;
+  queue[tail++] = 0;
+  while (head < tail) {
+    uint32_t s = queue[head++];
+    for (uint32_t c = 0; c < k; c++) {
+      uint32_t *edge = &f->next[s * k + c];
+      uint32_t via_fail = s == 0 ? 0 : f->next[fail[s] * k + c];
+      if (*edge == 0) {
+        *edge = via_fail;
+        continue;
+      }
+      fail[*edge] = via_fail;
+      accept[*edge] |= accept[via_fail];
+      queue[tail++] = *edge;
+    }
+  }
+  // rows instead of state numbers save a multiply per byte when matching
+  for (size_t e = 0; e < (size_t) f->n_states * k; e++) {
+    uint32_t to = f->next[e];
+    f->next[e] = to * k | (accept[to] ? FILTER_ACCEPT : 0);
+  }
+}
+
+// compiles the pattern file at path, NULL (logged) when it cannot be read
+// or is too large
+Filter *filter_load(const char *path) {
+  Patterns pats = { NULL, 0, 0, 0 };
+  if (patterns_read(&pats, path) < 0) {
+    patterns_free(&pats);
+    return NULL;
+  }
+  if (pats.bytes + 1 > FILTER_MAX_STATES) {
+    LOG_FROM_ERR("%s: %zu pattern bytes, at most %u\n", path, pats.bytes,
+                 FILTER_MAX_STATES - 1);
+    patterns_free(&pats);
+    return NULL;
+  }
+
+  Filter *f = calloc(1, sizeof(Filter));
+  if (f == NULL) {
+    LOG_FROM_ERR("null pointer allocating %s\n", "(Filter *)");
+    patterns_free(&pats);
+    return NULL;
+  }
+  f->n_patterns = pats.n;
+  f->n_classes = 1;
+  for (size_t p = 0; p < pats.n; p++) {
+    for (const unsigned char *b = (const unsigned char *) pats.lines[p];
+         *b != '\0'; b++)
+    {
+      uint8_t lower = fold(*b);
+      if (f->classes[lower] == 0) f->classes[lower] = (uint8_t) f->n_classes++;
+    }
+  }
+  for (int b = 0; b < 256; b++) f->classes[b] = f->classes[fold((uint8_t) b)];
+
+  size_t max_states = pats.bytes + 1;
+  f->next = calloc(max_states * f->n_classes, sizeof(uint32_t));
+  uint8_t *accept = calloc(max_states, 1);
+  uint32_t *fail = malloc(max_states * sizeof(uint32_t));
+  uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+  if (f->next == NULL || accept == NULL || fail == NULL || queue == NULL) {
+    LOG_FROM_ERR("null pointer allocating %zu filter states\n", max_states);
+    free(accept);
+    free(fail);
+    free(queue);
+    filter_free(f);
+    patterns_free(&pats);
+    return NULL;
+  }
+  f->n_states = 1;
+  build_automaton(f, &pats, accept, fail, queue);
+  free(accept);
+  free(fail);
+  free(queue);
+  patterns_free(&pats);
+
+  // shared prefixes leave part of the table unused
+  uint32_t *next = realloc(f->next, (size_t) f->n_states * f->n_classes
+                                    * sizeof(uint32_t));
+  if (next != NULL) f->next = next;
+
+  for (int b = 0; b < 256; b++) {
+    if (f->next[f->classes[b]] == 0) continue;
+    if (f->n_first == SCAN_SET_MAX) { // too many to compare against
+      f->n_first = 0;
+      break;
+    }
+    f->first[f->n_first++] = (uint8_t) b;
+  }
+  return f;
+}
+
+void filter_free(Filter *f) {
+  if (f == NULL) return;
+  free(f->next);
+  free(f);
+}
+
+// true when any pattern occurs in buf
+bool filter_match(Filter *f, const char *buf, size_t len) {
+  const unsigned char *s = (const unsigned char *) buf;
+  f->scanned += len;
+  if (f->n_patterns == 0) return false;
+  uint32_t row = 0;
+  bool prefilter = f->n_first > 0;
+  int short_skips = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (row == 0 && prefilter) { // nothing to do until a first byte
+      size_t skip = scan_find_any(buf + i, len - i, f->first, f->n_first);
+      // first bytes are common in this text, plain walking is cheaper
+      if (skip < FILTER_SKIP_MIN && ++short_skips == FILTER_SHORT_SKIPS)
+        prefilter = false;
+      i += skip;
+      if (i == len) break;
+    }
+    row = f->next[row + f->classes[s[i]]];
+    if (row & FILTER_ACCEPT) {
+      f->hits++;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,58 @@
+/*
+  Content filter: messages from users that contain a banned term or link are
+  dropped before broadcast_all() fans them out. Patterns come one per line
+  from the file given by `--filter`, blank lines and lines starting with #
+  are skipped, matching ignores ASCII case:
+
+    # filter.txt
+    buy followers
+    bit.ly/
+
+    ./build/run 9001 --filter filter.txt
+    kill -HUP <pid>   # edit filter.txt, then reload it without a restart
+
+  The patterns are compiled into one Aho-Corasick automaton, flattened into
+  a DFA over byte classes, so matching costs one table lookup per byte no
+  matter how many patterns are loaded. While the automaton sits at its root
+  only a pattern's first byte can move it; with few distinct first bytes
+  (SCAN_SET_MAX, both cases counted) scan_find_any() skips to the next one
+  with SIMD compares instead of walking byte by byte.
+
+  A reload builds a new filter and swaps it in only if the file compiled,
+  a broken file keeps the old one. Each frame is screened on its own, a
+  pattern split across two reads of a client is not seen.
+ */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "scan.h"
+
+#define FILTER_MAX_LINE 256 // longest pattern
+#define FILTER_MAX_STATES (1u << 22) // ~ 4M pattern bytes in total
+#define FILTER_ACCEPT (1u << 31)
+#define FILTER_SKIP_MIN    16 // prefilter skips shorter than this ...
+#define FILTER_SHORT_SKIPS 4  // ... turn it off for the rest of a frame
+
+typedef struct {
+  uint32_t n_states;
+  uint32_t n_classes;    // class 0: bytes that appear in no pattern
+  uint8_t classes[256];  // byte -> class, ASCII case folded
+  uint32_t *next;        // [row + class]: row of the next state, that is
+                         // state * n_classes, | FILTER_ACCEPT where a
+                         // pattern ends
+  uint8_t first[SCAN_SET_MAX]; // what the root leaves on, for the prefilter
+  int n_first;           // 0: too many first bytes, no prefilter
+  size_t n_patterns;
+  uint64_t scanned;      // bytes screened
+  uint64_t hits;         // frames that matched
+} Filter;
+
+Filter *filter_load(const char *);
+void filter_free(Filter *);
+bool filter_match(Filter *, const char *, size_t);
+
+#endif // FILTER_H_
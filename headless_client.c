@@ -6,11 +6,15 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 
+#include "shm.h"
+
 #define PORT     9001
 #define BUF_SIZE 1024
+#define POLL_FOREVER -1
 
 typedef enum {
   EXIT_CLIENT_F_GETFL = 100,
@@ -54,28 +58,81 @@ void set_non_blocking(int sock) {
   if (fcntl(sock, F_SETFL, opts) < 0) exit(EXIT_CLIENT_F_SETFL);
 }
 
-int main() {
+// same-host transport: messages go through the shared rings, poll() only
+// ever sleeps on stdin and the host's doorbell
+static int run_over_shm(const char *path) {
+  ShmChannel ch;
+  char buffer[BUF_SIZE];
+  if (shm_connect(path, &ch) < 0) exit(EXIT_CLIENT_CONNECT_FAIL);
+  shm_channel_arm(&ch);
+
+  struct pollfd fds[2];
+  fds[0].fd     = STDIN_FILENO;
+  fds[0].events = POLLIN;
+  fds[1].fd     = ch.rx_bell;
+  fds[1].events = POLLIN;
+
+  while (true) {
+    if (poll(fds, 2, POLL_FOREVER) < 0) exit(EXIT_CLIENT_POLL_ERROR);
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      memset(buffer, 0, BUF_SIZE);
+      if (fgets(buffer, BUF_SIZE, stdin) == NULL) break;
+      if (shm_channel_write(&ch, buffer, strlen(buffer)) < 0) {
+        exit(EXIT_CLIENT_SERVER_CLOSE);
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      ssize_t n;
+      do {
+        shm_channel_drain_bell(&ch);
+        memset(buffer, 0, BUF_SIZE);
+        while ((n = shm_channel_read(&ch, buffer, BUF_SIZE - 1)) > 0) {
+          printf("Received: %s", buffer);
+          memset(buffer, 0, BUF_SIZE);
+        }
+      } while (n == 0 && !shm_channel_arm(&ch));
+      if (n < 0) exit(EXIT_CLIENT_SERVER_CLOSE);
+    }
+  }
+  shm_channel_close(&ch);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2 && strcmp(argv[1], "--shm") == 0) return run_over_shm(argv[2]);
+
   int sockfd;
-  struct sockaddr_in serv_addr;
-  struct hostent *server;
   char buffer[BUF_SIZE];
 
   on_exit(client_exit_handler, &sockfd);
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0) exit(EXIT_CLIENT_SOCKET_OPEN_FAIL);
+  if (argc > 2 && strcmp(argv[1], "--unix") == 0) {
+    // local sidecars skip the TCP/IP stack through the host's --unix-path
+    sockfd = unix_connect(argv[2]);
+    if (sockfd < 0)
+      exit(errno == ENAMETOOLONG ? EXIT_CLIENT_NO_HOST
+                                 : EXIT_CLIENT_CONNECT_FAIL);
+  } else {
+    struct sockaddr_in serv_addr;
+    struct hostent *server;
 
-  server = gethostbyname("localhost");
-  if (server == NULL) exit(EXIT_CLIENT_NO_HOST);
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) exit(EXIT_CLIENT_SOCKET_OPEN_FAIL);
 
-  memset(&serv_addr, 0, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  memcpy(&serv_addr.sin_addr.s_addr,
-         server->h_addr, (size_t) server->h_length);
-  serv_addr.sin_port = htons(PORT);
+    server = gethostbyname("localhost");
+    if (server == NULL) exit(EXIT_CLIENT_NO_HOST);
 
-  if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-    exit(EXIT_CLIENT_CONNECT_FAIL);
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    memcpy(&serv_addr.sin_addr.s_addr,
+           server->h_addr, (size_t) server->h_length);
+    serv_addr.sin_port = htons(PORT);
+
+    if (connect(sockfd, (struct sockaddr *) &serv_addr,
+                sizeof(serv_addr)) < 0)
+    {
+      exit(EXIT_CLIENT_CONNECT_FAIL);
+    }
   }
 
   set_non_blocking(sockfd);
@@ -86,10 +143,9 @@ int main() {
   fds[1].fd     = sockfd;
   fds[1].events = POLLIN;
 
-  #define POLL_FOREVER -1
   while (true) {
     if (poll(fds, 2, POLL_FOREVER) < 0) exit(EXIT_CLIENT_POLL_ERROR);
-    if (fds[0].revents & POLLIN) {
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
       memset(buffer, 0, BUF_SIZE);
       if (fgets(buffer, BUF_SIZE, stdin) == NULL) break;
       send(sockfd, buffer, strlen(buffer), 0);
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+#include "history.h"
+#include "host.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+void history_init(History *history) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  history->next_seq = (uint64_t) ts.tv_sec * 1000000000ull
+                    + (uint64_t) ts.tv_nsec;
+  history->head = history->n = 0;
+  history->data_head = history->data_used = 0;
+}
+
+static void evict_oldest(History *history) {
+  HistoryEntry *oldest = &history->entries[history->head];
+  history->data_head = (history->data_head + oldest->len) % HISTORY_DATA_LEN;
+  history->data_used -= oldest->len;
+  history->head = (history->head + 1) % HISTORY_MAX_MSGS;
+  history->n--;
+}
+
+// remembers msg from the user named sender (NULL: none) and drops the oldest
+// messages to make room; returns its seq
+uint64_t history_append(History *history, const char *msg, size_t len,
+                        const char *sender)
+{
+  if (len > HISTORY_DATA_LEN) return 0; // never with MAX_DATA_LEN_CEIL
+  while (history->n == HISTORY_MAX_MSGS ||
+         history->data_used + len > HISTORY_DATA_LEN)
+    evict_oldest(history);
+
+  size_t off = (history->data_head + history->data_used) % HISTORY_DATA_LEN;
+  size_t first = HISTORY_DATA_LEN - off < len ? HISTORY_DATA_LEN - off : len;
+  memcpy(history->data + off, msg, first);
+  memcpy(history->data, msg + first, len - first); // wrapped part, if any
+  history->data_used += len;
+
+  HistoryEntry *entry =
+    &history->entries[(history->head + history->n) % HISTORY_MAX_MSGS];
+  entry->seq = history->next_seq++;
+  entry->off = off;
+  entry->len = len;
+  if (sender != NULL) strcpy(entry->sender, sender);
+  else entry->sender[0] = '\0';
+  history->n++;
+  return entry->seq;
+}
+
+size_t history_frame_header(char buf[HISTORY_HEADER_MAX],
+                            uint64_t seq, size_t len)
+{
+  int n = snprintf(buf, HISTORY_HEADER_MAX, "#%llu %zu\n",
+                   (unsigned long long) seq, len);
+  return (size_t) n;
+}
+
+// `/sync <seq>\n` -> true and *after = seq
+bool history_parse_sync(const char *msg, size_t len, uint64_t *after) {
+  size_t cmd_len = strlen(HISTORY_SYNC_CMD);
+  if (len <= cmd_len || len > 40 || msg[len - 1] != '\n') return false;
+  if (memcmp(msg, HISTORY_SYNC_CMD, cmd_len) != 0) return false;
+  char digits[41];
+  memcpy(digits, msg + cmd_len, len - cmd_len - 1);
+  digits[len - cmd_len - 1] = '\0';
+  char *end;
+  unsigned long long seq = strtoull(digits, &end, 10);
+  if (end == digits || *end != '\0') return false;
+  *after = (uint64_t) seq;
+  return true;
+}
+
+// sends every retained message newer than `after` that c's block lists let
+// through to user c, framed, batched into writev() calls; returns how many
+// were sent or -1
+int history_replay(const History *history, uint64_t after,
+                   ClientPool *pool, int c)
+{
+  int fd = pool->pfds[c].fd;
+  enum { BATCH = 32 }; // 3 iovecs each: header and up to 2 data segments
+  char headers[BATCH][HISTORY_HEADER_MAX];
+  struct iovec iov[3 * BATCH];
+  int sent = 0, n_iov = 0, in_batch = 0;
+
+  for (size_t e = 0; e < history->n; e++) {
+    const HistoryEntry *entry =
+      &history->entries[(history->head + e) % HISTORY_MAX_MSGS];
+    if (entry->seq <= after) continue;
+    if (entry->sender[0] != '\0' && block_hides(pool, entry->sender, c))
+      continue;
+    size_t first = HISTORY_DATA_LEN - entry->off < entry->len
+                 ? HISTORY_DATA_LEN - entry->off : entry->len;
+    iov[n_iov].iov_base = headers[in_batch];
+    iov[n_iov++].iov_len = history_frame_header(headers[in_batch],
+                                                entry->seq, entry->len);
+    iov[n_iov].iov_base = (char *) history->data + entry->off;
+    iov[n_iov++].iov_len = first;
+    if (first < entry->len) {
+      iov[n_iov].iov_base = (char *) history->data;
+      iov[n_iov++].iov_len = entry->len - first;
+    }
+    sent++;
+    if (++in_batch == BATCH) {
+      if (client_send(pool, c, iov, n_iov) < 0) return -1;
+      n_iov = in_batch = 0;
+    }
+  }
+  if (n_iov > 0 && client_send(pool, c, iov, n_iov) < 0) return -1;
+  LOG_FROM_SUCC("replayed %d messages after seq %llu to socket %d\n",
+                sent, (unsigned long long) after, fd);
+  return sent;
+}
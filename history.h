@@ -0,0 +1,60 @@
+/*
+  Recent messages kept by the host so a client can catch up on what it missed
+  instead of starting from an empty feed. Every broadcast gets the next
+  sequence number and is remembered until the ring runs out of entries or
+  bytes. A client opts in by sending
+
+    /sync <highest seq it already has>\n
+
+  as its first message: the host replays everything newer it still holds and
+  from then on frames every message to that client as
+
+    #<seq> <len>\n<len bytes>
+
+  so it can tell where messages end and which ones it has stored. Sequence
+  numbers start at the wall clock (ns) like the relay's, so they keep growing
+  across host restarts. Seq 0 marks a message that is not retained, e.g. a
+  bulk payload that went out through splice_broadcast().
+
+  Each entry keeps the name its sender had, so a replay leaves out what the
+  block lists hide from the client right now (block_hides()).
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "block.h"
+
+#define HISTORY_MAX_MSGS   1024
+#define HISTORY_DATA_LEN   (256 * 1024)
+#define HISTORY_HEADER_MAX 48 // "#<seq> <len>\n", both up to 20 digits
+#define HISTORY_SYNC_CMD   "/sync "
+
+typedef struct {
+  uint64_t seq;
+  size_t off; // into the data ring
+  size_t len;
+  char sender[NICK_MAX + 1]; // empty: no name, or not from a user
+} HistoryEntry;
+
+typedef struct {
+  uint64_t next_seq;
+  size_t head;      // oldest entry
+  size_t n;
+  size_t data_head; // first byte of the oldest entry
+  size_t data_used;
+  HistoryEntry entries[HISTORY_MAX_MSGS];
+  char data[HISTORY_DATA_LEN];
+} History;
+
+void history_init(History *);
+uint64_t history_append(History *, const char *, size_t, const char *);
+size_t history_frame_header(char[HISTORY_HEADER_MAX], uint64_t, size_t);
+bool history_parse_sync(const char *, size_t, uint64_t *);
+typedef struct ClientPool ClientPool;
+int history_replay(const History *, uint64_t, ClientPool *, int);
+
+#endif // HISTORY_H_
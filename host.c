@@ -1,65 +1,142 @@
+#define _GNU_SOURCE // splice, tee, F_SETPIPE_SZ
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <poll.h>
 
 #include "host.h"
+#include "shm.h"
+#include "config.h"
+#include "trace.h"
+#include "bitset.h"
 #include "log.h" // LOG_IMPLEMENTION defined in main.c
 
 uint16_t extract_or_default_port(int argc, char **argv) {
-  if (argc < 2) {
+  if (argc < 2 || argv[1][0] == '-') {
     LOG_FROM_WARN("no port given, defaulting to %d\n", PORT_DEFAULT);
     return PORT_DEFAULT;
   }
   return (uint16_t) atoi(argv[1]);
 }
 
-static void
-pool_malloc_guard_fatal(ClientPool *p, Client *cs, struct pollfd *ps)
-{
-  const char *restrict fmt = "null pointer allocating %s\n";
-  if (p == NULL) {
-    LOG_FROM_ERR(fmt, "(ClientPool *)");
-    exit(EXIT_FAILURE);
-  }
-  if (cs == NULL) {
-    LOG_FROM_ERR(fmt, "(Client *)");
-    exit(EXIT_FAILURE);
+// value following `flag` on the command line, NULL if absent
+const char *arg_value(int argc, char **argv, const char *flag) {
+  for (int a = 1; a + 1 < argc; a++) {
+    if (strcmp(argv[a], flag) == 0) return argv[a + 1];
   }
-  if (ps == NULL) {
-    LOG_FROM_ERR(fmt, "(struct pollfd *)");
-    exit(EXIT_FAILURE);
+  return NULL;
+}
+
+// returns a queue's buffer to the outq slab or to malloc(), whichever
+// handed it out
+static void outq_free(ClientPool *pool, OutQueue *q) {
+  if (q->data != NULL && slab_owns(&pool->outq_slab, q->data)) {
+    slab_free(&pool->outq_slab, q->data);
+  } else {
+    free(q->data);
   }
+  *q = (OutQueue) { NULL, 0, 0, 0 };
 }
 
-ClientPool *clients_init(uint8_t max) {
-  // should I simply add 1 for listener?
-  ClientPool *pool     = malloc(sizeof(ClientPool));
-  Client *clients      = malloc(max * sizeof(Client));
-  struct pollfd *pfds  = malloc(max * sizeof(struct pollfd));
-  pool_malloc_guard_fatal(pool, clients, pfds);
+ClientPool *clients_init(uint16_t max) {
+  // one block: the pool header, its outbox, then its clients, then the
+  // poll set, then the slot bitsets (pollfds keep them 8 byte aligned)
+  size_t words = BITSET_WORDS(max);
+  size_t n_masks = 2 + (size_t) max + OUTBOX_MAX_MSGS;
+  ClientPool *pool = malloc(sizeof(ClientPool)
+                            + sizeof(Outbox)
+                            + max * sizeof(Client)
+                            + max * sizeof(struct pollfd)
+                            + n_masks * words * sizeof(uint64_t));
+  if (pool == NULL) {
+    LOG_FROM_ERR("null pointer allocating %s\n", "(ClientPool *)");
+    exit(EXIT_FAILURE);
+  }
 
   pool->max = max;
   pool->n_clients = 0;
-  pool->clients = clients;
-  pool->pfds = pfds;
+  pool->outbox = (Outbox *) (pool + 1);
+  pool->outbox->n_msgs = 0;
+  pool->outbox->used = 0;
+  pool->outbox->queued = 0;
+  pool->outbox->writes = 0;
+  pool->clients = (Client *) (pool->outbox + 1);
+  pool->pfds = (struct pollfd *) (pool->clients + max);
+  pool->mask_words = words;
+  pool->user_mask = (uint64_t *) (pool->pfds + max);
+  pool->fanout = pool->user_mask + words;
+  pool->blocked_by = pool->fanout + words;
+  pool->outbox->masks = pool->blocked_by + (size_t) max * words;
+  bitset_zero(pool->user_mask, n_masks * words);
+  pool->cfg = NULL;
+  pool->history = NULL;
+  pool->src_pipe[0] = pool->src_pipe[1] = -1;
+  pool->tee_pipe[0] = pool->tee_pipe[1] = -1;
+  pool->pipe_cap = 0;
+  pool->spliced = 0;
+  pool->n_paused = 0;
+  pool->throttled = 0;
+  pool->out_queued = 0;
+  pool->out_peak = 0;
+  pool->n_held = 0;
+  pool->holds = 0;
+  pool->slow_dropped = 0;
+  pool->rr_next = 0;
+  pool->capture = NULL;
+  pool->next_conn_id = 0;
+  pool->utf8_rejected = 0;
+  pool->filter = NULL;
+  memset(&pool->rx_delay, 0, sizeof(pool->rx_delay));
+  memset(&pool->tx_delay, 0, sizeof(pool->tx_delay));
+  slab_init(&pool->conn_slab, "conn", sizeof(ShmChannel), max);
+  slab_init(&pool->outq_slab, "outq", OUTQ_BLOCK, max);
 
   for (int c = 0; c < max; c ++) {
     pool->pfds[c].fd = -1;
     pool->pfds[c].events = 0;
     pool->clients[c].is_connected = false;
-    pool->clients[c].name = NULL;
+    pool->clients[c].kind = CLIENT_USER;
+    pool->clients[c].name[0] = '\0';
     pool->clients[c].pfd = &pool->pfds[c];
+    pool->clients[c].shm = NULL;
+    pool->clients[c].corked = false;
+    pool->clients[c].needs_flush = false;
+    pool->clients[c].sequenced = false;
+    bucket_init(&pool->clients[c].msg_bucket, 0, 0);
+    bucket_init(&pool->clients[c].byte_bucket, 0, 0);
+    pool->clients[c].resume_us = 0;
+    pool->clients[c].outq = (OutQueue) { NULL, 0, 0, 0 };
+    pool->clients[c].held = false;
+    pool->clients[c].recent_in = 0;
+    pool->clients[c].recent_us = 0;
+    pool->clients[c].bytes_in = 0;
+    pool->clients[c].budget_spent = 0;
+    pool->clients[c].conn_id = 0;
+    pool->clients[c].utf8 = (Utf8State) { {0}, 0 };
+    pool->clients[c].blocks = NULL;
+    pool->clients[c].stamped = false;
+    memset(&pool->clients[c].tx_stamps, 0, sizeof(TstampTx));
   }
 
   return pool;
 }
 
 int client_add(ClientPool *pool, int fd, short ev_flags) {
+  return client_add_as(pool, fd, ev_flags, CLIENT_USER);
+}
+
+int
+client_add_as(ClientPool *pool, int fd, short ev_flags, client_kind_t kind)
+{
   if (pool->n_clients >= pool->max) {
     LOG_FROM_ERR("max clients (%d) reached, add failed\n", pool->n_clients);
     return -1;
@@ -69,6 +146,8 @@ int client_add(ClientPool *pool, int fd, short ev_flags) {
       pool->pfds[c].fd = fd;
       pool->pfds[c].events = ev_flags;
       pool->clients[c].is_connected = true;
+      pool->clients[c].kind = kind;
+      if (kind == CLIENT_USER) bitset_set(pool->user_mask, c);
       pool->n_clients++;
       LOG_FROM_SUCC("added client on socket descriptor: %d\n", fd);
       LOG_APPEND("current connected clients: %d\n", pool->n_clients);
@@ -80,6 +159,10 @@ int client_add(ClientPool *pool, int fd, short ev_flags) {
 }
 
 int client_remove(ClientPool *pool, int fd) {
+  if (fd < 0) { // would match the first free slot
+    LOG_FROM_ERR("client removal failed, invalid descriptor %d\n", fd);
+    return -1;
+  }
   if (pool->n_clients == 0) {
     LOG_FROM_ERR("no connected clients to remove\n");
     return -1;
@@ -90,7 +173,33 @@ int client_remove(ClientPool *pool, int fd) {
       pool->pfds[c].events = 0;
       pool->pfds[c].revents = 0;
       pool->clients[c].is_connected = false;
-      pool->clients[c].name = NULL;
+      pool->clients[c].kind = CLIENT_USER;
+      bitset_clear(pool->user_mask, c);
+      // lists naming it or made by it must not carry over to the next user
+      // of the slot
+      bool listed = pool->clients[c].name[0] != '\0' ||
+                    pool->clients[c].blocks != NULL;
+      pool->clients[c].name[0] = '\0';
+      free(pool->clients[c].blocks);
+      pool->clients[c].blocks = NULL;
+      if (listed) block_compile(pool);
+      pool->clients[c].shm = NULL;
+      pool->clients[c].corked = false;
+      pool->clients[c].needs_flush = false;
+      pool->clients[c].sequenced = false;
+      if (pool->clients[c].resume_us != 0) pool->n_paused--;
+      pool->clients[c].resume_us = 0;
+      pool->out_queued -= pool->clients[c].outq.len;
+      outq_free(pool, &pool->clients[c].outq);
+      if (pool->clients[c].held) pool->n_held--;
+      pool->clients[c].held = false;
+      pool->clients[c].recent_in = 0;
+      pool->clients[c].bytes_in = 0;
+      pool->clients[c].budget_spent = 0;
+      pool->clients[c].conn_id = 0;
+      pool->clients[c].utf8 = (Utf8State) { {0}, 0 };
+      pool->clients[c].stamped = false;
+      memset(&pool->clients[c].tx_stamps, 0, sizeof(TstampTx));
       pool->n_clients--;
       LOG_FROM_SUCC("removed client on socket descriptor: %d\n", fd);
       LOG_APPEND("current connected clients: %d\n", pool->n_clients);
@@ -104,14 +213,20 @@ int client_remove(ClientPool *pool, int fd) {
 
 void clients_destroy(ClientPool *pool) {
   LOG_FROM_SUCC("freeing memory of ClientPool ...\n");
-  free(pool->pfds);
-  free(pool->clients);
-  free(pool);
+  for (int c = 0; c < pool->max; c++) outq_free(pool, &pool->clients[c].outq);
+  slab_destroy(&pool->conn_slab);
+  slab_destroy(&pool->outq_slab);
+  for (int p = 0; p < 2; p++) {
+    if (pool->src_pipe[p] >= 0) close(pool->src_pipe[p]);
+    if (pool->tee_pipe[p] >= 0) close(pool->tee_pipe[p]);
+  }
+  for (int c = 0; c < pool->max; c++) free(pool->clients[c].blocks);
+  free(pool); // outbox, clients and pfds live in the same block
 }
 
-static const char *port_to_cstr(uint16_t port) {
-  char *cstr = malloc(6); // 6 because uint16_t can be > 9999
-  sprintf(cstr, "%d", port);
+// 6 because uint16_t can be > 9999
+static const char *port_to_cstr(uint16_t port, char cstr[6]) {
+  snprintf(cstr, 6, "%d", port);
   return cstr;
 }
 
@@ -131,8 +246,10 @@ int get_listener_socket(uint16_t port) {
   struct addrinfo config, *addr_info;
   addr_info_configure(&config);
 
+  char port_cstr[6];
   int rv; // store return value of getaddrinfo
-  if ((rv = getaddrinfo(NULL, port_to_cstr(port), &config, &addr_info)) != 0)
+  if ((rv = getaddrinfo(NULL, port_to_cstr(port, port_cstr),
+                        &config, &addr_info)) != 0)
   {
     LOG_FATAL("%s\n", gai_strerror(rv));
     exit(EXIT_FAILURE);
@@ -167,12 +284,48 @@ int get_listener_socket(uint16_t port) {
   return listener_fd;
 }
 
-void poll_disconnect_guard(int poll_count) {
+// AF_UNIX stream listener, lets local tooling skip the TCP/IP stack. Only a
+// socket is replaced at path (left by a previous run), anything else there
+// is kept and the listener fails. Returns -1 on failure.
+int get_unix_listener_socket(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_sockaddr(path, &addr) < 0) {
+    LOG_FROM_ERR("unix socket path too long: %s\n", path);
+    return -1;
+  }
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      LOG_FROM_ERR("%s exists and is not a socket, not replacing it\n", path);
+      return -1;
+    }
+    unlink(path);
+  }
+
+  int listener_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener_fd < 0) {
+    LOG_FROM_ERR("failed to open unix socket\n");
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+  if (bind(listener_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(listener_fd, 10) < 0)
+  {
+    LOG_FROM_ERR("failed to listen on unix socket %s\n", path);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    close(listener_fd);
+    return -1;
+  }
+  return listener_fd;
+}
+
+void poll_disconnect_guard(int poll_count, int timeout) {
   switch (poll_count) {
   case 0:
-    LOG_FATAL("polling timed out, do data for %d milliseconds\n", TIMEOUT);
+    LOG_FATAL("polling timed out, do data for %d milliseconds\n", timeout);
     exit(EXIT_FAILURE);
   case -1:
+    if (errno == EINTR) return; // e.g. SIGUSR1 asking for stats
     LOG_FATAL("poll suddenly dropped out\n");
     LOG_APPEND("errno: %s\n", strerror(errno));
     exit(EXIT_FAILURE);
@@ -186,6 +339,26 @@ static void *get_in_addr(struct sockaddr *sa) {
     : (void *) &(((struct sockaddr_in6 *) sa)->sin6_addr);
 }
 
+static void set_opt(int fd, int level, int opt, int val, const char *name) {
+  if (setsockopt(fd, level, opt, &val, sizeof(val)) < 0) {
+    LOG_FROM_WARN("setsockopt(%s = %d) on socket %d failed\n", name, val, fd);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+  }
+}
+
+// socket side of the deployment profile, see config.h
+static void apply_socket_profile(const HostConfig *cfg, int fd, int family) {
+  if (cfg->sndbuf > 0) set_opt(fd, SOL_SOCKET, SO_SNDBUF, cfg->sndbuf,
+                               "SO_SNDBUF");
+  if (cfg->rcvbuf > 0) set_opt(fd, SOL_SOCKET, SO_RCVBUF, cfg->rcvbuf,
+                               "SO_RCVBUF");
+  if (family == AF_UNIX) return; // the rest is TCP/IP only
+  if (cfg->busy_poll > 0) set_opt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                                  cfg->busy_poll, "SO_BUSY_POLL");
+  if (cfg->nodelay) set_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  if (cfg->cork)    set_opt(fd, IPPROTO_TCP, TCP_CORK, 1, "TCP_CORK");
+}
+
 void
 connect_client(ClientPool *pool, int client_fd, struct sockaddr_storage *addr)
 {
@@ -200,6 +373,39 @@ connect_client(ClientPool *pool, int client_fd, struct sockaddr_storage *addr)
     close(client_fd);
     return;
   }
+  // never block the loop on one slow reader, see OutQueue
+  int flags = fcntl(client_fd, F_GETFL);
+  if (flags < 0 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    LOG_FROM_WARN("could not make socket %d non-blocking\n", client_fd);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+  }
+  for (int c = 0; c < pool->max; c++) {
+    if (pool->pfds[c].fd != client_fd) continue;
+    pool->clients[c].conn_id = ++pool->next_conn_id;
+    capture_inbound(pool, c, CAPTURE_OPEN, NULL, 0);
+  }
+  if (pool->cfg != NULL) {
+    apply_socket_profile(pool->cfg, client_fd, addr->ss_family);
+    // TX stamps are TCP/IP only, no point in half of them
+    bool stamped = pool->cfg->timestamps && addr->ss_family != AF_UNIX;
+    if (stamped && tstamp_enable(client_fd) < 0) {
+      LOG_FROM_WARN("no kernel timestamps on socket %d\n", client_fd);
+      LOG_APPEND("errno: %s\n", strerror(errno));
+      stamped = false;
+    }
+    int64_t now = ratelimit_now_us();
+    for (int c = 0; c < pool->max; c++) {
+      if (pool->pfds[c].fd != client_fd) continue;
+      pool->clients[c].stamped = stamped;
+      pool->clients[c].corked = pool->cfg->cork && addr->ss_family != AF_UNIX;
+      bucket_init(&pool->clients[c].msg_bucket, pool->cfg->rate_msgs, now);
+      bucket_init(&pool->clients[c].byte_bucket, pool->cfg->rate_bytes, now);
+    }
+  }
+  if (addr->ss_family == AF_UNIX) {
+    LOG_FROM_SUCC("new local connection on socket %d\n", client_fd);
+    return;
+  }
   LOG_FROM_SUCC("new connection from %s on socket %d\n",
               inet_ntop(addr->ss_family,
                         get_in_addr((struct sockaddr *) addr),
@@ -208,22 +414,608 @@ connect_client(ClientPool *pool, int client_fd, struct sockaddr_storage *addr)
   return;
 }
 
+void connect_shm_client(ClientPool *pool, int listener_fd) {
+  ShmChannel *ch = slab_alloc(&pool->conn_slab);
+  if (ch == NULL) {
+    LOG_FROM_ERR("connection slab exhausted, refusing shm client\n");
+    close(accept(listener_fd, NULL, NULL));
+    return;
+  }
+  int bell_fd = shm_accept(listener_fd, ch);
+  if (bell_fd < 0) {
+    LOG_FROM_ERR("shared-memory handshake failed\n");
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    slab_free(&pool->conn_slab, ch);
+    return;
+  }
+  if (client_add_as(pool, bell_fd, POLLIN, CLIENT_SHM) < 0) {
+    LOG_FROM_ERR("failed to add shm client, closing channel\n");
+    shm_channel_close(ch);
+    slab_free(&pool->conn_slab, ch);
+    return;
+  }
+  // no events: a dead peer still raises POLLHUP, stray bytes wake nobody
+  if (client_add_as(pool, ch->ctl_fd, 0, CLIENT_SHM_CTL) < 0) {
+    LOG_FROM_ERR("failed to add shm control socket, closing channel\n");
+    client_remove(pool, bell_fd);
+    shm_channel_close(ch);
+    slab_free(&pool->conn_slab, ch);
+    return;
+  }
+  for (int c = 0; c < pool->max; c++) {
+    if (pool->pfds[c].fd == ch->ctl_fd) pool->clients[c].shm = ch;
+    if (pool->pfds[c].fd != bell_fd) continue;
+    pool->clients[c].shm = ch;
+    pool->clients[c].conn_id = ++pool->next_conn_id;
+    capture_inbound(pool, c, CAPTURE_OPEN, NULL, 0);
+  }
+  LOG_FROM_SUCC("new shared-memory client on doorbell %d\n", bell_fd);
+}
+
 void disconnect_client(ClientPool *pool, int client_id) {
-  close(pool->pfds[client_id].fd);
-  client_remove(pool, pool->pfds[client_id].fd);
+  int fd = pool->pfds[client_id].fd;
+  if (fd < 0) {
+    LOG_FROM_ERR("slot %d is already disconnected\n", client_id);
+    return;
+  }
+  capture_inbound(pool, client_id, CAPTURE_CLOSE, NULL, 0);
+  if (pool->clients[client_id].kind == CLIENT_SHM) {
+    client_remove(pool, pool->clients[client_id].shm->ctl_fd);
+    shm_channel_close(pool->clients[client_id].shm); // closes the doorbell
+    slab_free(&pool->conn_slab, pool->clients[client_id].shm);
+  } else {
+    close(fd);
+  }
+  client_remove(pool, fd);
 }
 
+// shm rings are written directly since they cost no syscall per message
+void broadcast_shm(ClientPool *pool, int send_fd, char *msg, ssize_t msg_len) {
+  for (int c = 0; c < pool->max; c++) {
+    if (!pool->clients[c].is_connected) continue;
+    if (pool->clients[c].kind != CLIENT_SHM) continue;
+    int dest_fd = pool->pfds[c].fd;
+    if (dest_fd == send_fd) continue;
+    if (shm_channel_write(pool->clients[c].shm, msg, (size_t) msg_len) < 0)
+      LOG_FROM_ERR("shm ring of doorbell %d full, message dropped\n", dest_fd);
+  }
+}
+
+static int slot_of(const ClientPool *pool, int fd) {
+  for (int c = 0; fd >= 0 && c < pool->max; c++) {
+    if (pool->pfds[c].fd == fd) return c;
+  }
+  return -1;
+}
+
+// queues msg for every user but the sender and those blocking it, see
+// flush_outbox()
 void broadcast_all(ClientPool *pool,
                    int send_fd, int list_fd,
                    char *msg, ssize_t msg_len)
 {
-  for (int c = 0; c < pool->n_clients; c++) {
-    int dest_fd = pool->pfds[c].fd;
-    if (dest_fd != list_fd && dest_fd != send_fd) { // exclude
-      if (send(dest_fd, msg, (size_t) msg_len, 0) == -1) {
-        LOG_FROM_ERR("send() failed\n");
-        LOG_APPEND("errno: %s\n", errno);
-      }
+  (void) list_fd; // listeners are never CLIENT_USER
+  broadcast_shm(pool, send_fd, msg, msg_len);
+
+  Outbox *out = pool->outbox;
+  if (out->n_msgs == OUTBOX_MAX_MSGS ||
+      out->used + (size_t) msg_len > OUTBOX_DATA_LEN)
+    flush_outbox(pool);
+  // the caller reuses msg for the next recv(), keep our own copy
+  char *copy = out->data + out->used;
+  memcpy(copy, msg, (size_t) msg_len);
+  out->used += (size_t) msg_len;
+  uint64_t trace_id = trace_take();
+  int sender = slot_of(pool, send_fd);
+  const char *name = sender >= 0 && pool->clients[sender].kind == CLIENT_USER
+                   ? pool->clients[sender].name : NULL;
+  uint64_t seq = pool->history != NULL
+    ? history_append(pool->history, msg, (size_t) msg_len, name) : 0;
+  if (seq != 0) TRACE(TRACE_PERSIST, trace_id, msg_len);
+  out->trace_ids[out->n_msgs] = trace_id;
+  block_recipients(pool, sender,
+                   out->masks + (size_t) out->n_msgs * pool->mask_words);
+  out->msgs[out->n_msgs].iov_base = copy;
+  out->msgs[out->n_msgs].iov_len = (size_t) msg_len;
+  out->headers[out->n_msgs].iov_base = out->header_data[out->n_msgs];
+  out->headers[out->n_msgs].iov_len =
+    history_frame_header(out->header_data[out->n_msgs], seq, (size_t) msg_len);
+  out->n_msgs++;
+  out->queued++;
+  TRACE(TRACE_ENQUEUE, trace_id, out->n_msgs);
+}
+
+// stamps the first send of each message in the batch that went to user c
+static void trace_sent(const ClientPool *pool, int c, uint16_t *fanout) {
+  const Outbox *out = pool->outbox;
+  for (int m = 0; m < out->n_msgs; m++) {
+    if (!bitset_test(out->masks + (size_t) m * pool->mask_words, c))
+      continue;
+    if (fanout[m]++ == 0)
+      trace_event(TRACE_FIRST_SEND, out->trace_ids[m],
+                  (uint32_t) pool->pfds[c].fd);
+  }
+}
+
+// poll interest of a user: POLLIN unless throttled or held, POLLOUT while
+// something is queued for it
+static void update_events(ClientPool *pool, int c) {
+  Client *client = &pool->clients[c];
+  short events = 0;
+  if (client->resume_us == 0 && !client->held) events |= POLLIN;
+  if (client->outq.len > 0) events |= POLLOUT;
+  pool->pfds[c].events = events;
+}
+
+static size_t queue_client_max(const ClientPool *pool) {
+  return pool->cfg != NULL ? pool->cfg->queue_client_max
+                           : QUEUE_CLIENT_MAX_DEFAULT;
+}
+
+// appends to the queue of client c, -1 when that would pass its cap
+static int outq_push(ClientPool *pool, int c, const char *data, size_t len) {
+  OutQueue *q = &pool->clients[c].outq;
+  if (q->len + len > queue_client_max(pool)) return -1;
+  if (q->head + q->len + len > q->cap) {
+    if (q->head > 0) { // slide the unsent part to the front first
+      memmove(q->data, q->data + q->head, q->len);
+      q->head = 0;
+    }
+    if (q->len + len > q->cap) {
+      size_t cap = q->cap == 0 ? OUTQ_BLOCK : q->cap;
+      while (cap < q->len + len) cap *= 2;
+      char *data = cap == OUTQ_BLOCK ? slab_alloc(&pool->outq_slab) : NULL;
+      if (data == NULL) data = malloc(cap);
+      if (data == NULL) return -1;
+      if (q->len > 0) memcpy(data, q->data, q->len); // head is 0 by now
+      size_t kept = q->len;
+      outq_free(pool, q);
+      *q = (OutQueue) { data, 0, kept, cap };
+    }
+  }
+  memcpy(q->data + q->head + q->len, data, len);
+  q->len += len;
+  pool->out_queued += len;
+  if (pool->out_queued > pool->out_peak) pool->out_peak = pool->out_queued;
+  return 0;
+}
+
+static void drop_slow_receiver(ClientPool *pool, int c) {
+  LOG_FROM_WARN("socket %d stopped reading, %zu bytes queued, "
+                "disconnecting\n", pool->pfds[c].fd,
+                pool->clients[c].outq.len);
+  pool->slow_dropped++;
+  disconnect_client(pool, c);
+}
+
+// taken right before a write to user c, its TX stamp is compared with it
+static int64_t send_start(const ClientPool *pool, int c) {
+  return pool->clients[c].stamped ? tstamp_now_ns() : 0;
+}
+
+// len bytes of a write started at t went to user c's socket
+static void sent(ClientPool *pool, int c, size_t len, int64_t t) {
+  if (pool->clients[c].stamped)
+    tstamp_sent(&pool->clients[c].tx_stamps, len, t);
+}
+
+// sends iov[0..n) to user c without blocking: what the socket does not take
+// now is queued and goes out on POLLOUT, after anything queued before it.
+// Returns -1 when c got disconnected on the way.
+int client_send(ClientPool *pool, int c, struct iovec *iov, int n) {
+  size_t done = 0;
+  if (pool->clients[c].outq.len == 0) {
+    ssize_t rv;
+    int64_t t = send_start(pool, c);
+    do rv = writev(pool->pfds[c].fd, iov, n);
+    while (rv < 0 && errno == EINTR);
+    if (rv < 0 && errno != EAGAIN) {
+      LOG_FROM_ERR("writev() to socket %d failed\n", pool->pfds[c].fd);
+      LOG_APPEND("errno: %s\n", strerror(errno));
+      return 0; // poll() reports the hang up
+    }
+    if (rv > 0) done = (size_t) rv;
+    sent(pool, c, done, t);
+  }
+  for (int i = 0; i < n; i++) {
+    if (done >= iov[i].iov_len) {
+      done -= iov[i].iov_len;
+      continue;
+    }
+    if (outq_push(pool, c, (char *) iov[i].iov_base + done,
+                  iov[i].iov_len - done) < 0)
+    {
+      drop_slow_receiver(pool, c);
+      return -1;
     }
+    done = 0;
+  }
+  update_events(pool, c);
+  return 0;
+}
+
+// POLLOUT: send as much of the queue as the socket takes
+void client_on_writable(ClientPool *pool, int c) {
+  OutQueue *q = &pool->clients[c].outq;
+  while (q->len > 0) {
+    int64_t t = send_start(pool, c);
+    ssize_t n = send(pool->pfds[c].fd, q->data + q->head, q->len,
+                     MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) break;
+    if (n < 0) {
+      LOG_FROM_ERR("send() to socket %d failed\n", pool->pfds[c].fd);
+      LOG_APPEND("errno: %s\n", strerror(errno));
+      disconnect_client(pool, c);
+      return;
+    }
+    sent(pool, c, (size_t) n, t);
+    q->head += (size_t) n;
+    q->len -= (size_t) n;
+    pool->out_queued -= (size_t) n;
+  }
+  if (q->len == 0 && q->cap > OUTQ_BLOCK) { // give a burst's memory back
+    outq_free(pool, q);
+  } else if (q->len == 0) {
+    q->head = 0; // the block stays for the next time it falls behind
+  }
+  if (pool->clients[c].corked) pool->clients[c].needs_flush = true;
+  update_events(pool, c);
+}
+
+// one writev() per user carrying everything broadcast since the last flush,
+// called at the end of each loop iteration
+void flush_outbox(ClientPool *pool) {
+  Outbox *out = pool->outbox;
+  if (out->n_msgs == 0) return;
+  struct iovec iov[2 * OUTBOX_MAX_MSGS];
+  uint16_t fanout[OUTBOX_MAX_MSGS] = {0}; // recipients, for the trace
+  for (int c = 0; c < pool->max; c++) {
+    if (!pool->clients[c].is_connected) continue;
+    if (pool->clients[c].kind != CLIENT_USER) continue; // listeners, relays
+    int n = 0;
+    for (int m = 0; m < out->n_msgs; m++) {
+      if (!bitset_test(out->masks + (size_t) m * pool->mask_words, c))
+        continue;
+      if (pool->clients[c].sequenced) iov[n++] = out->headers[m];
+      iov[n++] = out->msgs[m];
+    }
+    if (n == 0) continue;
+    out->writes++;
+    if (client_send(pool, c, iov, n) < 0) continue;
+    if (trace_on) trace_sent(pool, c, fanout);
+    if (pool->clients[c].corked) pool->clients[c].needs_flush = true;
+  }
+  for (int m = 0; trace_on && m < out->n_msgs; m++)
+    trace_event(TRACE_LAST_SEND, out->trace_ids[m], fanout[m]);
+  out->n_msgs = 0;
+  out->used = 0;
+}
+
+// records traffic of a user or shm client when capturing, see capture.h; a
+// failed write stops the capture rather than the host
+void capture_inbound(ClientPool *pool, int c, capture_kind_t kind,
+                     const char *data, size_t len)
+{
+  if (pool->capture == NULL || pool->clients[c].conn_id == 0) return;
+  if (capture_write(pool->capture, pool->clients[c].conn_id, kind,
+                    data, len) == 0)
+    return;
+  LOG_FROM_ERR("writing the capture failed, capture stopped\n");
+  LOG_APPEND("errno: %s\n", strerror(errno));
+  capture_close(pool->capture);
+  pool->capture = NULL;
+}
+
+// throughput profile: pop the cork once per loop iteration so everything
+// queued during it leaves in as few full segments as possible
+void flush_corked(ClientPool *pool) {
+  for (int c = 0; c < pool->max; c++) {
+    if (!pool->clients[c].needs_flush) continue;
+    pool->clients[c].needs_flush = false;
+    if (!pool->clients[c].is_connected) continue;
+    int off = 0, on = 1;
+    setsockopt(pool->pfds[c].fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    setsockopt(pool->pfds[c].fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+  }
+}
+
+bool clients_of_kind(const ClientPool *pool, client_kind_t kind) {
+  for (int c = 0; c < pool->max; c++) {
+    if (pool->clients[c].is_connected && pool->clients[c].kind == kind)
+      return true;
+  }
+  return false;
+}
+
+static int open_splice_pipes(ClientPool *pool) {
+  if (pipe2(pool->src_pipe, O_CLOEXEC) < 0) return -1;
+  if (pipe2(pool->tee_pipe, O_CLOEXEC) < 0) {
+    close(pool->src_pipe[0]);
+    close(pool->src_pipe[1]);
+    pool->src_pipe[0] = pool->src_pipe[1] = -1;
+    return -1;
+  }
+  // tee() cannot resume half way, so the tee pipe must hold a whole chunk:
+  // ask for the same size on both and go with the smaller grant
+  fcntl(pool->src_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_LEN);
+  fcntl(pool->tee_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_LEN);
+  int src_cap = fcntl(pool->src_pipe[1], F_GETPIPE_SZ);
+  int tee_cap = fcntl(pool->tee_pipe[1], F_GETPIPE_SZ);
+  pool->pipe_cap = (size_t) (src_cap < tee_cap ? src_cap : tee_cap);
+  return 0;
+}
+
+// drops whatever is left in a pipe after a failed splice
+static void pipe_discard(int fd, size_t len) {
+  char sink[512];
+  while (len > 0) {
+    ssize_t n = read(fd, sink, len < sizeof(sink) ? len : sizeof(sink));
+    if (n <= 0) return;
+    len -= (size_t) n;
+  }
+}
+
+// moves len bytes from a pipe to user c; once its socket is full (or it has
+// a backlog already) the rest is read out of the pipe into its queue
+static void splice_to(ClientPool *pool, int pipe_fd, int c, size_t len) {
+  while (len > 0 && pool->clients[c].outq.len == 0) {
+    int64_t t = send_start(pool, c);
+    ssize_t n = splice(pipe_fd, NULL, pool->pfds[c].fd, NULL, len,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) break;
+    if (n <= 0) {
+      LOG_FROM_ERR("splice to socket %d failed\n", pool->pfds[c].fd);
+      LOG_APPEND("errno: %s\n", strerror(errno));
+      pipe_discard(pipe_fd, len);
+      return;
+    }
+    sent(pool, c, (size_t) n, t);
+    len -= (size_t) n;
+  }
+  char buf[4096];
+  while (len > 0) {
+    ssize_t n = read(pipe_fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+    if (n <= 0) return;
+    len -= (size_t) n;
+    if (outq_push(pool, c, buf, (size_t) n) < 0) {
+      pipe_discard(pipe_fd, len);
+      drop_slow_receiver(pool, c);
+      return;
+    }
+  }
+  if (pool->clients[c].corked) pool->clients[c].needs_flush = true;
+  update_events(pool, c);
+}
+
+// sequenced clients need the frame header in front of spliced bytes, seq 0:
+// bulk payloads are not kept in the history
+static int frame_spliced(ClientPool *pool, int c, size_t len) {
+  if (!pool->clients[c].sequenced) return 0;
+  char header[HISTORY_HEADER_MAX];
+  struct iovec iov = { header, history_frame_header(header, 0, len) };
+  return client_send(pool, c, &iov, 1);
+}
+
+// sends a duplicate of the len bytes sitting in src_pipe to client c
+static void tee_to(ClientPool *pool, int c, size_t len) {
+  if (frame_spliced(pool, c, len) < 0) return;
+  ssize_t teed = tee(pool->src_pipe[0], pool->tee_pipe[1], len, 0);
+  if (teed < 0 || (size_t) teed != len) {
+    LOG_FROM_ERR("tee for socket %d failed\n", pool->pfds[c].fd);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    if (teed > 0) pipe_discard(pool->tee_pipe[0], (size_t) teed);
+    return;
+  }
+  splice_to(pool, pool->tee_pipe[0], c, len);
+}
+
+// Bytes waiting on client_id's socket when they are at least threshold and
+// may be spliced, 0 when they are to be received as messages instead. A
+// loaded filter keeps everything on the recv path: spliced bytes never pass
+// through userspace, so the filter stage could not screen them.
+size_t splice_pending(const ClientPool *pool, int client_id, size_t threshold)
+{
+  int pending = 0;
+  if (threshold == 0 || pool->filter != NULL) return 0;
+  if (ioctl(pool->pfds[client_id].fd, FIONREAD, &pending) < 0) return 0;
+  return (size_t) pending >= threshold ? (size_t) pending : 0;
+}
+
+// Zero-copy broadcast of up to len pending bytes of client_id: the bytes are
+// spliced into a pipe and tee()d to every other user, the last one takes
+// the original. When copy is not NULL (shm clients or relay peers need the
+// payload in memory) at most copy_cap bytes are moved, every user gets a
+// tee and the original is read into copy. Returns the bytes consumed, 0 on
+// hang up, -1 on error.
+ssize_t splice_broadcast(ClientPool *pool, int client_id, size_t len,
+                         char *copy, size_t copy_cap)
+{
+  if (pool->src_pipe[0] < 0 && open_splice_pipes(pool) < 0) return -1;
+  flush_outbox(pool); // messages queued earlier must arrive first
+
+  int src_fd = pool->pfds[client_id].fd;
+  if (len > pool->pipe_cap) len = pool->pipe_cap;
+  if (copy != NULL && len > copy_cap) len = copy_cap;
+  ssize_t in = splice(src_fd, NULL, pool->src_pipe[1], NULL, len,
+                      SPLICE_F_MOVE);
+  if (in <= 0) return in;
+  size_t moved = (size_t) in;
+
+  int last = -1;
+  block_recipients(pool, client_id, pool->fanout);
+  for (int c = 0; c < pool->max; c++) {
+    if (!bitset_test(pool->fanout, c)) continue;
+    if (last >= 0) tee_to(pool, last, moved);
+    last = c;
+  }
+
+  if (copy != NULL) {
+    if (last >= 0) tee_to(pool, last, moved);
+    for (size_t got = 0; got < moved;) {
+      ssize_t n = read(pool->src_pipe[0], copy + got, moved - got);
+      if (n <= 0) return -1;
+      got += (size_t) n;
+    }
+  } else if (last >= 0 && frame_spliced(pool, last, moved) == 0) {
+    splice_to(pool, pool->src_pipe[0], last, moved);
+  } else {
+    pipe_discard(pool->src_pipe[0], moved); // nobody to send it to
+  }
+  pool->spliced += moved;
+  return in;
+}
+
+// read rate of a client as a byte count halved every BACKPRESSURE_DECAY_US
+static double recent_in(Client *client, int64_t now_us) {
+  int64_t halvings = (now_us - client->recent_us) / BACKPRESSURE_DECAY_US;
+  if (halvings <= 0) return client->recent_in;
+  client->recent_in = halvings > 60 ? 0
+                    : client->recent_in / (double) (1ULL << halvings);
+  client->recent_us += halvings * BACKPRESSURE_DECAY_US;
+  return client->recent_in;
+}
+
+static void throttle_pause(ClientPool *pool, int c, int64_t until_us) {
+  if (pool->clients[c].resume_us == 0) pool->n_paused++;
+  pool->clients[c].resume_us = until_us;
+  pool->pfds[c].events &= ~POLLIN;
+  pool->throttled++;
+}
+
+static int64_t refill_wait_us(Client *client) {
+  int64_t msgs = bucket_wait_us(&client->msg_bucket, 1);
+  int64_t bytes = bucket_wait_us(&client->byte_bucket, 1);
+  return msgs > bytes ? msgs : bytes;
+}
+
+// bytes client c may send us right now, 0 when it got paused instead
+size_t throttle_admit(ClientPool *pool, int c, size_t want, int64_t now_us) {
+  Client *client = &pool->clients[c];
+  if (client->resume_us != 0) { // paused, only read to notice a hang up
+    return pool->pfds[c].revents & (POLLHUP | POLLERR) ? want : 0;
+  }
+  double msgs = bucket_available(&client->msg_bucket, now_us);
+  double bytes = bucket_available(&client->byte_bucket, now_us);
+  if (msgs >= 1 && bytes >= 1) return bytes < (double) want
+                                 ? (size_t) bytes : want;
+  throttle_pause(pool, c, now_us + refill_wait_us(client));
+  return 0;
+}
+
+// bills msgs messages of len bytes in total, pausing the client as soon as
+// it is out of tokens rather than on its next wake-up
+void throttle_charge(ClientPool *pool, int c, size_t msgs, size_t len,
+                     int64_t now_us)
+{
+  Client *client = &pool->clients[c];
+  bucket_take(&client->msg_bucket, (double) msgs);
+  bucket_take(&client->byte_bucket, (double) len);
+  client->recent_in = recent_in(client, now_us) + (double) len;
+  client->bytes_in += len;
+  int64_t wait = refill_wait_us(client);
+  if (wait > 0) throttle_pause(pool, c, now_us + wait);
+}
+
+void throttle_resume(ClientPool *pool, int64_t now_us) {
+  if (pool->n_paused == 0) return;
+  for (int c = 0; c < pool->max; c++) {
+    if (pool->clients[c].resume_us == 0) continue;
+    if (pool->clients[c].resume_us > now_us) continue;
+    pool->clients[c].resume_us = 0;
+    update_events(pool, c);
+    pool->n_paused--;
+  }
+}
+
+// poll() must wake up in time for the next throttled client to resume
+int throttle_poll_timeout(const ClientPool *pool, int timeout, int64_t now_us)
+{
+  if (pool->n_paused == 0) return timeout;
+  int64_t earliest = INT64_MAX;
+  for (int c = 0; c < pool->max; c++) {
+    int64_t resume = pool->clients[c].resume_us;
+    if (resume != 0 && resume < earliest) earliest = resume;
+  }
+  int64_t wait_ms = (earliest - now_us + 999) / 1000;
+  if (wait_ms < 0) wait_ms = 0;
+  if (timeout >= 0 && wait_ms >= timeout) return timeout;
+  return (int) wait_ms;
+}
+
+// slot the loop services first this pass, the next one gets to go first on
+// the following pass
+int clients_rr_first(ClientPool *pool) {
+  int first = pool->rr_next;
+  pool->rr_next = (uint16_t) ((first + 1) % pool->max);
+  return first;
+}
+
+void read_budget_init(ReadBudget *budget, int frames, size_t bytes) {
+  budget->frames = frames;
+  budget->bytes = bytes;
+}
+
+// bytes the next read may ask for (at most max_len), 0: done for this pass
+size_t read_budget_want(const ReadBudget *budget, size_t max_len) {
+  if (budget->frames <= 0) return 0;
+  return budget->bytes < max_len ? budget->bytes : max_len;
+}
+
+// one read of len bytes done
+void read_budget_charge(ReadBudget *budget, size_t len) {
+  budget->frames--;
+  budget->bytes -= len < budget->bytes ? len : budget->bytes;
+}
+
+// whether the pass ended on the budget rather than on an empty socket
+bool read_budget_spent(const ReadBudget *budget) {
+  return budget->frames <= 0 || budget->bytes == 0;
+}
+
+// holds the busiest producers once everything queued for sending passes the
+// high mark, releases all of them below the low mark; called once per loop
+// iteration after the outbox went out
+void backpressure_update(ClientPool *pool, int64_t now_us) {
+  size_t high = pool->cfg != NULL ? pool->cfg->queue_high
+                                  : QUEUE_HIGH_DEFAULT;
+  size_t low = pool->cfg != NULL ? pool->cfg->queue_low : QUEUE_LOW_DEFAULT;
+  if (low >= high) low = high / 2;
+
+  if (pool->n_held > 0 && pool->out_queued <= low) {
+    for (int c = 0; c < pool->max; c++) {
+      if (!pool->clients[c].held) continue;
+      pool->clients[c].held = false;
+      update_events(pool, c);
+    }
+    LOG_FROM_SUCC("outbound queues down to %zu bytes, released %u "
+                  "producers\n", pool->out_queued, pool->n_held);
+    pool->n_held = 0;
+    return;
+  }
+  if (pool->out_queued <= high) return;
+
+  double busiest = 0;
+  for (int c = 0; c < pool->max; c++) {
+    Client *client = &pool->clients[c];
+    if (!client->is_connected || client->kind != CLIENT_USER) continue;
+    if (client->held) continue;
+    double rate = recent_in(client, now_us);
+    if (rate > busiest) busiest = rate;
+  }
+  if (busiest <= 0) return; // nobody left producing, only draining helps
+  uint16_t held = 0;
+  for (int c = 0; c < pool->max; c++) {
+    Client *client = &pool->clients[c];
+    if (!client->is_connected || client->kind != CLIENT_USER) continue;
+    if (client->held || client->recent_in < busiest / 2) continue;
+    client->held = true;
+    update_events(pool, c);
+    held++;
   }
+  pool->n_held = (uint16_t) (pool->n_held + held);
+  pool->holds += held;
+  LOG_FROM_WARN("%zu bytes queued outbound, holding %u more producers\n",
+                pool->out_queued, held);
 }
@@ -2,47 +2,211 @@
 #define HOST_H_
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "alloc.h"
+#include "history.h"
+#include "ratelimit.h"
+#include "capture.h"
+#include "scan.h"
+#include "filter.h"
+#include "block.h"
+#include "tstamp.h"
 
 // BEGIN: misc
+// compiled defaults, see config.h for overriding them at runtime
 #define PORT_DEFAULT 9001
 #define MAX_DATA_LEN 256
+#define MAX_DATA_LEN_CEIL 4096
+#define READ_FRAMES_DEFAULT 4           // reads per client per loop pass
+#define READ_BUDGET_DEFAULT (64 * 1024) // bytes per client per loop pass
 uint16_t extract_or_default_port(int, char **);
+const char *arg_value(int, char **, const char *);
 // END: misc
 
 // BEGIN: client
 #define MAX_CLIENTS 3
+#define MAX_CLIENTS_CEIL 1024
 #define MIN_NAME_LEN 3
 #define MAX_NAME_LEN 25
 // 15 minutes
 #define TIMEOUT 900000
 
+// every descriptor the host polls lives in the pool, kind decides routing
+typedef enum {
+  CLIENT_USER,
+  CLIENT_LISTENER,
+  CLIENT_RELAY_LISTENER,
+  CLIENT_RELAY,
+  CLIENT_SHM_LISTENER,
+  CLIENT_SHM, // pfd is the doorbell of a shared-memory channel
+  CLIENT_SHM_CTL, // its control socket, polled for POLLHUP only
+  CLIENT_TRANSFER_LISTENER,
+  CLIENT_TRANSFER_NOTICE, // eventfd, finished uploads to announce
+} client_kind_t;
+
+typedef struct ShmChannel ShmChannel;
+
+#define OUTQ_BLOCK 4096 // first buffer of an OutQueue, from the outq slab
+
+// bytes a non-blocking user socket did not take yet, sent on POLLOUT
+typedef struct {
+  // an OUTQ_BLOCK from the pool's outq_slab, kept while connected; a burst
+  // that outgrows it moves to malloc() up to queue-client-max, and back to
+  // the slab once drained
+  char *data;
+  size_t head; // first unsent byte
+  size_t len;
+  size_t cap;
+} OutQueue;
+
 typedef struct {
   bool is_connected;
-  const char *name;
+  client_kind_t kind;
+  char name[NICK_MAX + 1]; // set by /nick, empty until then
   struct pollfd *pfd;
+  ShmChannel *shm;  // CLIENT_SHM and CLIENT_SHM_CTL only
+  bool corked;      // TCP_CORK set by the throughput profile
+  bool needs_flush; // corked and written to during this iteration
+  bool sequenced;   // sent /sync, gets framed messages, see history.h
+  TokenBucket msg_bucket;  // see ratelimit.h
+  TokenBucket byte_bucket;
+  int64_t resume_us; // paused (POLLIN off) until then, 0: reading
+  OutQueue outq;
+  bool held;         // POLLIN off until the outbound queues drain
+  double recent_in;  // bytes read lately, halved every BACKPRESSURE_DECAY_US
+  int64_t recent_us;
+  uint64_t bytes_in;     // read from it since it connected, for the shares
+  uint64_t budget_spent; // passes that ended on its read budget
+  uint32_t conn_id;      // unique over the host's lifetime, for captures
+  Utf8State utf8;        // a character split by the last recv, see scan.h
+  BlockList *blocks;     // NULL until its first /mute or /block
+  bool stamped;          // kernel timestamps on, see tstamp.h
+  TstampTx tx_stamps;    // its sends waiting for their TX stamp
 } Client;
 
+typedef struct HostConfig HostConfig;
+
+// messages broadcast during one loop iteration, written out with a single
+// writev() per destination by flush_outbox() instead of a send() each
+#define OUTBOX_MAX_MSGS 64          // well below IOV_MAX
+#define OUTBOX_DATA_LEN (64 * 1024) // flushed early when either runs out
+#define SPLICE_PIPE_LEN (256 * 1024) // per splice_broadcast() call at most
+
 typedef struct {
-  uint8_t max;
-  uint8_t n_clients;
+  int n_msgs;
+  size_t used;
+  uint64_t *masks; // [msg * mask_words]: recipients of each, see block.h
+  struct iovec msgs[OUTBOX_MAX_MSGS];
+  struct iovec headers[OUTBOX_MAX_MSGS]; // frames for sequenced clients
+  char header_data[OUTBOX_MAX_MSGS][HISTORY_HEADER_MAX];
+  uint64_t trace_ids[OUTBOX_MAX_MSGS]; // see trace.h, 0 when off
+  char data[OUTBOX_DATA_LEN];
+  uint64_t queued;  // messages accepted, for the SIGUSR1 stats
+  uint64_t writes;  // writev() calls issued for them
+} Outbox;
+
+typedef struct ClientPool {
+  uint16_t max;
+  uint16_t n_clients;
   Client *clients;
   struct pollfd *pfds;
+  SlabPool conn_slab; // per-connection state, one object per slot at most
+  SlabPool outq_slab; // OUTQ_BLOCK queue buffers, one per slot at most
+  const HostConfig *cfg; // socket profile for accepted clients, may be NULL
+  Outbox *outbox;
+  History *history; // NULL: messages are neither kept nor numbered
+  // splice_broadcast(): sender bytes land in src_pipe, each recipient gets a
+  // tee() of it through tee_pipe, both opened on first use
+  int src_pipe[2];
+  int tee_pipe[2];
+  size_t pipe_cap;
+  uint64_t spliced; // bytes that went out without a userspace copy
+  uint16_t n_paused; // clients throttled right now
+  uint64_t throttled; // times any client got paused
+  size_t out_queued;  // sum of every OutQueue.len, see backpressure
+  size_t out_peak;
+  uint16_t n_held;    // producers not read from right now
+  uint64_t holds;     // times any producer got held
+  uint64_t slow_dropped; // receivers disconnected for a full queue
+  uint16_t rr_next;   // slot the event loop services first next pass
+  Capture *capture;   // NULL: inbound traffic is not recorded
+  uint32_t next_conn_id;
+  uint64_t utf8_rejected; // frames dropped for not being UTF-8
+  Filter *filter;     // NULL: messages are not screened
+  // slot bitsets, see block.h
+  size_t mask_words;
+  uint64_t *user_mask;  // connected users
+  uint64_t *blocked_by; // [sender * mask_words]: who must not receive
+  uint64_t *fanout;     // recipients of a splice_broadcast()
+  LatencyHist rx_delay; // kernel stamp -> recv(), see tstamp.h
+  LatencyHist tx_delay; // send() -> kernel stamp
 } ClientPool;
 
-ClientPool *clients_init(uint8_t);
+ClientPool *clients_init(uint16_t);
 int client_add(ClientPool *, int, short);
+int client_add_as(ClientPool *, int, short, client_kind_t);
 int client_remove(ClientPool *, int);
 void clients_destroy(ClientPool *);
 // END: client
 
 // BEGIN: net
 int get_listener_socket(uint16_t);
-void poll_disconnect_guard(int);
+int get_unix_listener_socket(const char *);
+void poll_disconnect_guard(int, int);
 void connect_client(ClientPool *, int, struct sockaddr_storage *);
+void connect_shm_client(ClientPool *, int);
 void disconnect_client(ClientPool *, int);
+void broadcast_shm(ClientPool *, int, char *, ssize_t);
 void broadcast_all(ClientPool *, int, int, char *, ssize_t);
+bool clients_of_kind(const ClientPool *, client_kind_t);
+size_t splice_pending(const ClientPool *, int, size_t);
+ssize_t splice_broadcast(ClientPool *, int, size_t, char *, size_t);
+int client_send(ClientPool *, int, struct iovec *, int);
+void client_on_writable(ClientPool *, int);
+void flush_outbox(ClientPool *);
+void flush_corked(ClientPool *);
+void capture_inbound(ClientPool *, int, capture_kind_t, const char *, size_t);
 // END: net
 
+// BEGIN: throttle
+size_t throttle_admit(ClientPool *, int, size_t, int64_t);
+void throttle_charge(ClientPool *, int, size_t, size_t, int64_t);
+void throttle_resume(ClientPool *, int64_t);
+int throttle_poll_timeout(const ClientPool *, int, int64_t);
+// END: throttle
+
+// BEGIN: fairness
+// Each pass the loop starts at the next slot (round-robin), and reads a user
+// until it runs out of read-frames reads or read-budget bytes, whichever
+// comes first; the rest waits in the kernel for later passes.
+typedef struct {
+  int frames;   // reads left this pass
+  size_t bytes; // bytes left this pass
+} ReadBudget;
+
+int clients_rr_first(ClientPool *);
+void read_budget_init(ReadBudget *, int, size_t);
+size_t read_budget_want(const ReadBudget *, size_t);
+void read_budget_charge(ReadBudget *, size_t);
+bool read_budget_spent(const ReadBudget *);
+// END: fairness
+
+// BEGIN: backpressure
+// User sockets are non-blocking, whatever one does not take right away waits
+// in its OutQueue. The sum over all of them is checked against two marks:
+// above queue-high the busiest producers (at least half the read rate of the
+// busiest one) lose POLLIN, below queue-low they all get it back. Their
+// bytes wait in the kernel meanwhile, so host memory stays bounded by
+// queue-high plus one iteration of fan-out. A single receiver whose queue
+// would pass queue-client-max is disconnected instead, one stalled reader
+// must not hold up every producer.
+#define QUEUE_HIGH_DEFAULT       (8 * 1024 * 1024)
+#define QUEUE_LOW_DEFAULT        (4 * 1024 * 1024)
+#define QUEUE_CLIENT_MAX_DEFAULT (1024 * 1024)
+#define BACKPRESSURE_DECAY_US    100000
+void backpressure_update(ClientPool *, int64_t);
+// END: backpressure
+
 #endif
@@ -6,6 +6,11 @@
   #include "log.h"
 
   You may then simply `#include "log.h"` in any source files it is needed.
+
+  Every call prints in one piece, even with several threads logging. An
+  entry made of several calls (LOG_FROM_* then LOG_APPEND) may interleave
+  with another thread's, so threads besides the event loop log entries of a
+  single call.
  */
 
 #ifndef LOG_H_
@@ -27,19 +32,27 @@ void _log_from_fn(log_t target, const char *fn, const char *fmt, ...);
 #define LOG_APPEND(fmt, ...)    _log_append(fmt, ##__VA_ARGS__)
 
 #ifdef LOG_IMPLEMENTATION
-static FILE *_log_stream = NULL;
+#include <pthread.h>
+
+// per thread, a LOG_FROM_* elsewhere must not redirect this thread's appends
+static _Thread_local FILE *_log_stream = NULL;
+static pthread_mutex_t _log_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void _log_append(const char *fmt, ...) {
+  if (_log_stream == NULL) _log_stream = stdout;
+  pthread_mutex_lock(&_log_lock);
   fprintf(_log_stream, "» ");
   va_list args;
   va_start(args, fmt);
   vfprintf(_log_stream, fmt, args);
   va_end(args);
+  pthread_mutex_unlock(&_log_lock);
 }
 
 void _log_from_fn(log_t target, const char *fn, const char *fmt, ...)
 {
   _log_stream = target == SUCC ? stdout : stderr;
+  pthread_mutex_lock(&_log_lock);
 
   const char *ansi_clr = target == SUCC
     ? "\033[32m" : target == WARN
@@ -61,6 +74,7 @@ void _log_from_fn(log_t target, const char *fn, const char *fmt, ...)
     break;
   default:
     fprintf(stderr,  "[UNKNOWN] :: unreachable case\n");
+    pthread_mutex_unlock(&_log_lock);
     return;
   }
   fprintf(_log_stream, "» ");
@@ -68,6 +82,7 @@ void _log_from_fn(log_t target, const char *fn, const char *fmt, ...)
   va_start(args, fmt);
   vfprintf(_log_stream, fmt, args);
   va_end(args);
+  pthread_mutex_unlock(&_log_lock);
 }
 
 #endif // LOG_IMPLEMENTATION
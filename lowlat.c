@@ -0,0 +1,110 @@
+#define _GNU_SOURCE // pthread_setaffinity_np, CPU_SET
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "lowlat.h"
+#include "alloc.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+// a pinned loop: its mask, and every CPU the process had except the loop's
+static uint64_t loop_mask = 0;
+static cpu_set_t loop_others;
+
+// the nth CPU set in mask, -1 when it has fewer
+static int nth_cpu(uint64_t mask, int nth) {
+  for (int cpu = 0; cpu < 64; cpu++) {
+    if ((mask & (1ull << cpu)) && nth-- == 0) return cpu;
+  }
+  return -1;
+}
+
+// pin the calling thread to the nth CPU of mask
+int lowlat_pin_self(uint64_t mask, int nth) {
+  int cpu = nth_cpu(mask, nth);
+  if (cpu < 0) return -1;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET((size_t) cpu, &set);
+  int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rv != 0) {
+    LOG_FROM_WARN("failed to pin thread to cpu %d\n", cpu);
+    LOG_APPEND("errno: %s\n", strerror(rv));
+    return -1;
+  }
+  LOG_FROM_SUCC("thread pinned to cpu %d\n", cpu);
+  return cpu;
+}
+
+// First thing helper threads (watchdog, transfer workers) do: they inherit
+// the affinity of the thread that created them, the pinned loop's, and move
+// to the CPUs after it in the mask, round-robin by index, or to every other
+// CPU when the mask has only the loop's. Returns the CPU pinned to, -1 when
+// the loop is not pinned or that failed.
+int lowlat_pin_helper(int index) {
+  if (loop_mask == 0) return -1;
+  int spare = __builtin_popcountll(loop_mask) - 1;
+  int cpu = spare > 0 ? nth_cpu(loop_mask, 1 + index % spare) : -1;
+  cpu_set_t set = loop_others;
+  if (cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET((size_t) cpu, &set);
+  }
+  int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rv != 0) { // one call, see log.h
+    LOG_FROM_WARN("failed to pin helper %d to cpu %d: %s\n", index, cpu,
+                  strerror(rv));
+    return -1;
+  }
+  return cpu;
+}
+
+void lowlat_setup(const HostConfig *cfg) {
+  if (!cfg->low_latency) return;
+  cpu_set_t all;
+  if (cfg->cpu_mask != 0 &&
+      sched_getaffinity(0, sizeof(all), &all) == 0 &&
+      lowlat_pin_self(cfg->cpu_mask, 0) >= 0)
+  {
+    loop_mask = cfg->cpu_mask;
+    loop_others = all;
+    CPU_CLR((size_t) nth_cpu(loop_mask, 0), &loop_others);
+    if (CPU_COUNT(&loop_others) == 0) loop_others = all; // nothing else
+  }
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    // usually RLIMIT_MEMLOCK, pre-faulting below still helps
+    LOG_FROM_WARN("mlockall failed, memory may be paged out\n");
+    LOG_APPEND("errno: %s\n", strerror(errno));
+  }
+  alloc_prefault_all();
+  LOG_FROM_SUCC("low-latency mode, spinning up to %d us before blocking\n",
+                cfg->spin_us);
+}
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// poll() that busy-polls for spin_us before sleeping for `timeout` ms
+int lowlat_poll(struct pollfd *pfds, nfds_t n, int timeout, int spin_us,
+                LowLatStats *stats)
+{
+  if (spin_us > 0) {
+    int64_t deadline = now_us() + spin_us;
+    do {
+      int ready = poll(pfds, n, 0);
+      if (ready != 0) {
+        if (ready > 0) stats->spin_hits++;
+        return ready;
+      }
+    } while (now_us() < deadline);
+    stats->spin_misses++;
+  }
+  return poll(pfds, n, timeout);
+}
@@ -0,0 +1,34 @@
+/*
+  Low-latency mode (--low-latency) of the host, trades CPU for steady wake-up
+  latency:
+
+  - the event-loop thread is pinned to the first CPU of `cpus` (e.g. 2,4-5),
+    helper threads (watchdog, transfer workers) spread over the remaining
+    ones, or over every CPU but the loop's when `cpus` names just one
+  - mlockall() keeps the process resident, slab pools and arenas are
+    pre-faulted so the first messages do not pay for page faults
+  - before blocking in poll() the loop spins on non-blocking polls for up to
+    `spin-us` microseconds, so a message arriving shortly after the previous
+    one never waits for a scheduler wake-up
+
+  Pair it with `--profile latency` for the socket side.
+ */
+
+#ifndef LOWLAT_H_
+#define LOWLAT_H_
+
+#include <stdint.h>
+#include <poll.h>
+#include "config.h"
+
+typedef struct {
+  uint64_t spin_hits;   // readiness found while spinning
+  uint64_t spin_misses; // budget ran out, fell back to blocking
+} LowLatStats;
+
+void lowlat_setup(const HostConfig *);
+int lowlat_pin_self(uint64_t, int);
+int lowlat_pin_helper(int);
+int lowlat_poll(struct pollfd *, nfds_t, int, int, LowLatStats *);
+
+#endif // LOWLAT_H_
@@ -1,59 +1,562 @@
 #include <poll.h>
+#include <string.h>
+#include <signal.h>
 #include "host.h"
+#include "relay.h"
+#include "shm.h"
+#include "config.h"
+#include "lowlat.h"
+#include "transfer.h"
+#include "trace.h"
+#include "bitset.h"
+#include "pipeline.h"
+#include "watchdog.h"
 #define LOG_IMPLEMENTATION
 #include "log.h"
 
 #ifndef TEST__ // PRODUCTION
+// transient per-iteration data, e.g. relay frames under construction
+#define SCRATCH_ARENA_LEN (64 * 1024)
+
+static volatile sig_atomic_t DUMP_STATS = 0;
+
+static volatile sig_atomic_t DUMP_TRACE = 0;
+
+static volatile sig_atomic_t RELOAD_FILTER = 0;
+
+static void on_sigusr1(int sig) {
+  (void) sig;
+  DUMP_STATS = 1;
+}
+
+static void on_sigusr2(int sig) {
+  (void) sig;
+  DUMP_TRACE = 1;
+}
+
+static void on_sighup(int sig) {
+  (void) sig;
+  RELOAD_FILTER = 1;
+}
+
+// swaps in a freshly compiled filter, a file that does not compile keeps
+// the one running
+static void reload_filter(ClientPool *pool, const char *path) {
+  if (path[0] == '\0') {
+    LOG_FROM_WARN("SIGHUP without --filter, nothing to reload\n");
+    return;
+  }
+  Filter *fresh = filter_load(path);
+  if (fresh == NULL) {
+    LOG_FROM_ERR("keeping the previous filter\n");
+    return;
+  }
+  filter_free(pool->filter);
+  pool->filter = fresh;
+  LOG_FROM_SUCC("filter reloaded, %zu patterns in %u states\n",
+                fresh->n_patterns, fresh->n_states);
+}
+
+// one line per histogram of tstamp.h, microseconds
+static void log_delay(const char *what, const LatencyHist *h) {
+  LOG_APPEND("%s: %lu samples, p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f "
+             "max %.1f us\n", what, (unsigned long) h->n,
+             (double) hist_percentile(h, 0.5) / 1e3,
+             (double) hist_percentile(h, 0.9) / 1e3,
+             (double) hist_percentile(h, 0.99) / 1e3,
+             (double) hist_percentile(h, 0.999) / 1e3,
+             (double) h->max_ns / 1e3);
+}
+
+static void dump_stats(const ClientPool *pool, const Relay *relay,
+                       Transfer *transfer, const LowLatStats *lowlat,
+                       const Pipeline *pipeline)
+{
+  LOG_FROM_SUCC("%d connected of %d slots\n", pool->n_clients, pool->max);
+  LOG_APPEND("throttled clients %u now, %lu pauses so far\n",
+             pool->n_paused, (unsigned long) pool->throttled);
+  LOG_APPEND("spin polls that found work %lu, fell back to blocking %lu\n",
+             (unsigned long) lowlat->spin_hits,
+             (unsigned long) lowlat->spin_misses);
+  LOG_APPEND("broadcast %lu messages in %lu writev calls\n",
+             (unsigned long) pool->outbox->queued,
+             (unsigned long) pool->outbox->writes);
+  LOG_APPEND("queued outbound %zu bytes now, %zu at most\n",
+             pool->out_queued, pool->out_peak);
+  LOG_APPEND("held producers %u now, %lu holds, %lu slow receivers "
+             "dropped\n", pool->n_held, (unsigned long) pool->holds,
+             (unsigned long) pool->slow_dropped);
+  uint64_t total_in = 0;
+  for (int c = 0; c < pool->max; c++) total_in += pool->clients[c].bytes_in;
+  for (int c = 0; c < pool->max; c++) { // share of the reads each one got
+    const Client *client = &pool->clients[c];
+    if (!client->is_connected || client->kind != CLIENT_USER) continue;
+    LOG_APPEND("socket %d read %lu bytes, %.1f%% share, budget spent "
+               "%lu passes\n", pool->pfds[c].fd,
+               (unsigned long) client->bytes_in,
+               total_in > 0 ? 100.0 * (double) client->bytes_in
+                              / (double) total_in : 0.0,
+               (unsigned long) client->budget_spent);
+  }
+  size_t pairs = bitset_count(pool->blocked_by,
+                              (size_t) pool->max * pool->mask_words);
+  LOG_APPEND("sender/recipient pairs muted or blocked %zu\n", pairs);
+  LOG_APPEND("frames dropped for invalid UTF-8 %lu\n",
+             (unsigned long) pool->utf8_rejected);
+  if (pool->filter != NULL)
+    LOG_APPEND("filter of %zu patterns screened %lu bytes, dropped %lu\n",
+               pool->filter->n_patterns,
+               (unsigned long) pool->filter->scanned,
+               (unsigned long) pool->filter->hits);
+  LOG_APPEND("pipeline ran %lu batches of %lu messages\n",
+             (unsigned long) pipeline->batches,
+             (unsigned long) pipeline->msgs);
+  for (int s = 0; s < pipeline_n_stages; s++) {
+    const Stage *stage = &pipeline_stages[s];
+    LOG_APPEND("  stage %-10s %lu calls, %lu messages, %lu dropped\n",
+               stage->name, (unsigned long) stage->calls,
+               (unsigned long) stage->msgs, (unsigned long) stage->dropped);
+  }
+  if (pool->cfg->timestamps) {
+    log_delay("kernel rx -> recv", &pool->rx_delay);
+    log_delay("send -> kernel tx", &pool->tx_delay);
+  }
+  WatchdogStats stalls;
+  if (watchdog_stats(&stalls)) {
+    LOG_APPEND("loop stalls %lu, %lu ms in total, longest %lu ms\n",
+               (unsigned long) stalls.stalls,
+               (unsigned long) (stalls.total_us / 1000),
+               (unsigned long) (stalls.max_us / 1000));
+    for (int s = 0; s < stalls.n_stages; s++) {
+      const WatchdogStage *stage = &stalls.stages[s];
+      LOG_APPEND("  in %-12s %lu stalls, %lu ms, longest %lu ms\n",
+                 stage->name, (unsigned long) stage->stalls,
+                 (unsigned long) (stage->total_us / 1000),
+                 (unsigned long) (stage->max_us / 1000));
+    }
+  }
+  LOG_APPEND("spliced %lu bytes without copying\n",
+             (unsigned long) pool->spliced);
+  LOG_APPEND("relay peers %d, frames out %lu in %lu suppressed %lu\n",
+             relay->n_peers,
+             (unsigned long) relay->frames_out,
+             (unsigned long) relay->frames_in,
+             (unsigned long) relay->frames_suppressed);
+  LOG_APPEND("file transfers active %d, bytes in %lu out %lu\n",
+             atomic_load(&transfer->active),
+             (unsigned long) atomic_load(&transfer->bytes_in),
+             (unsigned long) atomic_load(&transfer->bytes_out));
+  LOG_APPEND("deduplicated uploads %lu, %lu bytes not stored again\n",
+             (unsigned long) atomic_load(&transfer->dedup_hits),
+             (unsigned long) atomic_load(&transfer->dedup_bytes));
+  alloc_stats_log();
+}
+
 int main(int argc, char **argv) {
-  const uint16_t port = extract_or_default_port(argc, argv);
-  char data_buffer[MAX_DATA_LEN];
+  HostConfig cfg;
+  config_defaults(&cfg);
+  cfg.port = extract_or_default_port(argc, argv);
+  if (config_from_args(&cfg, argc, argv) < 0) {
+    LOG_FATAL("invalid configuration, see above\n");
+    exit(EXIT_FAILURE);
+  }
+  config_log(&cfg);
+
+  char *data_buffer = malloc(cfg.max_data_len);
+  if (data_buffer == NULL) {
+    LOG_FATAL("null pointer allocating data buffer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // relay links and the relay, unix, shm and transfer listeners (plus the
+  // transfer notices) share the poll set with the clients
+  ClientPool *client_pool =
+    clients_init((uint16_t) (cfg.max_clients + RELAY_MAX_PEERS + 5));
+  client_pool->cfg = &cfg;
+  client_pool->history = malloc(sizeof(History));
+  if (client_pool->history == NULL) {
+    LOG_FATAL("null pointer allocating message history\n");
+    exit(EXIT_FAILURE);
+  }
+  history_init(client_pool->history);
+
+  Capture capture;
+  if (cfg.capture_path[0] != '\0') {
+    if (capture_create(&capture, cfg.capture_path) < 0) {
+      LOG_FATAL("cannot create capture file %s\n", cfg.capture_path);
+      LOG_APPEND("errno: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    client_pool->capture = &capture;
+  }
+  int64_t capture_flushed = 0;
+
+  if (cfg.filter_path[0] != '\0') {
+    client_pool->filter = filter_load(cfg.filter_path);
+    if (client_pool->filter == NULL) {
+      LOG_FATAL("cannot load the filter %s\n", cfg.filter_path);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  int listener = get_listener_socket(cfg.port);
+  client_add_as(client_pool, listener, POLLIN, CLIENT_LISTENER);
+
+  Relay relay;
+  relay_init(&relay, cfg.port);
+  relay_setup_from_args(&relay, client_pool, argc, argv);
+
+  if (cfg.unix_path[0] != '\0') { // same ClientPool and broadcast path as TCP
+    int unix_fd = get_unix_listener_socket(cfg.unix_path);
+    if (unix_fd < 0) {
+      LOG_FATAL("failed to set up the unix listener\n");
+      exit(EXIT_FAILURE);
+    }
+    client_add_as(client_pool, unix_fd, POLLIN, CLIENT_LISTENER);
+  }
+
+  if (cfg.shm_path[0] != '\0') {
+    int shm_fd = get_unix_listener_socket(cfg.shm_path);
+    if (shm_fd < 0) {
+      LOG_FATAL("failed to set up the shm listener\n");
+      exit(EXIT_FAILURE);
+    }
+    client_add_as(client_pool, shm_fd, POLLIN, CLIENT_SHM_LISTENER);
+  }
+
+  Transfer transfer;
+  if (transfer_init(&transfer, &cfg, client_pool) < 0) {
+    LOG_FATAL("failed to set up file transfers\n");
+    exit(EXIT_FAILURE);
+  }
 
-  ClientPool *client_pool = clients_init(MAX_CLIENTS);
+  Arena scratch;
+  arena_init(&scratch, "scratch", SCRATCH_ARENA_LEN);
+
+  Pipeline pipeline;
+  if (pipeline_init(&pipeline, client_pool, &relay, &scratch, listener) < 0)
+  {
+    LOG_FATAL("failed to set up the message pipeline\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // no SA_RESTART: poll() returns EINTR and the loop prints right away
+  struct sigaction sa = { .sa_handler = on_sigusr1 };
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+  sa.sa_handler = on_sigusr2;
+  sigaction(SIGUSR2, &sa, NULL);
+  sa.sa_handler = on_sighup;
+  sigaction(SIGHUP, &sa, NULL);
+  if (trace_init(cfg.trace) < 0) {
+    LOG_FATAL("failed to set up tracing\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!scan_init(cfg.simd)) {
+    LOG_FROM_WARN("%s kernels not supported by this CPU\n", cfg.simd);
+    scan_init("auto");
+  }
+  LOG_FROM_SUCC("scanning with the %s kernels\n", scan_kernels.name);
+  // peers that vanish mid-write surface as EPIPE instead of killing the host
+  signal(SIGPIPE, SIG_IGN);
 
-  int listener = get_listener_socket(port);
-  client_add(client_pool, listener, POLLIN);
+  LowLatStats lowlat = {0};
+  lowlat_setup(&cfg); // after every pool exists, so all of them get faulted
+  const int spin_us = cfg.low_latency ? cfg.spin_us : 0;
+  if (watchdog_start(cfg.watchdog_ms) < 0) {
+    LOG_FATAL("failed to set up the watchdog\n");
+    exit(EXIT_FAILURE);
+  }
 
   for (;;) {
-    int poll_count = poll(client_pool->pfds, client_pool->n_clients, TIMEOUT);
-    poll_disconnect_guard(poll_count);
-
-    for (int c = 0; c < client_pool->n_clients; c++) {
-      if (client_pool->pfds[c].revents && POLLIN) {
-        if (client_pool->pfds[c].fd == listener) { // listener routines
-          struct sockaddr_storage client_addr;
-          socklen_t client_addr_len = sizeof(client_addr);
-          int new_client_fd = accept(listener, (struct sockaddr *) &client_addr,
-                                     &client_addr_len);
-          connect_client(client_pool, new_client_fd, &client_addr);
-        } else { // client routines
-          ssize_t num_bytes = recv(client_pool->pfds[c].fd,
-                                   data_buffer, sizeof(data_buffer), 0);
-          if (num_bytes <= 0) {
+    WATCHDOG_STAGE("loop");
+    arena_reset(&scratch);
+    int64_t now = ratelimit_now_us();
+    throttle_resume(client_pool, now);
+    int wait = throttle_poll_timeout(client_pool, cfg.timeout, now);
+    // wake up to write the capture out even when traffic stops
+    if (client_pool->capture != NULL && (wait < 0 || wait > 1000))
+      wait = 1000;
+    WATCHDOG_STAGE(NULL); // waiting is not a stall
+    int poll_count = lowlat_poll(client_pool->pfds, client_pool->max,
+                                 wait, spin_us, &lowlat);
+    now = ratelimit_now_us();
+    watchdog_beat(now);
+    WATCHDOG_STAGE("loop");
+    if (client_pool->capture != NULL && now - capture_flushed >= 1000000) {
+      capture_flush(client_pool->capture);
+      capture_flushed = now;
+    }
+    // woken up early (throttled client, capture), not the idle timeout
+    if (poll_count == 0 && wait != cfg.timeout) continue;
+    poll_disconnect_guard(poll_count, cfg.timeout);
+    if (DUMP_STATS) {
+      DUMP_STATS = 0;
+      WATCHDOG_STAGE("dump_stats");
+      dump_stats(client_pool, &relay, &transfer, &lowlat, &pipeline);
+    }
+    if (DUMP_TRACE) {
+      DUMP_TRACE = 0;
+      WATCHDOG_STAGE("trace_dump");
+      trace_dump(cfg.trace_path);
+    }
+    if (RELOAD_FILTER) {
+      RELOAD_FILTER = 0;
+      WATCHDOG_STAGE("reload_filter");
+      reload_filter(client_pool, cfg.filter_path);
+    }
+    if (poll_count < 0) continue;
+
+    // a different slot goes first every pass, round-robin over the ready
+    // clients instead of always favouring the low slots
+    int first = clients_rr_first(client_pool);
+    for (int i = 0; i < client_pool->max; i++) {
+      int c = (first + i) % client_pool->max;
+      if (client_pool->pfds[c].revents & POLLOUT) {
+        WATCHDOG_STAGE("writable");
+        if (client_pool->clients[c].kind == CLIENT_RELAY)
+          relay_on_writable(&relay, client_pool, c); // may drop the link
+        else
+          client_on_writable(client_pool, c); // may disconnect it
+        if (!client_pool->clients[c].is_connected) continue;
+      }
+      if (!(client_pool->pfds[c].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      switch (client_pool->clients[c].kind) {
+      case CLIENT_LISTENER: {
+        WATCHDOG_STAGE("accept");
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int new_client_fd = accept(client_pool->pfds[c].fd,
+                                   (struct sockaddr *) &client_addr,
+                                   &client_addr_len);
+        connect_client(client_pool, new_client_fd, &client_addr);
+      } break;
+      case CLIENT_RELAY_LISTENER:
+        WATCHDOG_STAGE("relay_accept");
+        relay_accept(&relay, client_pool);
+        break;
+      case CLIENT_RELAY:
+        WATCHDOG_STAGE("relay");
+        relay_on_readable(&relay, client_pool, client_pool->pfds[c].fd);
+        break;
+      case CLIENT_TRANSFER_LISTENER:
+        WATCHDOG_STAGE("transfer_accept");
+        transfer_accept(&transfer);
+        break;
+      case CLIENT_TRANSFER_NOTICE:
+        WATCHDOG_STAGE("transfer_notice");
+        transfer_on_notice(&transfer, &pipeline, c);
+        break;
+      case CLIENT_SHM_LISTENER:
+        WATCHDOG_STAGE("shm_accept");
+        connect_shm_client(client_pool, client_pool->pfds[c].fd);
+        break;
+      case CLIENT_SHM_CTL:
+        // the CLIENT_SHM slot reads what is left, then disconnects both
+        WATCHDOG_STAGE("shm_ctl");
+        shm_channel_hangup(client_pool->clients[c].shm);
+        break;
+      case CLIENT_SHM: {
+        WATCHDOG_STAGE("shm");
+        ShmChannel *ch = client_pool->clients[c].shm;
+        ssize_t num_bytes;
+        do {
+          shm_channel_drain_bell(ch);
+          for (;;) {
+            char *buf = pipeline_reserve(&pipeline, cfg.max_data_len);
+            num_bytes = shm_channel_read(ch, buf, cfg.max_data_len);
+            if (num_bytes <= 0) break;
+            capture_inbound(client_pool, c, CAPTURE_FRAME, buf,
+                            (size_t) num_bytes);
+            pipeline_push(&pipeline, c, (size_t) num_bytes);
+          }
+        } while (num_bytes == 0 && !shm_channel_arm(ch));
+        if (num_bytes < 0) {
+          pipeline_run(&pipeline); // before its descriptor can be reused
+          LOG_FROM_SUCC("shm client on doorbell %d hung up\n",
+                        client_pool->pfds[c].fd);
+          disconnect_client(client_pool, c);
+        }
+      } break;
+      case CLIENT_USER: {
+        // at most read-frames reads / read-budget bytes per pass so a heavy
+        // sender cannot starve the others, the rest waits for later passes
+        WATCHDOG_STAGE("user");
+        int fd = client_pool->pfds[c].fd;
+        Client *client = &client_pool->clients[c];
+        // TX stamps raise POLLERR until they are read, only then is it
+        // known whether there is anything to read besides
+        if (client->stamped &&
+            (client_pool->pfds[c].revents & POLLERR) &&
+            tstamp_drain(fd, &client->tx_stamps,
+                         &client_pool->tx_delay) > 0 &&
+            !(client_pool->pfds[c].revents & (POLLIN | POLLHUP)))
+        {
+          break;
+        }
+        // anything that sends can drop it as a slow receiver, its slot is
+        // checked after each such call and the reads stop there
+        ReadBudget budget;
+        read_budget_init(&budget, cfg.read_frames, cfg.read_budget);
+        size_t want;
+        while ((want = read_budget_want(&budget, cfg.max_data_len)) > 0) {
+          size_t allowed = throttle_admit(client_pool, c, want, now);
+          if (allowed == 0) break; // paused, its bytes wait in the kernel
+          size_t pending;
+          ssize_t num_bytes;
+          char *buf = NULL; // in the batch, see pipeline.h
+          if ((pending = splice_pending(client_pool, c, cfg.splice_threshold))
+              > 0)
+          {
+            pipeline_run(&pipeline); // the messages before it go first
+            if (!client->is_connected) break;
+            // shm rings, relay frames and captures still need the payload
+            // in memory
+            bool copy = relay.n_peers > 0 || client_pool->capture != NULL ||
+                        clients_of_kind(client_pool, CLIENT_SHM);
+            double tokens = bucket_available(&client->byte_bucket, now);
+            if (tokens < (double) pending) pending = (size_t) tokens;
+            if (pending > budget.bytes) pending = budget.bytes;
+            num_bytes = splice_broadcast(client_pool, c, pending,
+                                         copy ? data_buffer : NULL,
+                                         cfg.max_data_len);
+            if (!client->is_connected) break;
+            if (num_bytes > 0) {
+              // bulk payloads are billed as one message and not checked
+              // for UTF-8, they may not even pass through userspace
+              throttle_charge(client_pool, c, 1, (size_t) num_bytes, now);
+              if (copy) {
+                capture_inbound(client_pool, c, CAPTURE_FRAME, data_buffer,
+                                (size_t) num_bytes);
+                broadcast_shm(client_pool, fd, data_buffer, num_bytes);
+                relay_publish(&relay, &scratch, data_buffer,
+                              (size_t) num_bytes);
+              }
+              read_budget_charge(&budget, (size_t) num_bytes);
+              continue;
+            }
+          } else {
+            buf = pipeline_reserve(&pipeline, allowed); // may run a batch
+            if (!client->is_connected) break;
+            num_bytes = client->stamped
+              ? tstamp_recv(fd, buf, allowed, &client_pool->rx_delay)
+              : recv(fd, buf, allowed, 0);
+          }
+          if (num_bytes > 0) {
+            TRACE(TRACE_RECV, trace_begin(), fd);
+            capture_inbound(client_pool, c, CAPTURE_FRAME, buf,
+                            (size_t) num_bytes);
+          }
+          uint64_t after;
+          char nick[NICK_MAX + 1];
+          block_cmd_t cmd;
+          if (num_bytes < 0 && errno == EAGAIN) {
+            break; // drained, the socket is non-blocking
+          } else if (num_bytes <= 0) {
             if (num_bytes == 0) {
-              LOG_FROM_SUCC("socket %d hung up\n", client_pool->pfds[c].fd);
+              LOG_FROM_SUCC("socket %d hung up\n", fd);
             } else {
               LOG_FROM_ERR("recv() failure\n");
-              LOG_APPEND("errno: %s\n", errno);
+              LOG_APPEND("errno: %s\n", strerror(errno));
+            }
+            pipeline_run(&pipeline); // before its descriptor can be reused
+            if (client->is_connected) disconnect_client(client_pool, c);
+            break;
+          } else if (history_parse_sync(buf, (size_t) num_bytes, &after)) {
+            // anything still in the outbox is in the history too, the
+            // client drops the second copy by its seq
+            TRACE(TRACE_COMMAND, trace_take(), num_bytes); // never sent
+            pipeline_run(&pipeline); // the replay must include them
+            if (!client->is_connected) break;
+            client->sequenced = true;
+            if (history_replay(client_pool->history, after, client_pool, c)
+                < 0)
+            {
+              break;
             }
-            disconnect_client(client_pool, c);
+          } else if ((cmd = block_parse(buf, (size_t) num_bytes, nick))
+                     != BLOCK_NONE)
+          {
+            TRACE(TRACE_COMMAND, trace_take(), num_bytes); // never sent
+            pipeline_run(&pipeline); // earlier messages, old lists
+            if (!client->is_connected) break;
+            throttle_charge(client_pool, c, 1, (size_t) num_bytes, now);
+            block_apply(client_pool, c, cmd, nick);
           } else {
-            broadcast_all(client_pool,
-                          client_pool->pfds[c].fd,
-                          listener,
-                          data_buffer, num_bytes);
+            // one recv can hold several lines, each is a message to bill
+            size_t lines = scan_count(buf, (size_t) num_bytes, '\n');
+            throttle_charge(client_pool, c, lines > 0 ? lines : 1,
+                            (size_t) num_bytes, now);
+            pipeline_push(&pipeline, c, (size_t) num_bytes); // see stages.c
           }
+          read_budget_charge(&budget, (size_t) num_bytes);
         }
+        if (read_budget_spent(&budget) && client->is_connected)
+          client->budget_spent++;
+      } break;
       }
     }
+    pipeline_run(&pipeline);
+    WATCHDOG_STAGE("flush_outbox");
+    flush_outbox(client_pool);
+    WATCHDOG_STAGE("backpressure");
+    backpressure_update(client_pool, now);
+    WATCHDOG_STAGE("flush_corked");
+    flush_corked(client_pool);
   }
+  watchdog_stop();
+  relay_destroy(&relay);
+  transfer_destroy(&transfer);
+  pipeline_destroy(&pipeline);
+  arena_destroy(&scratch);
+  free(client_pool->history);
+  if (client_pool->capture != NULL) capture_close(client_pool->capture);
+  filter_free(client_pool->filter);
+  clients_destroy(client_pool);
+  free(data_buffer);
   return EXIT_SUCCESS;
 }
 #else // END PRODUCTION
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include "queue.h"
+#include "coro.h"
 #include "unit_test.h"
 
 int main(int argc, char **argv) {
   (void) argc; (void) argv;
   UNIT_CLIENT_BASICS();
+  UNIT_CONFIG_ARGS();
+  UNIT_RELAY_HEADER();
+  UNIT_RELAY_FORWARD();
+  UNIT_SHM_RING();
+  UNIT_UNIX_LISTENER();
+  UNIT_ALLOC_BOUNDS();
+  UNIT_QUEUE_FIFO();
+  UNIT_OUTBOX_COALESCE();
+  UNIT_SPLICE_TEE();
+  UNIT_TRANSFER_PARSE();
+  UNIT_TRANSFER_LINE();
+  UNIT_SHA256_VECTORS();
+  UNIT_HISTORY_RING();
+  UNIT_TOKEN_BUCKET();
+  UNIT_BACKPRESSURE();
+  UNIT_READ_FAIRNESS();
+  UNIT_CAPTURE_ROUNDTRIP();
+  UNIT_SCAN_KERNELS();
+  UNIT_FILTER_MATCH();
+  UNIT_BLOCK_MASKS();
+  UNIT_CORO_SCHED();
+  UNIT_PIPELINE_STAGES();
+  UNIT_TRACE_SLICES();
+  UNIT_WATCHDOG_STALL();
+  UNIT_TSTAMP_DELAYS();
   return EXIT_SUCCESS;
 }
 #endif
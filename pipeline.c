@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "pipeline.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+Stage pipeline_stages[PIPELINE_STAGES_MAX];
+int pipeline_n_stages = 0;
+
+// called from constructors, before main(); keeps the registry sorted by
+// phase, a stage goes after those of its phase registered before it
+int pipeline_register(stage_phase_t phase, const char *name, stage_fn fn) {
+  if (pipeline_n_stages == PIPELINE_STAGES_MAX) {
+    LOG_FROM_ERR("no room for stage `%s`, %d registered already\n", name,
+                 PIPELINE_STAGES_MAX);
+    return -1;
+  }
+  int at = pipeline_n_stages;
+  while (at > 0 && pipeline_stages[at - 1].phase > phase) {
+    pipeline_stages[at] = pipeline_stages[at - 1];
+    at--;
+  }
+  pipeline_stages[at] = (Stage) { name, phase, fn, 0, 0, 0 };
+  pipeline_n_stages++;
+  return 0;
+}
+
+int pipeline_init(Pipeline *p, ClientPool *pool, Relay *relay,
+                  Arena *scratch, int listener)
+{
+  *p = (Pipeline) { pool, relay, scratch, listener, NULL, 0, 0 };
+  p->batch = malloc(sizeof(MsgBatch));
+  if (p->batch == NULL) {
+    LOG_FROM_ERR("null pointer allocating %s\n", "(MsgBatch *)");
+    return -1;
+  }
+  p->batch->n = 0;
+  p->batch->used = 0;
+  return 0;
+}
+
+void pipeline_destroy(Pipeline *p) {
+  free(p->batch);
+  p->batch = NULL;
+}
+
+// room for a message of up to len bytes (at most PIPELINE_DATA_LEN), the
+// batch runs first when it has too little left
+char *pipeline_reserve(Pipeline *p, size_t len) {
+  MsgBatch *b = p->batch;
+  if (b->n == PIPELINE_BATCH_MAX || PIPELINE_DATA_LEN - b->used < len)
+    pipeline_run(p);
+  return b->data + b->used;
+}
+
+// adds the len bytes written at the last pipeline_reserve() as a message
+// from slot, taking over the trace of the last recv()
+void pipeline_push(Pipeline *p, int slot, size_t len) {
+  MsgBatch *b = p->batch;
+  b->msgs[b->n++] = (Msg) {
+    .data = b->data + b->used,
+    .len = len,
+    .slot = slot,
+    .fd = p->pool->pfds[slot].fd,
+    .kind = p->pool->clients[slot].kind,
+    .trace_id = trace_take(),
+  };
+  b->used += len;
+}
+
+// ends the message's trace slice, see trace.h
+void pipeline_drop(MsgBatch *b, int m) {
+  if (!b->msgs[m].dropped)
+    TRACE(TRACE_DROPPED, b->msgs[m].trace_id, b->msgs[m].len);
+  b->msgs[m].dropped = true;
+}
+
+// removes what the stage dropped, in order; how many that were
+static int compact(MsgBatch *b) {
+  int kept = 0;
+  for (int m = 0; m < b->n; m++) {
+    if (!b->msgs[m].dropped) b->msgs[kept++] = b->msgs[m];
+  }
+  int dropped = b->n - kept;
+  b->n = kept;
+  return dropped;
+}
+
+// every stage over the whole batch, then the batch is empty again
+void pipeline_run(Pipeline *p) {
+  MsgBatch *b = p->batch;
+  if (b->n == 0) return;
+  p->batches++;
+  p->msgs += (uint64_t) b->n;
+  const char *caller = atomic_load_explicit(&watchdog_stage_now,
+                                            memory_order_relaxed);
+  for (int s = 0; s < pipeline_n_stages && b->n > 0; s++) {
+    Stage *stage = &pipeline_stages[s];
+    WATCHDOG_STAGE(stage->name);
+    stage->calls++;
+    stage->msgs += (uint64_t) b->n;
+    stage->fn(p, b);
+    stage->dropped += (uint64_t) compact(b);
+  }
+  WATCHDOG_STAGE(caller);
+  b->n = 0;
+  b->used = 0;
+}
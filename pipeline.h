@@ -0,0 +1,112 @@
+/*
+  Messages read from users and shm clients, and file announcements (see
+  transfer.h), go through a pipeline of stages before they reach the outbox,
+  a batch at a time rather than one by one:
+
+    decode -> validate -> filter -> route -> persist -> encode
+
+  The event loop receives straight into the batch (pipeline_reserve(),
+  then pipeline_push()) and runs it once per pass, or earlier when it
+  fills up. Each stage gets every message of the batch in one call, so its
+  code and tables stay hot while it works through them, and drops what it
+  rejects with pipeline_drop(); the next stage only sees the survivors.
+
+  A stage is registered from any .c file linked into the host, main.c does
+  not list them:
+
+    static void shout(Pipeline *p, MsgBatch *b) {
+      (void) p;
+      for (int m = 0; m < b->n; m++)
+        if (b->msgs[m].len > 200) pipeline_drop(b, m);
+    }
+    PIPELINE_STAGE(STAGE_FILTER, "shout", shout);
+
+  Stages run by phase; within a phase in registration order, which across
+  files is link order. The built-in ones are in stages.c: utf8 (validate),
+  filter, broadcast (route, which also persists to the history) and relay
+  (encode). /sync and block commands bypass the pipeline, and so do
+  spliced bulk payloads, which are exempt from utf8 as they never pass
+  through userspace; they are not exempt from the filter, splicing is off
+  while one is loaded (splice_pending()). The loop runs the pipeline before
+  either so nothing overtakes a message.
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "host.h"
+#include "relay.h"
+
+#define PIPELINE_BATCH_MAX  64          // messages per batch
+#define PIPELINE_DATA_LEN   (64 * 1024) // bytes per batch
+#define PIPELINE_STAGES_MAX 32
+
+typedef enum {
+  STAGE_DECODE,
+  STAGE_VALIDATE,
+  STAGE_FILTER,
+  STAGE_ROUTE,
+  STAGE_PERSIST,
+  STAGE_ENCODE,
+} stage_phase_t;
+
+typedef struct {
+  char *data;        // in the batch's buffer, valid until the batch ran
+  size_t len;
+  int slot;          // sender in the ClientPool
+  int fd;
+  client_kind_t kind;
+  uint64_t trace_id; // see trace.h, 0 when off
+  bool dropped;
+} Msg;
+
+typedef struct {
+  int n;
+  Msg msgs[PIPELINE_BATCH_MAX];
+  size_t used;
+  char data[PIPELINE_DATA_LEN];
+} MsgBatch;
+
+typedef struct Pipeline Pipeline;
+typedef void (*stage_fn)(Pipeline *, MsgBatch *);
+
+typedef struct {
+  const char *name;
+  stage_phase_t phase;
+  stage_fn fn;
+  uint64_t calls;   // batches it got
+  uint64_t msgs;    // messages in them
+  uint64_t dropped;
+} Stage;
+
+struct Pipeline {
+  ClientPool *pool;
+  Relay *relay;     // NULL: not relaying
+  Arena *scratch;   // per loop iteration, relay frames
+  int listener;
+  MsgBatch *batch;
+  uint64_t batches; // runs, for the SIGUSR1 stats
+  uint64_t msgs;
+};
+
+// the registry, in the order the stages run
+extern Stage pipeline_stages[PIPELINE_STAGES_MAX];
+extern int pipeline_n_stages;
+
+#define PIPELINE_STAGE(phase, name, fn)                              \
+  __attribute__((constructor)) static void register_##fn(void) {     \
+    pipeline_register((phase), (name), (fn));                        \
+  }                                                                  \
+  extern int pipeline_n_stages // takes the semicolon
+
+int pipeline_register(stage_phase_t, const char *, stage_fn);
+int pipeline_init(Pipeline *, ClientPool *, Relay *, Arena *, int);
+void pipeline_destroy(Pipeline *);
+char *pipeline_reserve(Pipeline *, size_t);
+void pipeline_push(Pipeline *, int, size_t);
+void pipeline_drop(MsgBatch *, int);
+void pipeline_run(Pipeline *);
+
+#endif // PIPELINE_H_
@@ -1,3 +1,13 @@
+/*
+  SQLite storage for the probes: users, messages and, for attachments, one
+  blob row per content hash plus the attachments pointing at it.
+
+  The host does not use these tables. Its reference count for an attachment
+  body is the hard-link count of blobs/<sha256> (see transfer.c). `blobs` and
+  `attachments` only mirror that scheme for this probe's main, nothing keeps
+  them in sync with the host's blob directory.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -22,6 +32,25 @@ static const char *SQL_RAW_TABLE_MSG =
   "FOREIGN KEY(sender_id) REFERENCES users(id), "
   "FOREIGN KEY(recipient_id) REFERENCES users(id));";
 
+// attachment bodies are stored once per content hash, `refcount` counts the
+// attachments pointing at a blob and reaching 0 means its body can go; an
+// illustrative mirror of the host's link counts, see the top of this file
+static const char *SQL_RAW_TABLE_BLOB =
+  "CREATE TABLE IF NOT EXISTS blobs ("
+  "hash TEXT PRIMARY KEY, "
+  "size INTEGER NOT NULL, "
+  "refcount INTEGER NOT NULL DEFAULT 0, "
+  "created_at DATETIME DEFAULT CURRENT_TIMESTAMP);";
+
+static const char *SQL_RAW_TABLE_ATTACHMENT =
+  "CREATE TABLE IF NOT EXISTS attachments ("
+  "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+  "message_id INTEGER NOT NULL, "
+  "blob_hash TEXT NOT NULL, "
+  "name TEXT NOT NULL, "
+  "FOREIGN KEY(message_id) REFERENCES messages(id), "
+  "FOREIGN KEY(blob_hash) REFERENCES blobs(hash));";
+
 void open_db_or_die(sqlite3 **db) {
   if(sqlite3_open(":memory:", db) != SQLITE_OK) {
     fprintf(stderr,
@@ -64,6 +93,29 @@ void create_table_messages(sqlite3 *db) {
   }
 }
 
+void create_table_blobs(sqlite3 *db) {
+  char *err = 0;
+  if (sqlite3_exec(db, SQL_RAW_TABLE_BLOB, 0, 0, &err) != SQLITE_OK) {
+    fprintf(stderr, "%s() :: error creating blobs table: %s\n",
+            __func__, err);
+    sqlite3_free(err);
+  } else {
+    fprintf(stdout, "%s() :: blobs table created successfully.\n", __func__);
+  }
+}
+
+void create_table_attachments(sqlite3 *db) {
+  char *err = 0;
+  if (sqlite3_exec(db, SQL_RAW_TABLE_ATTACHMENT, 0, 0, &err) != SQLITE_OK) {
+    fprintf(stderr, "%s() :: error creating attachments table: %s\n",
+            __func__, err);
+    sqlite3_free(err);
+  } else {
+    fprintf(stdout, "%s() :: attachments table created successfully.\n",
+            __func__);
+  }
+}
+
 sqlite3_int64 insert_user(sqlite3 *db, const char *name) {
   sqlite3_stmt *stmt;
   const char *sql = "INSERT INTO users (name) VALUES (?);";
@@ -125,6 +177,122 @@ sqlite3_int64 insert_message(sqlite3 *db,
   return last_id;
 }
 
+// 1 when the blob is already stored and the body need not be sent again
+int blob_exists(sqlite3 *db, const char *hash) {
+  sqlite3_stmt *stmt;
+  const char *sql = "SELECT 1 FROM blobs WHERE hash = ?;";
+  int exists = 0;
+
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "%s() :: failed to prepare statement: %s\n",
+            __func__, sqlite3_errmsg(db));
+    return 0;
+  }
+  sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+  exists = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  return exists;
+}
+
+static int exec_bound(sqlite3 *db, const char *sql,
+                      const char *text, sqlite3_int64 num)
+{
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+  sqlite3_bind_text(stmt, 1, text, -1, SQLITE_STATIC);
+  if (num >= 0) sqlite3_bind_int64(stmt, 2, num);
+  int rv = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+  sqlite3_finalize(stmt);
+  return rv;
+}
+
+// links a message to the blob `hash`, creating the blob row on first use and
+// bumping its refcount otherwise, all in one transaction
+sqlite3_int64 insert_attachment(sqlite3 *db,
+                                int message_id,
+                                const char *hash,
+                                const char *name,
+                                sqlite3_int64 size)
+{
+  sqlite3_stmt *stmt;
+  const char *sql = "INSERT INTO attachments (message_id, blob_hash, name) "
+                    "VALUES (?, ?, ?);";
+  sqlite3_int64 last_id = -1;
+
+  fprintf(stdout, "%s() :: try( %s )\n", __func__, sql);
+
+  sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+  if (exec_bound(db, "INSERT INTO blobs (hash, size, refcount) "
+                     "VALUES (?, ?, 1) ON CONFLICT(hash) "
+                     "DO UPDATE SET refcount = refcount + 1;",
+                 hash, size) < 0)
+  {
+    fprintf(stderr, "%s() :: failed to reference blob: %s\n",
+            __func__, sqlite3_errmsg(db));
+    sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+    return last_id;
+  }
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    sqlite3_bind_int(stmt, 1, message_id);
+    sqlite3_bind_text(stmt, 2, hash, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, name, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) == SQLITE_DONE) {
+      last_id = sqlite3_last_insert_rowid(db);
+      fprintf(stdout, "%s() :: attachment `%s` inserted successfully.\n",
+              __func__, name);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if (last_id < 0) {
+    fprintf(stderr, "%s() :: failed to insert attachment: %s\n",
+            __func__, sqlite3_errmsg(db));
+    sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+    return last_id;
+  }
+  sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+  return last_id;
+}
+
+// drops one reference, returns the blob's remaining refcount (0: the stored
+// body may be deleted, the row is gone already) or -1 on error
+int release_attachment(sqlite3 *db, sqlite3_int64 attachment_id) {
+  sqlite3_stmt *stmt;
+  const char *sql = "SELECT blob_hash FROM attachments WHERE id = ?;";
+  char hash[65] = {0};
+  int refcount = -1;
+
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+  sqlite3_bind_int64(stmt, 1, attachment_id);
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    snprintf(hash, sizeof(hash), "%s", sqlite3_column_text(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+  if (hash[0] == '\0') return -1;
+
+  sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+  exec_bound(db, "UPDATE blobs SET refcount = refcount - 1 WHERE hash = ?;",
+             hash, -1);
+  if (sqlite3_prepare_v2(db, "DELETE FROM attachments WHERE id = ?;",
+                         -1, &stmt, NULL) == SQLITE_OK)
+  {
+    sqlite3_bind_int64(stmt, 1, attachment_id);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+  if (sqlite3_prepare_v2(db, "SELECT refcount FROM blobs WHERE hash = ?;",
+                         -1, &stmt, NULL) == SQLITE_OK)
+  {
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      refcount = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  if (refcount == 0)
+    exec_bound(db, "DELETE FROM blobs WHERE hash = ?;", hash, -1);
+  sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+  return refcount;
+}
+
 void ensure_directory(const char *path) {
   struct stat st = {0};
   if (stat(path, &st) == -1) mkdir(path, 0700);
@@ -183,6 +351,14 @@ int main(void) {
   insert_message(db, "goodbye moon!",  uid1, uid2);
   insert_message(db, "ola sun!",       uid2, uid1);
   insert_message(db, "sayonara mars!", uid2, uid1);
+  create_table_blobs(db);
+  create_table_attachments(db);
+  const char *cat = "e3b0c44298fc1c149afbf4c8996fb924"
+                    "27ae41e4649b934ca495991b7852b855";
+  sqlite3_int64 a1 = insert_attachment(db, 1, cat, "cat.png", 0);
+  if (!blob_exists(db, cat)) fprintf(stderr, "blob missing\n");
+  insert_attachment(db, 3, cat, "same-cat.png", 0); // body not stored again
+  release_attachment(db, a1);
   commit_from_memory(db, "./saves/");
   close_db(db);
 }
@@ -7,6 +7,12 @@ void open_db_or_die(sqlite3 **);
 void close_db(sqlite3 *);
 void create_table_users(sqlite3 *);
 void create_table_messages(sqlite3 *);
+void create_table_blobs(sqlite3 *);
+void create_table_attachments(sqlite3 *);
 sqlite3_int64 insert_user(sqlite3 *, const char *);
 sqlite3_int64 insert_message(sqlite3 *, const char *, int, int);
+int blob_exists(sqlite3 *, const char *);
+sqlite3_int64 insert_attachment(sqlite3 *, int, const char *, const char *,
+                                sqlite3_int64);
+int release_attachment(sqlite3 *, sqlite3_int64);
 void commit_from_memory(sqlite3 *, const char *);
@@ -0,0 +1,184 @@
+/*
+  host-threaded.c on coroutines: the same sequential handle_client(), but
+  every client is a coroutine (see coro.h) on one thread instead of a
+  thread of its own, so thousands of clients cost a few hundred bytes each.
+
+    make host-coro && ./build/host-coro 9001
+
+  Broadcasts do not await slow receivers: a message a receiver's socket
+  cannot take right now is dropped for it, one stuck client must not hold
+  up the sender's coroutine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "../coro.h"
+
+#define PORT_DEFAULT   9001
+#define MAX_TXT_BUFFER 256
+#define MAX_CLIENTS    4096
+#define STATS_EVERY_MS 10000
+
+typedef struct {
+  int socket;
+  size_t len;
+  char buffer[MAX_TXT_BUFFER + 1];
+} ClientState;
+
+typedef struct {
+  int host_socket;
+  CoroSched *sched;
+} AcceptState;
+
+static int CLIENTS[MAX_CLIENTS];
+static int CLIENT_COUNT = 0;
+static uint64_t DROPPED = 0; // broadcasts a receiver could not take
+
+static volatile sig_atomic_t RUN = 1;
+
+static const char *WELCOME_MSG = "hello, welcome fren!\n";
+static const char *CONN_REFUSED = "Connection to host refused!\n";
+static const char *MSG_SENT = "msg sent";
+
+static void on_sigint(int sig) {
+  (void) sig;
+  RUN = 0;
+}
+
+static void add_client(int socket) {
+  CLIENTS[CLIENT_COUNT++] = socket;
+}
+
+static void remove_client(int socket) {
+  for (int i = 0; i < CLIENT_COUNT; i++) {
+    if (CLIENTS[i] != socket) continue;
+    CLIENTS[i] = CLIENTS[--CLIENT_COUNT];
+    return;
+  }
+}
+
+static void broadcast_message_from(int sender_socket, const char *msg,
+                                   size_t len)
+{
+  for (int i = 0; i < CLIENT_COUNT; i++) {
+    if (CLIENTS[i] == sender_socket) continue;
+    ssize_t n = send(CLIENTS[i], msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < (ssize_t) len) DROPPED++;
+  }
+}
+
+static int handle_client(Coro *co) {
+  ClientState *st = co->arg;
+  CORO_BEGIN(co);
+  add_client(st->socket);
+  st->len = strlen(WELCOME_MSG);
+  CORO_SEND(co, st->socket, WELCOME_MSG, st->len);
+
+  while (RUN && co->result >= 0) {
+    CORO_RECV(co, st->socket, st->buffer, MAX_TXT_BUFFER - 1);
+    if (co->result <= 0) break;
+    st->len = (size_t) co->result;
+    st->buffer[st->len++] = '\n';
+    st->buffer[st->len] = '\0';
+    printf("Received: %s", st->buffer);
+    broadcast_message_from(st->socket, st->buffer, st->len);
+    CORO_SEND(co, st->socket, MSG_SENT, strlen(MSG_SENT));
+  }
+
+  printf("%s(): client (%d) exiting ...\n", __func__, st->socket);
+  remove_client(st->socket);
+  close(st->socket);
+  free(st);
+  CORO_END(co);
+}
+
+static int accept_clients(Coro *co) {
+  AcceptState *st = co->arg;
+  CORO_BEGIN(co);
+  while (RUN) {
+    CORO_AWAIT(co, st->host_socket, POLLIN);
+    int client_socket;
+    while ((client_socket = accept(st->host_socket, NULL, NULL)) >= 0) {
+      if (CLIENT_COUNT == MAX_CLIENTS) {
+        send(client_socket, CONN_REFUSED, strlen(CONN_REFUSED),
+             MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(client_socket);
+        continue;
+      }
+      ClientState *client = calloc(1, sizeof(ClientState));
+      if (client == NULL) {
+        fprintf(stderr, "%s(): malloc failure.\n", __func__);
+        close(client_socket);
+        continue;
+      }
+      client->socket = client_socket;
+      // NULL also when the handler already finished, it cleaned up then
+      coro_spawn(st->sched, handle_client, client);
+    }
+  }
+  CORO_END(co);
+}
+
+static int print_stats(Coro *co) {
+  CoroSched *sched = co->arg;
+  CORO_BEGIN(co);
+  while (RUN) {
+    CORO_SLEEP_MS(co, STATS_EVERY_MS);
+    printf("%d clients, %d coroutines, %lu resumes, %lu dropped\n",
+           CLIENT_COUNT, sched->n, (unsigned long) sched->resumes,
+           (unsigned long) DROPPED);
+  }
+  CORO_END(co);
+}
+
+int main(int argc, char **argv) {
+  uint16_t port = argc > 1 ? (uint16_t) atoi(argv[1]) : PORT_DEFAULT;
+  int host_socket = socket(AF_INET, SOCK_STREAM, 0);
+  int optval = 1;
+  setsockopt(host_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+  fcntl(host_socket, F_SETFL, O_NONBLOCK);
+  struct sockaddr_in server_addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = INADDR_ANY,
+  };
+  if (bind(host_socket, (struct sockaddr *) &server_addr,
+           sizeof(server_addr)) < 0 || listen(host_socket, 512) < 0)
+  {
+    perror("HOST ::");
+    close(host_socket);
+    return EXIT_FAILURE;
+  }
+  printf("Server listening on port %d...\n", port);
+  signal(SIGINT, on_sigint);
+  signal(SIGTERM, on_sigint);
+
+  CoroSched sched;
+  if (coro_sched_init(&sched) < 0) {
+    fprintf(stderr, "%s(): malloc failure.\n", __func__);
+    return EXIT_FAILURE;
+  }
+  AcceptState acceptor = { host_socket, &sched };
+  coro_spawn(&sched, accept_clients, &acceptor);
+  coro_spawn(&sched, print_stats, &sched);
+  while (RUN) {
+    if (coro_sched_run_once(&sched, 1000) < 0 && RUN) perror("poll");
+  }
+
+  // handlers left suspended never reach their cleanup
+  for (int i = 0; i < CLIENT_COUNT; i++) close(CLIENTS[i]);
+  for (int i = 0; i < sched.n; i++) {
+    if (sched.coros[i]->fn == handle_client) free(sched.coros[i]->arg);
+  }
+  coro_sched_destroy(&sched);
+  close(host_socket);
+  printf("Host closed peacefully.\n");
+  return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdatomic.h>
 
 #include "db.h"
 
@@ -19,7 +20,7 @@
 // BEGIN: client data structure
 // In the future, a thread pool should be implemented.
 #define MAX_CLIENTS 2
-int CLIENT_COUNT = 0;
+atomic_int CLIENT_COUNT = 0; // slots taken, reserved before the thread starts
 
 typedef struct {
   bool is_connected;
@@ -29,12 +30,61 @@ typedef struct {
   pthread_t thread_id;
 } Client;
 
-Client CLIENTS[MAX_CLIENTS];
+/*
+  Client threads broadcast against an immutable snapshot of the registry
+  without taking a lock. add_client()/remove_client() copy the current
+  snapshot, change the copy and publish it with one atomic store (writers
+  still serialize on REGISTRY_LOCK, readers never touch it).
+
+  A replaced snapshot, and the socket of a removed client, may still be in
+  use by a thread that loaded the old pointer, so they are retired instead
+  of freed: epoch-based reclamation frees them once every thread inside a
+  read section has moved on by two epochs. Closing the socket late matters
+  as much as the memory, a recycled descriptor would otherwise receive
+  another client's messages.
+ */
+typedef struct {
+  int n;
+  Client clients[MAX_CLIENTS];
+} ClientRegistry;
+
+static ClientRegistry EMPTY_REGISTRY; // initial version, never freed
+static _Atomic(ClientRegistry *) REGISTRY = &EMPTY_REGISTRY;
+static pthread_mutex_t REGISTRY_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
 void clients_init(void);
 void add_client(pthread_t, int);
 void remove_client(int socket);
 // END: client data structure
 
+// BEGIN: epoch based reclamation
+#define MAX_READERS MAX_CLIENTS // one per client thread
+
+typedef struct {
+  atomic_bool used;
+  atomic_bool active;    // inside a read section
+  atomic_ulong epoch;    // global epoch seen on entering it
+} EpochSlot;
+
+typedef struct Retired {
+  struct Retired *next;
+  unsigned long epoch;   // global epoch when it was unlinked
+  ClientRegistry *registry; // NULL or a snapshot to free
+  int socket;               // -1 or a descriptor to close
+} Retired;
+
+static EpochSlot EPOCH_SLOTS[MAX_READERS];
+static atomic_ulong GLOBAL_EPOCH = 0;
+static _Thread_local int EPOCH_SLOT = -1;
+static Retired *RETIRED = NULL; // guarded by REGISTRY_LOCK
+
+int epoch_register(void);
+void epoch_unregister(void);
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_reclaim(bool);
+// END: epoch based reclamation
+
 // BEGIN: signal thread
 typedef struct {
   sigset_t *set;
@@ -150,24 +200,33 @@ void host_panic_on_fail(bool cond, int host_socket, const char *msg) {
   }
 }
 
+// lock-free: the snapshot loaded here stays valid until epoch_exit()
 void broadcast_message_from(int sender_socket, const char *msg) {
-  for (int i = 0; i < CLIENT_COUNT; i++) {
-    if (CLIENTS[i].socket != sender_socket) {
-      send(CLIENTS[i].socket, msg, strlen(msg), 0);
+  epoch_enter();
+  const ClientRegistry *registry =
+    atomic_load_explicit(&REGISTRY, memory_order_acquire);
+  for (int i = 0; i < registry->n; i++) {
+    if (registry->clients[i].socket != sender_socket) {
+      send(registry->clients[i].socket, msg, strlen(msg), MSG_NOSIGNAL);
     }
   }
+  epoch_exit();
 }
 
 void join_all_threads(void) {
   printf("%s(): cleaning up threads.\n", __func__);
-  for (int i = 0; i < CLIENT_COUNT; i++) {
-    if (pthread_cancel(CLIENTS[i].thread_id) == 0) {
+  // cancelled threads remove themselves, so work from a copy
+  pthread_mutex_lock(&REGISTRY_LOCK);
+  ClientRegistry registry = *atomic_load(&REGISTRY);
+  pthread_mutex_unlock(&REGISTRY_LOCK);
+  for (int i = 0; i < registry.n; i++) {
+    if (pthread_cancel(registry.clients[i].thread_id) == 0) {
       printf("%s(): cancelling thread %d\n", __func__, i);
       fflush(stdout);
-      pthread_join(CLIENTS[i].thread_id, NULL);
+      pthread_join(registry.clients[i].thread_id, NULL);
     }
   }
-  CLIENT_COUNT = 0;
+  epoch_reclaim(true); // no readers left, free everything retired
 }
 
 int resolve_client_connection(int client_socket,
@@ -175,7 +234,8 @@ int resolve_client_connection(int client_socket,
                               struct sockaddr_in client_addr)
 {
   if (client_socket < 0) return -1;
-  if ((CLIENT_COUNT + 1 > MAX_CLIENTS)) {
+  if (atomic_fetch_add(&CLIENT_COUNT, 1) >= MAX_CLIENTS) {
+    atomic_fetch_sub(&CLIENT_COUNT, 1);
     printf("%s(): rejected new client, at (%d) capacity.\n",
            __func__, MAX_CLIENTS);
 
@@ -187,20 +247,23 @@ int resolve_client_connection(int client_socket,
   int *ptr_client_socket = malloc(sizeof(int));
   if (!ptr_client_socket) {
     fprintf(stderr, "%s(): malloc failure.\n", __func__);
+    atomic_fetch_sub(&CLIENT_COUNT, 1);
     close(client_socket);
     return -1;
   }
 
   *ptr_client_socket = client_socket;
+  // the thread adds itself, so it is never removed before it was added
   if (pthread_create(thread, NULL, handle_client, ptr_client_socket) != 0) {
+    atomic_fetch_sub(&CLIENT_COUNT, 1);
     close(client_socket);
     free(ptr_client_socket); // Cleanup on thread creation failure
     return -1;
   }
 
-  add_client(*thread, client_socket);
   printf("%s(): client connected --> %s\nTotal clients: %d\n",
-         __func__, inet_ntoa(client_addr.sin_addr), CLIENT_COUNT);
+         __func__, inet_ntoa(client_addr.sin_addr),
+         atomic_load(&CLIENT_COUNT));
   send(client_socket, WELCOME_MSG, strlen(WELCOME_MSG), 0);
   return 0;
 }
@@ -210,7 +273,10 @@ void client_cleanup_handler(void *arg) {
   printf("%s(): client (%d) exiting ...\n", __func__, client_socket);
   printf("%s(): cleaning client socket ... \n", __func__);
   fflush(stdout);
-  close(client_socket);
+  epoch_unregister(); // also ends a read section cut short by cancellation
+  // the peer learns now, the descriptor is closed once no broadcast can
+  // still be sending to it
+  shutdown(client_socket, SHUT_RDWR);
   remove_client(client_socket);
   free(arg);
 }
@@ -218,6 +284,11 @@ void client_cleanup_handler(void *arg) {
 void *handle_client(void *arg) {
   int *client_socket = (int *) arg;
   pthread_cleanup_push(client_cleanup_handler, client_socket);
+  if (epoch_register() < 0) {
+    fprintf(stderr, "%s(): no free epoch slot.\n", __func__);
+    pthread_exit(NULL);
+  }
+  add_client(pthread_self(), *client_socket);
 
   char buffer[MAX_TXT_BUFFER];
   ssize_t bytes_read;
@@ -233,7 +304,6 @@ void *handle_client(void *arg) {
     broadcast_message_from(*client_socket, buffer);
   }
 
-  close(*client_socket);
   pthread_cleanup_pop(1);
   return NULL;
 }
@@ -285,33 +355,154 @@ void *handle_signal_thread(void *raw) {
 void clients_init(void) {
   size_t n = 0;
   while (n < MAX_CLIENTS) {
-    CLIENTS[n].is_connected = false;
-    CLIENTS[n].socket = -1;
-    CLIENTS[n++].id = -1;
+    EMPTY_REGISTRY.clients[n].is_connected = false;
+    EMPTY_REGISTRY.clients[n].socket = -1;
+    EMPTY_REGISTRY.clients[n++].id = -1;
   }
+  EMPTY_REGISTRY.n = 0;
+}
+
+// caller holds REGISTRY_LOCK
+static void retire(ClientRegistry *registry, int socket) {
+  Retired *node = malloc(sizeof(Retired));
+  if (node == NULL) { // leak rather than free something still read
+    fprintf(stderr, "%s(): malloc failure.\n", __func__);
+    return;
+  }
+  node->epoch = atomic_load(&GLOBAL_EPOCH);
+  node->registry = registry == &EMPTY_REGISTRY ? NULL : registry;
+  node->socket = socket;
+  node->next = RETIRED;
+  RETIRED = node;
+}
+
+// caller holds REGISTRY_LOCK, publishes next and retires the version it
+// replaces (plus the socket of a removed client)
+static void publish(ClientRegistry *next, int retired_socket) {
+  ClientRegistry *prev = atomic_exchange_explicit(&REGISTRY, next,
+                                                  memory_order_acq_rel);
+  retire(prev, retired_socket);
 }
 
 void add_client(pthread_t thread, int client_socket) {
-  CLIENTS[CLIENT_COUNT].thread_id = thread;
-  CLIENTS[CLIENT_COUNT].socket = client_socket;
-  CLIENTS[CLIENT_COUNT].id = CLIENT_COUNT;
-  CLIENTS[CLIENT_COUNT].is_connected = true;
-  CLIENT_COUNT++;
+  pthread_mutex_lock(&REGISTRY_LOCK);
+  ClientRegistry *next = malloc(sizeof(ClientRegistry));
+  if (next == NULL) {
+    pthread_mutex_unlock(&REGISTRY_LOCK);
+    fprintf(stderr, "%s(): malloc failure.\n", __func__);
+    return;
+  }
+  *next = *atomic_load(&REGISTRY);
+  Client *client = &next->clients[next->n];
+  client->thread_id = thread;
+  client->socket = client_socket;
+  client->id = next->n;
+  client->is_connected = true;
+  next->n++;
+  publish(next, -1);
+  epoch_reclaim(false);
+  pthread_mutex_unlock(&REGISTRY_LOCK);
   printf("%s(): client successfully added on socket %d.\n",
          __func__, client_socket);
   fflush(stdout);
 }
 
 void remove_client(int socket) {
-  for (size_t n = 0; n < MAX_CLIENTS; n ++) {
-    if (CLIENTS[n].socket == socket) {
-      CLIENTS[n].socket = -1;
-      CLIENTS[n].id = -1;
-      CLIENTS[n].is_connected = false;
-      CLIENT_COUNT--;
-      printf("%s(): client successfully removed from socket %d.\n",
-             __func__, socket);
-      fflush(stdout);
+  pthread_mutex_lock(&REGISTRY_LOCK);
+  const ClientRegistry *prev = atomic_load(&REGISTRY);
+  ClientRegistry *next = malloc(sizeof(ClientRegistry));
+  if (next == NULL) {
+    pthread_mutex_unlock(&REGISTRY_LOCK);
+    fprintf(stderr, "%s(): malloc failure.\n", __func__);
+    return;
+  }
+  next->n = 0;
+  bool found = false;
+  for (int n = 0; n < prev->n; n++) {
+    if (prev->clients[n].socket == socket) {
+      found = true;
+      continue;
+    }
+    next->clients[next->n] = prev->clients[n];
+    next->clients[next->n].id = next->n;
+    next->n++;
+  }
+  if (!found) { // never added, nobody can be sending to it
+    free(next);
+    close(socket);
+  } else {
+    publish(next, socket);
+    epoch_reclaim(false);
+  }
+  atomic_fetch_sub(&CLIENT_COUNT, 1);
+  pthread_mutex_unlock(&REGISTRY_LOCK);
+  printf("%s(): client successfully removed from socket %d.\n",
+         __func__, socket);
+  fflush(stdout);
+}
+
+// claims a slot for the calling thread, -1 when all are taken
+int epoch_register(void) {
+  for (int i = 0; i < MAX_READERS; i++) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&EPOCH_SLOTS[i].used, &expected,
+                                       true))
+    {
+      atomic_store(&EPOCH_SLOTS[i].active, false);
+      EPOCH_SLOT = i;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void epoch_unregister(void) {
+  if (EPOCH_SLOT < 0) return;
+  atomic_store(&EPOCH_SLOTS[EPOCH_SLOT].active, false);
+  atomic_store(&EPOCH_SLOTS[EPOCH_SLOT].used, false);
+  EPOCH_SLOT = -1;
+}
+
+// seq_cst: the epoch we announce must be visible before we load REGISTRY
+void epoch_enter(void) {
+  EpochSlot *slot = &EPOCH_SLOTS[EPOCH_SLOT];
+  atomic_store(&slot->active, true);
+  atomic_store(&slot->epoch, atomic_load(&GLOBAL_EPOCH));
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit(void) {
+  atomic_store_explicit(&EPOCH_SLOTS[EPOCH_SLOT].active, false,
+                        memory_order_release);
+}
+
+// the global epoch moves on once every active reader has seen it
+static bool epoch_try_advance(void) {
+  unsigned long epoch = atomic_load(&GLOBAL_EPOCH);
+  for (int i = 0; i < MAX_READERS; i++) {
+    if (!atomic_load(&EPOCH_SLOTS[i].used)) continue;
+    if (!atomic_load(&EPOCH_SLOTS[i].active)) continue;
+    if (atomic_load(&EPOCH_SLOTS[i].epoch) != epoch) return false;
+  }
+  return atomic_compare_exchange_strong(&GLOBAL_EPOCH, &epoch, epoch + 1);
+}
+
+// caller holds REGISTRY_LOCK (or is the last thread); anything retired two
+// epochs ago cannot be referenced by a reader anymore, `all` skips the wait
+void epoch_reclaim(bool all) {
+  epoch_try_advance();
+  epoch_try_advance();
+  unsigned long epoch = atomic_load(&GLOBAL_EPOCH);
+  Retired **link = &RETIRED;
+  while (*link != NULL) {
+    Retired *node = *link;
+    if (!all && node->epoch + 2 > epoch) {
+      link = &node->next;
+      continue;
     }
+    *link = node->next;
+    free(node->registry);
+    if (node->socket >= 0) close(node->socket);
+    free(node);
   }
 }
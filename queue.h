@@ -0,0 +1,181 @@
+/*
+  Bounded lock-free queues of pointers for handing work between threads.
+
+  SpscQueue: exactly one producer thread and one consumer thread. Each side
+  owns its index and keeps a cached copy of the other one, so the shared
+  cache line is only read when the cached view says full/empty.
+
+  MpscQueue: any number of producers, one consumer. Every cell carries a
+  sequence number (Vyukov's bounded queue), producers claim cells with a CAS
+  on the tail and publish them by bumping the cell sequence.
+
+  Indices live on their own cache lines so producers and consumer never
+  false-share. Capacities must be powers of two. All functions are static
+  inline, there is nothing to link:
+
+    #include "queue.h"
+
+  bench/queue_bench.c measures both under contention (`make bench`).
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define QUEUE_CACHELINE 64
+
+// BEGIN: spsc
+typedef struct {
+  _Alignas(QUEUE_CACHELINE) _Atomic size_t head; // next slot to pop
+  size_t cached_tail;                            // consumer's view of tail
+  _Alignas(QUEUE_CACHELINE) _Atomic size_t tail; // next slot to push
+  size_t cached_head;                            // producer's view of head
+  _Alignas(QUEUE_CACHELINE) size_t mask;
+  void **slots;
+} SpscQueue;
+
+static inline bool spsc_init(SpscQueue *q, size_t cap) {
+  if (cap < 2 || (cap & (cap - 1)) != 0) return false;
+  q->slots = calloc(cap, sizeof(void *));
+  if (q->slots == NULL) return false;
+  q->mask = cap - 1;
+  q->cached_tail = q->cached_head = 0;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  return true;
+}
+
+static inline void spsc_destroy(SpscQueue *q) {
+  free(q->slots);
+  q->slots = NULL;
+}
+
+// pushes up to n items, returns how many fit
+static inline size_t spsc_push_batch(SpscQueue *q, void *const *items, size_t n)
+{
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t free_slots = q->mask + 1 - (tail - q->cached_head);
+  if (free_slots < n) {
+    q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+    free_slots = q->mask + 1 - (tail - q->cached_head);
+    if (n > free_slots) n = free_slots;
+  }
+  for (size_t i = 0; i < n; i++) q->slots[(tail + i) & q->mask] = items[i];
+  atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+  return n;
+}
+
+static inline bool spsc_push(SpscQueue *q, void *item) {
+  return spsc_push_batch(q, &item, 1) == 1;
+}
+
+// pops up to n items, returns how many were there
+static inline size_t spsc_pop_batch(SpscQueue *q, void **items, size_t n) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t avail = q->cached_tail - head;
+  if (avail < n) {
+    q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    avail = q->cached_tail - head;
+    if (n > avail) n = avail;
+  }
+  for (size_t i = 0; i < n; i++) items[i] = q->slots[(head + i) & q->mask];
+  atomic_store_explicit(&q->head, head + n, memory_order_release);
+  return n;
+}
+
+static inline bool spsc_pop(SpscQueue *q, void **item) {
+  return spsc_pop_batch(q, item, 1) == 1;
+}
+// END: spsc
+
+// BEGIN: mpsc
+typedef struct {
+  _Atomic size_t seq; // == position: free for it, == position + 1: full
+  void *item;
+} MpscCell;
+
+typedef struct {
+  _Alignas(QUEUE_CACHELINE) _Atomic size_t tail; // shared by producers
+  _Alignas(QUEUE_CACHELINE) size_t head;         // consumer only
+  _Alignas(QUEUE_CACHELINE) size_t mask;
+  MpscCell *cells;
+} MpscQueue;
+
+static inline bool mpsc_init(MpscQueue *q, size_t cap) {
+  if (cap < 2 || (cap & (cap - 1)) != 0) return false;
+  q->cells = malloc(cap * sizeof(MpscCell));
+  if (q->cells == NULL) return false;
+  for (size_t c = 0; c < cap; c++) atomic_init(&q->cells[c].seq, c);
+  q->mask = cap - 1;
+  q->head = 0;
+  atomic_init(&q->tail, 0);
+  return true;
+}
+
+static inline void mpsc_destroy(MpscQueue *q) {
+  free(q->cells);
+  q->cells = NULL;
+}
+
+// claims up to n consecutive cells with a single CAS, returns how many
+static inline size_t mpsc_push_batch(MpscQueue *q, void *const *items, size_t n)
+{
+  size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t got;
+  for (;;) {
+    got = 0;
+    while (got < n) {
+      MpscCell *cell = &q->cells[(pos + got) & q->mask];
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+      if (seq != pos + got) break;
+      got++;
+    }
+    if (got == 0) {
+      MpscCell *cell = &q->cells[pos & q->mask];
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+      if ((ptrdiff_t) (seq - pos) < 0) return 0; // full
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+      continue; // another producer got there first
+    }
+    if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + got,
+                                              memory_order_relaxed,
+                                              memory_order_relaxed))
+      break;
+  }
+  for (size_t i = 0; i < got; i++) {
+    MpscCell *cell = &q->cells[(pos + i) & q->mask];
+    cell->item = items[i];
+    atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);
+  }
+  return got;
+}
+
+static inline bool mpsc_push(MpscQueue *q, void *item) {
+  return mpsc_push_batch(q, &item, 1) == 1;
+}
+
+// pops up to n items, stops early at a cell a producer has not published yet
+static inline size_t mpsc_pop_batch(MpscQueue *q, void **items, size_t n) {
+  size_t got = 0;
+  while (got < n) {
+    MpscCell *cell = &q->cells[q->head & q->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (seq != q->head + 1) break;
+    items[got++] = cell->item;
+    atomic_store_explicit(&cell->seq, q->head + q->mask + 1,
+                          memory_order_release);
+    q->head++;
+  }
+  return got;
+}
+
+static inline bool mpsc_pop(MpscQueue *q, void **item) {
+  return mpsc_pop_batch(q, item, 1) == 1;
+}
+// END: mpsc
+
+#endif // QUEUE_H_
@@ -0,0 +1,37 @@
+#include <time.h>
+#include <float.h>
+
+#include "ratelimit.h"
+
+int64_t ratelimit_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// starts full, holding one second worth of tokens
+void bucket_init(TokenBucket *bucket, double rate, int64_t now_us) {
+  bucket->rate = rate;
+  bucket->burst = rate;
+  bucket->tokens = rate;
+  bucket->last_us = now_us;
+}
+
+double bucket_available(TokenBucket *bucket, int64_t now_us) {
+  if (bucket->rate <= 0) return DBL_MAX; // unlimited
+  double refill = (double) (now_us - bucket->last_us) * bucket->rate / 1e6;
+  bucket->tokens += refill;
+  if (bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+  bucket->last_us = now_us;
+  return bucket->tokens;
+}
+
+void bucket_take(TokenBucket *bucket, double n) {
+  if (bucket->rate > 0) bucket->tokens -= n;
+}
+
+// microseconds until at least n tokens are available, 0 if they are now
+int64_t bucket_wait_us(const TokenBucket *bucket, double n) {
+  if (bucket->rate <= 0 || bucket->tokens >= n) return 0;
+  return (int64_t) ((n - bucket->tokens) * 1e6 / bucket->rate) + 1;
+}
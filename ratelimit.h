@@ -0,0 +1,36 @@
+/*
+  Per-connection ingress rate limiting. Every user connection gets two token
+  buckets, messages/sec (`rate-msgs`) and bytes/sec (`rate-bytes`), each
+  holding up to one second worth of tokens so short bursts pass untouched.
+
+  A client is checked before its data is read: recv() never asks for more
+  bytes than the byte bucket holds, and a client out of tokens is paused by
+  dropping POLLIN from its poll events. Its bytes then wait in the kernel
+  (TCP pushes back on the sender) until the buckets refill, at which point
+  POLLIN is restored. Nobody is disconnected for going fast; the host just
+  stops spending O(clients) fan-out on one noisy sender.
+
+    ./build/run 9001 --rate-msgs 20 --rate-bytes 8192
+ */
+
+#ifndef RATELIMIT_H_
+#define RATELIMIT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+  double rate;   // tokens per second, 0: unlimited
+  double burst;  // bucket size
+  double tokens; // may go negative after an oversized charge (debt)
+  int64_t last_us;
+} TokenBucket;
+
+int64_t ratelimit_now_us(void);
+void bucket_init(TokenBucket *, double, int64_t);
+double bucket_available(TokenBucket *, int64_t);
+void bucket_take(TokenBucket *, double);
+int64_t bucket_wait_us(const TokenBucket *, double);
+
+#endif // RATELIMIT_H_
@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+
+#include "relay.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+size_t relay_encode_header(uint8_t *buf, const RelayHeader *hdr) {
+  buf[0] = hdr->type;
+  buf[1] = 0; // reserved
+  buf[2] = (uint8_t) (hdr->len >> 8);
+  buf[3] = (uint8_t) (hdr->len);
+  for (int b = 0; b < 4; b++)
+    buf[4 + b] = (uint8_t) (hdr->origin >> (24 - 8 * b));
+  for (int b = 0; b < 8; b++)
+    buf[8 + b] = (uint8_t) (hdr->seq >> (56 - 8 * b));
+  return RELAY_HEADER_LEN;
+}
+
+void relay_decode_header(const uint8_t *buf, RelayHeader *hdr) {
+  hdr->type   = buf[0];
+  hdr->len    = (uint16_t) ((buf[2] << 8) | buf[3]);
+  hdr->origin = 0;
+  hdr->seq    = 0;
+  for (int b = 0; b < 4; b++) hdr->origin = (hdr->origin << 8) | buf[4 + b];
+  for (int b = 0; b < 8; b++) hdr->seq    = (hdr->seq << 8)    | buf[8 + b];
+}
+
+void relay_init(Relay *relay, uint32_t self_id) {
+  memset(relay, 0, sizeof(*relay));
+  relay->self_id = self_id;
+  relay->listener_fd = -1;
+  for (int p = 0; p < RELAY_MAX_PEERS; p++) relay->peers[p].fd = -1;
+
+  // sequence numbers start at wall clock time so a restarted host is never
+  // mistaken for a replay of its previous life by the peers that outlived it
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  relay->next_seq = (uint64_t) now.tv_sec * 1000000000ull
+                  + (uint64_t) now.tv_nsec;
+}
+
+static RelayPeer *peer_by_fd(Relay *relay, int fd) {
+  for (int p = 0; p < RELAY_MAX_PEERS; p++) {
+    if (relay->peers[p].fd == fd) return &relay->peers[p];
+  }
+  return NULL;
+}
+
+static int slot_of(const ClientPool *pool, int fd) {
+  for (int c = 0; c < pool->max; c++) {
+    if (pool->pfds[c].fd == fd) return c;
+  }
+  return -1;
+}
+
+// the pool dropped the link (queue over its cap, send error) and already
+// closed the socket, only our side is left to clear
+static void peer_forget(Relay *relay, RelayPeer *peer) {
+  LOG_FROM_WARN("relay link to host %u on socket %d is gone\n",
+                peer->peer_id, peer->fd);
+  peer->fd = -1;
+  peer->peer_id = 0;
+  peer->rx_len = 0;
+  relay->n_peers--;
+}
+
+// never blocks the loop: through client_send(), what the link does not take
+// now waits in its OutQueue for POLLOUT; false when the link got dropped
+static bool
+peer_send(Relay *relay, RelayPeer *peer, const uint8_t *frame, size_t len)
+{
+  int c = slot_of(relay->pool, peer->fd);
+  struct iovec iov = { (void *) frame, len };
+  if (c < 0 || client_send(relay->pool, c, &iov, 1) < 0) {
+    peer_forget(relay, peer);
+    return false;
+  }
+  return true;
+}
+
+static void send_hello(Relay *relay, RelayPeer *peer) {
+  uint8_t buf[RELAY_HEADER_LEN];
+  RelayHeader hdr = { .type = RELAY_HELLO, .origin = relay->self_id };
+  relay_encode_header(buf, &hdr);
+  if (!peer_send(relay, peer, buf, sizeof(buf))) {
+    LOG_FROM_ERR("failed to greet relay peer\n");
+  }
+}
+
+static void
+peer_attach(Relay *relay, ClientPool *pool, int fd, bool dialed)
+{
+  RelayPeer *peer = peer_by_fd(relay, -1);
+  if (peer == NULL) {
+    LOG_FROM_ERR("max relay peers (%d) reached, closing link\n",
+                 RELAY_MAX_PEERS);
+    close(fd);
+    return;
+  }
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+      client_add_as(pool, fd, POLLIN, CLIENT_RELAY) < 0)
+  {
+    LOG_FROM_ERR("no pool slot for relay link, closing socket %d\n", fd);
+    close(fd);
+    return;
+  }
+  peer->fd = fd;
+  peer->dialed = dialed;
+  peer->peer_id = 0;
+  peer->rx_len = 0;
+  relay->n_peers++;
+  send_hello(relay, peer);
+}
+
+static void peer_detach(Relay *relay, ClientPool *pool, RelayPeer *peer) {
+  LOG_FROM_WARN("dropping relay link to host %u on socket %d\n",
+                peer->peer_id, peer->fd);
+  close(peer->fd);
+  client_remove(pool, peer->fd);
+  peer->fd = -1;
+  peer->peer_id = 0;
+  peer->rx_len = 0;
+  relay->n_peers--;
+}
+
+static void relay_dial(Relay *relay, ClientPool *pool, const char *spec) {
+  char host[256];
+  const char *colon = strrchr(spec, ':');
+  if (colon == NULL || (size_t) (colon - spec) >= sizeof(host)) {
+    LOG_FROM_ERR("bad peer `%s`, expected host:port\n", spec);
+    return;
+  }
+  memcpy(host, spec, (size_t) (colon - spec));
+  host[colon - spec] = '\0';
+
+  struct addrinfo config, *addr_info, *curr;
+  memset(&config, 0, sizeof(config));
+  config.ai_family   = AF_UNSPEC;
+  config.ai_socktype = SOCK_STREAM;
+
+  int rv;
+  if ((rv = getaddrinfo(host, colon + 1, &config, &addr_info)) != 0) {
+    LOG_FROM_ERR("%s: %s\n", spec, gai_strerror(rv));
+    return;
+  }
+
+  int fd = -1;
+  for (curr = addr_info; curr != NULL; curr = curr->ai_next) {
+    fd = socket(curr->ai_family, curr->ai_socktype, curr->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, curr->ai_addr, curr->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addr_info);
+
+  if (fd < 0) {
+    LOG_FROM_WARN("peer %s is not up yet, it will dial us\n", spec);
+    return;
+  }
+  LOG_FROM_SUCC("dialed relay peer %s on socket %d\n", spec, fd);
+  peer_attach(relay, pool, fd, true);
+}
+
+void
+relay_setup_from_args(Relay *relay, ClientPool *pool, int argc, char **argv)
+{
+  relay->pool = pool;
+  for (int a = 1; a + 1 < argc; a++) {
+    if (strcmp(argv[a], "--relay-id") == 0) {
+      relay->self_id = (uint32_t) strtoul(argv[++a], NULL, 10);
+    }
+  }
+  for (int a = 1; a + 1 < argc; a++) {
+    if (strcmp(argv[a], "--relay-port") == 0) {
+      relay->listener_fd = get_listener_socket((uint16_t) atoi(argv[++a]));
+      client_add_as(pool, relay->listener_fd, POLLIN, CLIENT_RELAY_LISTENER);
+      LOG_FROM_SUCC("relay %u listening on port %s\n",
+                    relay->self_id, argv[a]);
+    } else if (strcmp(argv[a], "--peer") == 0) {
+      relay_dial(relay, pool, argv[++a]);
+    }
+  }
+}
+
+void relay_accept(Relay *relay, ClientPool *pool) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd = accept(relay->listener_fd, (struct sockaddr *) &addr, &addr_len);
+  if (fd == -1) {
+    LOG_FROM_ERR("failed to accept relay link\n");
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return;
+  }
+  LOG_FROM_SUCC("accepted relay link on socket %d\n", fd);
+  peer_attach(relay, pool, fd, false);
+}
+
+static uint32_t link_dialer(const Relay *relay, const RelayPeer *peer) {
+  return peer->dialed ? relay->self_id : peer->peer_id;
+}
+
+// returns false when the hello made us drop `peer` itself
+static bool
+on_hello(Relay *relay, ClientPool *pool, RelayPeer *peer, uint32_t peer_id)
+{
+  peer->peer_id = peer_id;
+  if (peer_id == relay->self_id) {
+    LOG_FROM_WARN("relay link loops back to ourselves\n");
+    peer_detach(relay, pool, peer);
+    return false;
+  }
+  for (int p = 0; p < RELAY_MAX_PEERS; p++) {
+    RelayPeer *other = &relay->peers[p];
+    if (other == peer || other->fd < 0 || other->peer_id != peer_id) continue;
+    // both hosts dialed each other, both sides keep the same single link
+    uint32_t keep = relay->self_id < peer_id ? relay->self_id : peer_id;
+    if (link_dialer(relay, peer) == keep && link_dialer(relay, other) != keep)
+    {
+      peer_detach(relay, pool, other);
+      return true;
+    }
+    peer_detach(relay, pool, peer);
+    return false;
+  }
+  LOG_FROM_SUCC("relay link up with host %u\n", peer_id);
+  return true;
+}
+
+static bool origin_linked(const Relay *relay, uint32_t origin) {
+  for (int p = 0; p < RELAY_MAX_PEERS; p++) {
+    if (relay->peers[p].fd >= 0 && relay->peers[p].peer_id == origin)
+      return true;
+  }
+  return false;
+}
+
+_Static_assert(RELAY_MAX_PEERS < RELAY_MAX_ORIGINS,
+               "a full table must have an origin no link leads to");
+
+// highest-sequence-wins is sufficient: every link is FIFO, so by the time a
+// frame arrives over some path all earlier frames of that origin on the same
+// path have been seen already. A full table forgets an origin no link leads
+// to, a linked one would let its duplicates through.
+static bool already_seen(Relay *relay, uint32_t origin, uint64_t seq) {
+  if (origin == relay->self_id) return true;
+  for (int s = 0; s < relay->n_seen; s++) {
+    if (relay->seen[s].origin != origin) continue;
+    if (seq <= relay->seen[s].seq) return true;
+    relay->seen[s].seq = seq;
+    return false;
+  }
+  int slot = relay->n_seen;
+  if (slot < RELAY_MAX_ORIGINS) {
+    relay->n_seen++;
+  } else {
+    slot = 0;
+    while (origin_linked(relay, relay->seen[slot].origin)) slot++;
+  }
+  relay->seen[slot].origin = origin;
+  relay->seen[slot].seq = seq;
+  return false;
+}
+
+// POLLOUT on a link: its queue goes out like a user's
+void relay_on_writable(Relay *relay, ClientPool *pool, int c) {
+  RelayPeer *peer = peer_by_fd(relay, pool->pfds[c].fd);
+  client_on_writable(pool, c);
+  if (peer != NULL && !pool->clients[c].is_connected)
+    peer_forget(relay, peer);
+}
+
+void relay_on_readable(Relay *relay, ClientPool *pool, int fd) {
+  RelayPeer *peer = peer_by_fd(relay, fd);
+  if (peer == NULL) return;
+
+  ssize_t n = recv(fd, peer->rx + peer->rx_len,
+                   sizeof(peer->rx) - peer->rx_len, 0);
+  if (n < 0 && errno == EAGAIN) return;
+  if (n <= 0) {
+    peer_detach(relay, pool, peer);
+    return;
+  }
+  peer->rx_len += (size_t) n;
+
+  size_t off = 0;
+  while (peer->rx_len - off >= RELAY_HEADER_LEN) {
+    RelayHeader hdr;
+    relay_decode_header(peer->rx + off, &hdr);
+    if (hdr.len > MAX_DATA_LEN_CEIL) {
+      LOG_FROM_ERR("oversized relay frame (%u bytes)\n", hdr.len);
+      peer_detach(relay, pool, peer);
+      return;
+    }
+    size_t frame_len = RELAY_HEADER_LEN + hdr.len;
+    if (peer->rx_len - off < frame_len) break;
+
+    switch ((relay_frame_t) hdr.type) {
+    case RELAY_HELLO:
+      if (!on_hello(relay, pool, peer, hdr.origin)) return;
+      break;
+    case RELAY_MSG:
+      relay->frames_in++;
+      if (already_seen(relay, hdr.origin, hdr.seq)) {
+        relay->frames_suppressed++;
+        break;
+      }
+      // delivered here only, its origin sent it to every host itself
+      broadcast_all(pool, -1, -1,
+                    (char *) peer->rx + off + RELAY_HEADER_LEN, hdr.len);
+      break;
+    default:
+      LOG_FROM_ERR("unknown relay frame type %u\n", hdr.type);
+      peer_detach(relay, pool, peer);
+      return;
+    }
+    off += frame_len;
+  }
+  memmove(peer->rx, peer->rx + off, peer->rx_len - off);
+  peer->rx_len -= off;
+}
+
+void
+relay_publish(Relay *relay, Arena *scratch, const char *msg, size_t len)
+{
+  if (relay->n_peers == 0) return;
+  if (len > MAX_DATA_LEN_CEIL) len = MAX_DATA_LEN_CEIL;
+  uint8_t *frame = arena_alloc(scratch, RELAY_HEADER_LEN + len);
+  if (frame == NULL) {
+    LOG_FROM_ERR("scratch arena exhausted, message not relayed\n");
+    return;
+  }
+  RelayHeader hdr = {
+    .type   = RELAY_MSG,
+    .len    = (uint16_t) len,
+    .origin = relay->self_id,
+    .seq    = relay->next_seq++,
+  };
+  relay_encode_header(frame, &hdr);
+  memcpy(frame + RELAY_HEADER_LEN, msg, len);
+  for (int p = 0; p < RELAY_MAX_PEERS; p++) {
+    RelayPeer *peer = &relay->peers[p];
+    if (peer->fd < 0) continue;
+    if (peer_send(relay, peer, frame, RELAY_HEADER_LEN + len))
+      relay->frames_out++;
+  }
+}
+
+void relay_destroy(Relay *relay) {
+  for (int p = 0; p < RELAY_MAX_PEERS; p++) {
+    if (relay->peers[p].fd >= 0) close(relay->peers[p].fd);
+  }
+  if (relay->listener_fd >= 0) close(relay->listener_fd);
+}
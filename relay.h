@@ -0,0 +1,90 @@
+/*
+  Inter-host relay: several host processes peer over dedicated TCP links so a
+  message said on one host reaches the clients of every host. A message is
+  sent once per peer link (never once per remote client), each peer fans it
+  out to its own ClientPool. The hosts form a full mesh: a host sends its own
+  messages to every peer and never forwards what it received, so each
+  message crosses each link once instead of flooding the mesh. Frames carry
+  the id of the host they originated from plus a per-origin sequence number,
+  hosts drop frames they have already seen, e.g. while two hosts that dialed
+  each other still have both links up.
+
+  Links are non-blocking: what a link does not take is queued like a user's
+  outbound (see client_send() in host.h) and a link whose queue passes
+  queue-client-max is dropped.
+
+  Local cluster on loopback, three hosts in a full mesh:
+
+    ./build/run 9001 --relay-port 9101
+    ./build/run 9002 --relay-port 9102 --peer 127.0.0.1:9101
+    ./build/run 9003 --relay-port 9103 --peer 127.0.0.1:9101 \
+                                       --peer 127.0.0.1:9102
+
+  Hosts which start before their peers simply get dialed later, only one link
+  survives per pair of hosts (the one dialed by the lower id).
+ */
+
+#ifndef RELAY_H_
+#define RELAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "host.h"
+
+#define RELAY_MAX_PEERS   8
+#define RELAY_MAX_ORIGINS 64
+#define RELAY_HEADER_LEN  16
+#define RELAY_RX_CAP      (2 * (RELAY_HEADER_LEN + MAX_DATA_LEN_CEIL))
+
+typedef enum {
+  RELAY_HELLO = 1,
+  RELAY_MSG   = 2,
+} relay_frame_t;
+
+typedef struct {
+  uint8_t type;
+  uint16_t len;
+  uint32_t origin;
+  uint64_t seq;
+} RelayHeader;
+
+typedef struct {
+  int fd;
+  bool dialed;      // we connected out, the peer accepted
+  uint32_t peer_id; // 0 until the peer said hello
+  size_t rx_len;
+  uint8_t rx[RELAY_RX_CAP];
+} RelayPeer;
+
+typedef struct {
+  uint32_t origin;
+  uint64_t seq; // highest sequence delivered from this origin
+} RelaySeen;
+
+typedef struct {
+  ClientPool *pool; // the links live in it, set by relay_setup_from_args()
+  uint32_t self_id;
+  uint64_t next_seq;
+  int listener_fd;
+  uint8_t n_peers;
+  RelayPeer peers[RELAY_MAX_PEERS];
+  uint8_t n_seen;
+  RelaySeen seen[RELAY_MAX_ORIGINS];
+  uint64_t frames_out;
+  uint64_t frames_in;
+  uint64_t frames_suppressed;
+} Relay;
+
+void relay_init(Relay *, uint32_t);
+void relay_setup_from_args(Relay *, ClientPool *, int, char **);
+void relay_accept(Relay *, ClientPool *);
+void relay_on_readable(Relay *, ClientPool *, int);
+void relay_on_writable(Relay *, ClientPool *, int);
+void relay_publish(Relay *, Arena *, const char *, size_t);
+void relay_destroy(Relay *);
+
+size_t relay_encode_header(uint8_t *, const RelayHeader *);
+void relay_decode_header(const uint8_t *, RelayHeader *);
+
+#endif // RELAY_H_
@@ -0,0 +1,228 @@
+/*
+  Plays a capture (see capture.h) back at a host: one TCP connection per
+  captured connection id, opened and closed where the capture says, every
+  frame sent as it was received. Whatever the host sends back is read and
+  dropped so it never has to hold us up: the host stops reading a client
+  whose replies pile up, so a send that cannot go on waits in poll() for
+  the socket to drain while reading the replies of every connection.
+
+    make replay
+    ./build/replay prod.cap [host] [port] [--fast | --speed 4]
+
+  By default frames keep their original spacing, --speed divides it and
+  --fast sends everything back to back. Reports frames/s and throughput at
+  the end, plus how far behind schedule timed replays fell.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "capture.h"
+
+#define REPLAY_MAX_CONNS 1024
+#define FRAME_MAX        4096 // MAX_DATA_LEN_CEIL of the host
+#define DRAIN_EVERY      64   // frames between draining replies when --fast
+
+typedef struct {
+  uint32_t id;
+  int fd;
+} Conn;
+
+static Conn conns[REPLAY_MAX_CONNS];
+static struct pollfd pfds[REPLAY_MAX_CONNS];
+static int n_conns = 0;
+static uint64_t bytes_back = 0; // replies read and dropped
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int connect_host(const char *host, const char *port) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+static int find_conn(uint32_t id) {
+  for (int c = 0; c < n_conns; c++) {
+    if (conns[c].id == id) return c;
+  }
+  return -1;
+}
+
+// the connection replaying id, opened on first use (captures may start
+// while connections are already up)
+static int conn_for(uint32_t id, const char *host, const char *port) {
+  int c = find_conn(id);
+  if (c >= 0) return c;
+  if (n_conns == REPLAY_MAX_CONNS) {
+    fprintf(stderr, "more than %d connections at once\n", REPLAY_MAX_CONNS);
+    return -1;
+  }
+  int fd = connect_host(host, port);
+  if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+    perror("connect");
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  conns[n_conns] = (Conn) { id, fd };
+  pfds[n_conns] = (struct pollfd) { .fd = fd, .events = POLLIN };
+  return n_conns++;
+}
+
+// FIN first and read what is pending: closing with unread replies would
+// reset the connection and the host could lose frames not yet read
+static void close_conn(int c) {
+  char sink[4096];
+  ssize_t n;
+  shutdown(conns[c].fd, SHUT_WR);
+  while ((n = recv(conns[c].fd, sink, sizeof(sink), MSG_DONTWAIT)) > 0)
+    bytes_back += (uint64_t) n;
+  close(conns[c].fd);
+  n_conns--;
+  conns[c] = conns[n_conns];
+  pfds[c] = pfds[n_conns];
+}
+
+// reads replies until nothing is left, waiting up to timeout_ms for them
+static void drain(int timeout_ms) {
+  char sink[16 * 1024];
+  if (poll(pfds, (nfds_t) n_conns, timeout_ms) <= 0) return;
+  for (int c = 0; c < n_conns; c++) {
+    if (!(pfds[c].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+    ssize_t n;
+    while ((n = recv(pfds[c].fd, sink, sizeof(sink), MSG_DONTWAIT)) > 0)
+      bytes_back += (uint64_t) n;
+    if (n == 0) pfds[c].events = 0; // host hung up on us, keep the slot
+  }
+}
+
+static int send_all(int c, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(conns[c].fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    if (n < 0) { // full, read replies until it takes more
+      pfds[c].events |= POLLOUT;
+      drain(-1);
+      pfds[c].events = (short) (pfds[c].events & ~POLLOUT);
+      continue;
+    }
+    data += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+// sleeps until the (scaled) capture time of the next record, reading
+// replies meanwhile
+static void wait_until(uint64_t target_ns) {
+  for (uint64_t now = now_ns(); now < target_ns; now = now_ns()) {
+    int ms = (int) ((target_ns - now) / 1000000);
+    if (ms == 0) ms = 1; // poll() cannot sleep less, still fine for chat
+    drain(ms);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <capture> [host] [port] "
+                    "[--fast | --speed N]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *host = "127.0.0.1", *port = "9001";
+  bool fast = false;
+  double speed = 1.0;
+  int positional = 0;
+  for (int a = 2; a < argc; a++) {
+    if (strcmp(argv[a], "--fast") == 0) {
+      fast = true;
+    } else if (strcmp(argv[a], "--speed") == 0 && a + 1 < argc) {
+      speed = atof(argv[++a]);
+      if (speed <= 0) speed = 1.0;
+    } else if (positional++ == 0) {
+      host = argv[a];
+    } else {
+      port = argv[a];
+    }
+  }
+
+  Capture cap;
+  if (capture_open(&cap, argv[1]) < 0) {
+    fprintf(stderr, "%s is not a readable capture\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  char frame[FRAME_MAX];
+  CaptureRecord rec;
+  uint64_t frames = 0, sent = 0, max_late_ns = 0;
+  uint64_t start = now_ns();
+  int rv;
+  while ((rv = capture_next(&cap, &rec, frame, sizeof(frame))) > 0) {
+    if (!fast) {
+      uint64_t target = start + (uint64_t) ((double) rec.ts_ns / speed);
+      wait_until(target);
+      uint64_t late = now_ns() - target;
+      if (late > max_late_ns) max_late_ns = late;
+    } else if (frames % DRAIN_EVERY == 0) {
+      drain(0);
+    }
+    int c;
+    switch (rec.kind) {
+    case CAPTURE_OPEN:
+      conn_for(rec.conn, host, port);
+      break;
+    case CAPTURE_CLOSE:
+      if ((c = find_conn(rec.conn)) >= 0) close_conn(c);
+      break;
+    case CAPTURE_FRAME:
+      if ((c = conn_for(rec.conn, host, port)) < 0) break;
+      if (send_all(c, frame, rec.len) < 0) {
+        perror("send");
+        close_conn(c);
+        break;
+      }
+      frames++;
+      sent += rec.len;
+      break;
+    }
+  }
+  if (rv < 0) fprintf(stderr, "record larger than %d bytes, stopped\n",
+                      FRAME_MAX);
+  double secs = (double) (now_ns() - start) / 1e9;
+  drain(100); // the last replies
+  while (n_conns > 0) close_conn(n_conns - 1);
+  capture_close(&cap);
+
+  printf("replayed %lu frames, %lu bytes in %.3f s\n",
+         (unsigned long) frames, (unsigned long) sent, secs);
+  printf("%.0f frames/s, %.2f MB/s, %lu bytes back from the host\n",
+         (double) frames / secs, (double) sent / secs / 1e6,
+         (unsigned long) bytes_back);
+  if (!fast) printf("fell behind schedule by %.3f ms at most\n",
+                    (double) max_late_ns / 1e6);
+  return rv < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,391 @@
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// BEGIN: scalar
+static size_t find_scalar(const char *buf, size_t len, char delim) {
+  for (size_t i = 0; i < len; i++) {
+    if (buf[i] == delim) return i;
+  }
+  return len;
+}
+
+static size_t count_scalar(const char *buf, size_t len, char delim) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) n += buf[i] == delim;
+  return n;
+}
+
+static size_t find_any_scalar(const char *buf, size_t len,
+                              const uint8_t *set, int n_set)
+{
+  for (size_t i = 0; i < len; i++) {
+    for (int k = 0; k < n_set; k++) {
+      if ((uint8_t) buf[i] == set[k]) return i;
+    }
+  }
+  return len;
+}
+
+// length of the valid character at s, 0 if it is invalid, -1 if s holds a
+// valid but unfinished prefix of one
+static int utf8_seq(const unsigned char *s, size_t n) {
+  unsigned char c = s[0], lo = 0x80, hi = 0xBF;
+  int len;
+  if (c < 0x80) return 1;
+  if (c >= 0xC2 && c <= 0xDF) len = 2;
+  else if (c == 0xE0) len = 3, lo = 0xA0; // overlong below
+  else if (c == 0xED) len = 3, hi = 0x9F; // surrogates above
+  else if (c >= 0xE1 && c <= 0xEF) len = 3;
+  else if (c == 0xF0) len = 4, lo = 0x90; // overlong below
+  else if (c >= 0xF1 && c <= 0xF3) len = 4;
+  else if (c == 0xF4) len = 4, hi = 0x8F; // past U+10FFFF above
+  else return 0;
+  for (int i = 1; i < len; i++) {
+    if ((size_t) i >= n) return -1;
+    unsigned char b = s[i];
+    if (i == 1 ? b < lo || b > hi : (b & 0xC0) != 0x80) return 0;
+  }
+  return len;
+}
+
+static bool utf8_scalar(const char *buf, size_t len) {
+  const unsigned char *s = (const unsigned char *) buf;
+  size_t i = 0;
+  while (i < len) {
+    int n = utf8_seq(s + i, len - i);
+    if (n <= 0) return false;
+    i += (size_t) n;
+  }
+  return true;
+}
+// END: scalar
+
+#ifdef SCAN_X86
+// BEGIN: sse2
+static size_t find_sse2(const char *buf, size_t len, char delim) {
+  const __m128i needle = _mm_set1_epi8(delim);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+    if (mask != 0) return i + (size_t) __builtin_ctz((unsigned) mask);
+  }
+  return i + find_scalar(buf + i, len - i, delim);
+}
+
+static size_t count_sse2(const char *buf, size_t len, char delim) {
+  const __m128i needle = _mm_set1_epi8(delim);
+  size_t i = 0, n = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+    unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+    n += (size_t) __builtin_popcount(mask);
+  }
+  return n + count_scalar(buf + i, len - i, delim);
+}
+
+static size_t find_any_sse2(const char *buf, size_t len,
+                            const uint8_t *set, int n_set)
+{
+  __m128i needles[SCAN_SET_MAX];
+  for (int k = 0; k < n_set; k++) needles[k] = _mm_set1_epi8((char) set[k]);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+    __m128i hit = _mm_setzero_si128();
+    for (int k = 0; k < n_set; k++)
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[k]));
+    int mask = _mm_movemask_epi8(hit);
+    if (mask != 0) return i + (size_t) __builtin_ctz((unsigned) mask);
+  }
+  return i + find_any_scalar(buf + i, len - i, set, n_set);
+}
+
+// ASCII 16 bytes at a time; the first block with a high bit set is handed to
+// the scalar validator, which resumes at a character boundary past it
+static bool utf8_sse2(const char *buf, size_t len) {
+  const unsigned char *s = (const unsigned char *) buf;
+  size_t i = 0;
+  while (i + 16 <= len) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (s + i));
+    if (_mm_movemask_epi8(block) == 0) {
+      i += 16;
+      continue;
+    }
+    for (size_t stop = i + 16; i < stop;) {
+      int n = utf8_seq(s + i, len - i);
+      if (n <= 0) return false;
+      i += (size_t) n;
+    }
+  }
+  return utf8_scalar(buf + i, len - i);
+}
+// END: sse2
+
+// BEGIN: avx2
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t find_avx2(const char *buf, size_t len, char delim) {
+  const __m256i needle = _mm256_set1_epi8(delim);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *) (buf + i));
+    unsigned mask =
+      (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+    if (mask != 0) return i + (size_t) __builtin_ctz(mask);
+  }
+  return i + find_sse2(buf + i, len - i, delim);
+}
+
+AVX2 static size_t count_avx2(const char *buf, size_t len, char delim) {
+  const __m256i needle = _mm256_set1_epi8(delim);
+  size_t i = 0, n = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *) (buf + i));
+    unsigned mask =
+      (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+    n += (size_t) __builtin_popcount(mask);
+  }
+  return n + count_sse2(buf + i, len - i, delim);
+}
+
+AVX2 static size_t find_any_avx2(const char *buf, size_t len,
+                                 const uint8_t *set, int n_set)
+{
+  __m256i needles[SCAN_SET_MAX];
+  for (int k = 0; k < n_set; k++)
+    needles[k] = _mm256_set1_epi8((char) set[k]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *) (buf + i));
+    __m256i hit = _mm256_setzero_si256();
+    for (int k = 0; k < n_set; k++)
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, needles[k]));
+    unsigned mask = (unsigned) _mm256_movemask_epi8(hit);
+    if (mask != 0) return i + (size_t) __builtin_ctz(mask);
+  }
+  return i + find_any_sse2(buf + i, len - i, set, n_set);
+}
+
+// error classes of a (previous byte, byte) pair, see Keiser & Lemire
+#define TOO_SHORT  (1 << 0) // lead byte or ASCII after a lead byte
+#define TOO_LONG   (1 << 1) // continuation after ASCII
+#define OVERLONG_3 (1 << 2) // E0 80..9F
+#define TOO_LARGE  (1 << 3) // F4 90.. and above
+#define SURROGATE  (1 << 4) // ED A0..BF
+#define OVERLONG_2 (1 << 5) // C0, C1
+#define TOO_LARGE_1000 (1 << 6) // F5.. 80..8F
+#define OVERLONG_4 (1 << 6) // F0 80..8F
+#define TWO_CONTS  (1 << 7) // continuation after continuation
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+// by the high nibble of the previous byte, both 128-bit lanes alike
+static const uint8_t byte_1_high[32] = {
+#define ROW TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,                       \
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,                       \
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                   \
+            TOO_SHORT | OVERLONG_2,                                       \
+            TOO_SHORT,                                                    \
+            TOO_SHORT | OVERLONG_3 | SURROGATE,                           \
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+  ROW, ROW
+#undef ROW
+};
+
+// by the low nibble of the previous byte
+static const uint8_t byte_1_low[32] = {
+#define ROW CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,                 \
+            CARRY | OVERLONG_2,                                           \
+            CARRY,                                                        \
+            CARRY,                                                        \
+            CARRY | TOO_LARGE,                                            \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,               \
+            CARRY | TOO_LARGE | TOO_LARGE_1000,                           \
+            CARRY | TOO_LARGE | TOO_LARGE_1000
+  ROW, ROW
+#undef ROW
+};
+
+// by the high nibble of the byte itself
+static const uint8_t byte_2_high[32] = {
+#define ROW TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                   \
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                   \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3                \
+              | TOO_LARGE_1000 | OVERLONG_4,                              \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,   \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,    \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,    \
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+  ROW, ROW
+#undef ROW
+};
+
+// a block ending in these bytes still expects continuations: >= F0 three
+// from the end, >= E0 two from the end, >= C0 last
+static const uint8_t incomplete_max[32] = {
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+AVX2 static inline __m256i nibble_high(__m256i v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+// v shifted by n bytes with the tail of prev shifted in
+#define PREV(v, prev, n) \
+  _mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21), \
+                     16 - (n))
+
+AVX2 static __m256i utf8_block_errors(__m256i in, __m256i prev_in) {
+  __m256i prev1 = PREV(in, prev_in, 1);
+  __m256i table_1h = _mm256_loadu_si256((const __m256i *) byte_1_high);
+  __m256i table_1l = _mm256_loadu_si256((const __m256i *) byte_1_low);
+  __m256i table_2h = _mm256_loadu_si256((const __m256i *) byte_2_high);
+  __m256i special = _mm256_and_si256(
+    _mm256_and_si256(
+      _mm256_shuffle_epi8(table_1h, nibble_high(prev1)),
+      _mm256_shuffle_epi8(table_1l,
+        _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+    _mm256_shuffle_epi8(table_2h, nibble_high(in)));
+  // third and fourth bytes of a sequence must be continuations; those are
+  // the only ones where special cases expect TWO_CONTS
+  __m256i third = _mm256_subs_epu8(PREV(in, prev_in, 2),
+                                   _mm256_set1_epi8(0xE0 - 0x80));
+  __m256i fourth = _mm256_subs_epu8(PREV(in, prev_in, 3),
+                                    _mm256_set1_epi8(0xF0 - 0x80));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                    _mm256_set1_epi8((char) 0x80));
+  return _mm256_xor_si256(must23, special);
+}
+
+AVX2 static bool utf8_avx2(const char *buf, size_t len) {
+  const __m256i max = _mm256_loadu_si256((const __m256i *) incomplete_max);
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_in = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  unsigned char last[32];
+  for (size_t i = 0; i < len; i += 32) {
+    __m256i in;
+    if (i + 32 <= len) {
+      in = _mm256_loadu_si256((const __m256i *) (buf + i));
+    } else { // zero padding is ASCII, which is what an end looks like
+      memset(last, 0, sizeof(last));
+      memcpy(last, buf + i, len - i);
+      in = _mm256_loadu_si256((const __m256i *) last);
+    }
+    if (_mm256_movemask_epi8(in) == 0) { // ASCII: only the carry can fail
+      error = _mm256_or_si256(error, prev_incomplete);
+      prev_incomplete = _mm256_setzero_si256();
+    } else {
+      error = _mm256_or_si256(error, utf8_block_errors(in, prev_in));
+      prev_incomplete = _mm256_subs_epu8(in, max);
+    }
+    prev_in = in;
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+// END: avx2
+#endif // SCAN_X86
+
+static const ScanKernels kernels_scalar = {
+  "scalar", find_scalar, count_scalar, find_any_scalar, utf8_scalar
+};
+#ifdef SCAN_X86
+static const ScanKernels kernels_sse2 = {
+  "sse2", find_sse2, count_sse2, find_any_sse2, utf8_sse2
+};
+static const ScanKernels kernels_avx2 = {
+  "avx2", find_avx2, count_avx2, find_any_avx2, utf8_avx2
+};
+#endif
+
+ScanKernels scan_kernels = {
+  "scalar", find_scalar, count_scalar, find_any_scalar, utf8_scalar
+};
+
+bool scan_supported(const char *isa) {
+  if (strcmp(isa, "scalar") == 0) return true;
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (strcmp(isa, "sse2") == 0) return __builtin_cpu_supports("sse2");
+  if (strcmp(isa, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+  return false;
+}
+
+// "auto" takes the widest supported kernels; false for an unknown or
+// unsupported isa, the current kernels stay then
+bool scan_init(const char *isa) {
+  if (strcmp(isa, "auto") == 0) {
+    if (scan_init("avx2") || scan_init("sse2")) return true;
+    return scan_init("scalar");
+  }
+  if (!scan_supported(isa)) return false;
+#ifdef SCAN_X86
+  if (strcmp(isa, "avx2") == 0) scan_kernels = kernels_avx2;
+  if (strcmp(isa, "sse2") == 0) scan_kernels = kernels_sse2;
+#endif
+  if (strcmp(isa, "scalar") == 0) scan_kernels = kernels_scalar;
+  return true;
+}
+
+// bytes at the end of s that start a character not finished yet
+static size_t utf8_tail(const unsigned char *s, size_t n) {
+  for (size_t back = 1; back <= 3 && back <= n; back++) {
+    unsigned char c = s[n - back];
+    if ((c & 0xC0) == 0x80) continue; // continuation, look further back
+    if (c < 0xC0) return 0;           // ASCII
+    size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+    return need > back ? back : 0;
+  }
+  return 0;
+}
+
+// validates one read of a stream; false means the frame is not UTF-8 (the
+// carried state is dropped then)
+bool utf8_stream(Utf8State *st, const char *buf, size_t len) {
+  const unsigned char *s = (const unsigned char *) buf;
+  if (st->len > 0 && len > 0) { // finish the character the last read split
+    unsigned char seq[4];
+    size_t take = len < 4u - st->len ? len : 4u - st->len;
+    memcpy(seq, st->carry, st->len);
+    memcpy(seq + st->len, s, take);
+    int n = utf8_seq(seq, st->len + take);
+    if (n == 0) {
+      st->len = 0;
+      return false;
+    }
+    if (n < 0) { // still short, all of buf belongs to it
+      memcpy(st->carry + st->len, s, len);
+      st->len = (uint8_t) (st->len + len);
+      return true;
+    }
+    s += (size_t) n - st->len;
+    len -= (size_t) n - st->len;
+    st->len = 0;
+  }
+  size_t tail = utf8_tail(s, len);
+  if (!utf8_valid((const char *) s, len - tail)) return false;
+  if (tail > 0) {
+    if (utf8_seq(s + len - tail, tail) != -1) return false;
+    memcpy(st->carry, s + len - tail, tail);
+    st->len = (uint8_t) tail;
+  }
+  return true;
+}
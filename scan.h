@@ -0,0 +1,69 @@
+/*
+  Byte scanning on the receive path: finding/counting message delimiters
+  and validating UTF-8, the two loops that touch every byte a client sends,
+  plus finding any byte of a small set for the prefilter of filter.h.
+  Each comes as a scalar, an SSE2 and an AVX2 kernel; scan_init() picks the
+  widest one the CPU supports (or the one named by `--simd`):
+
+    scan_init("auto");
+    size_t lines = scan_count(buf, len, '\n');
+    if (!utf8_stream(&client->utf8, buf, len)) ... // reject the frame
+
+  UTF-8 is validated strictly (RFC 3629: no overlongs, surrogates or code
+  points past U+10FFFF). A recv() may end in the middle of a character, the
+  incomplete tail is carried in Utf8State and checked once the rest
+  arrives. The AVX2 validator is the lookup algorithm of Keiser and Lemire
+  ("Validating UTF-8 in less than one instruction per byte"); SSE2 has no
+  byte shuffle, so it skips ASCII 16 bytes at a time and checks the rest
+  with the scalar code. `make bench` compares all of them.
+ */
+
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCAN_SET_MAX 16
+
+typedef struct {
+  const char *name;
+  size_t (*find)(const char *, size_t, char);  // index of delim, or len
+  size_t (*count)(const char *, size_t, char);
+  // index of the first byte that is one of set (up to SCAN_SET_MAX), or len
+  size_t (*find_any)(const char *, size_t, const uint8_t *, int);
+  bool (*utf8_valid)(const char *, size_t);    // complete sequences only
+} ScanKernels;
+
+typedef struct {
+  uint8_t carry[3]; // start of a character split across reads
+  uint8_t len;
+} Utf8State;
+
+extern ScanKernels scan_kernels;
+
+bool scan_init(const char *);
+bool scan_supported(const char *);
+
+static inline size_t scan_find(const char *buf, size_t len, char delim) {
+  return scan_kernels.find(buf, len, delim);
+}
+
+static inline size_t scan_count(const char *buf, size_t len, char delim) {
+  return scan_kernels.count(buf, len, delim);
+}
+
+static inline size_t scan_find_any(const char *buf, size_t len,
+                                   const uint8_t *set, int n_set)
+{
+  return scan_kernels.find_any(buf, len, set, n_set);
+}
+
+static inline bool utf8_valid(const char *buf, size_t len) {
+  return scan_kernels.utf8_valid(buf, len);
+}
+
+bool utf8_stream(Utf8State *, const char *, size_t);
+
+#endif // SCAN_H_
@@ -0,0 +1,33 @@
+/*
+  SHA-256 (FIPS 180-4), small enough to keep in tree instead of pulling in a
+  crypto library just to name blobs by their content:
+
+    Sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, chunk, chunk_len); // as often as needed
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, hex); // 64 lowercase hex digits + '\0'
+ */
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_LEN     32
+#define SHA256_HEX_LEN (2 * SHA256_LEN)
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t total; // bytes hashed so far
+  size_t buf_len;
+  uint8_t buf[64];
+} Sha256;
+
+void sha256_init(Sha256 *);
+void sha256_update(Sha256 *, const void *, size_t);
+void sha256_final(Sha256 *, uint8_t[SHA256_LEN]);
+void sha256_hex(const uint8_t[SHA256_LEN], char[SHA256_HEX_LEN + 1]);
+
+#endif // SHA256_H_
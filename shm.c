@@ -0,0 +1,282 @@
+#define _GNU_SOURCE // memfd_create
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+
+#include "shm.h"
+
+#define SHM_MAP_LEN (2 * sizeof(ShmRing))
+#define SHM_REC_HDR sizeof(uint32_t)
+
+// ring 0 carries host -> client traffic, ring 1 client -> host
+static ShmRing *ring_at(void *map, int idx) {
+  return (ShmRing *) map + idx;
+}
+
+int unix_sockaddr(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+int unix_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_sockaddr(path, &addr) < 0) return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+static int send_fds(int sock, const int *fds, int n) {
+  char byte = 'S';
+  struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+  union {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct msghdr msg = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = ctl.buf,
+    .msg_controllen = CMSG_SPACE((size_t) n * sizeof(int)),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN((size_t) n * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, (size_t) n * sizeof(int));
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static int recv_fds(int sock, int *fds, int n) {
+  char byte;
+  struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+  union {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct msghdr msg = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = ctl.buf,
+    .msg_controllen = CMSG_SPACE((size_t) n * sizeof(int)),
+  };
+  if (recvmsg(sock, &msg, 0) != 1) return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN((size_t) n * sizeof(int)))
+  {
+    errno = EPROTO;
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), (size_t) n * sizeof(int));
+  return 0;
+}
+
+static void *map_rings(int memfd) {
+  void *map = mmap(NULL, SHM_MAP_LEN, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, memfd, 0);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+int shm_accept(int listener_fd, ShmChannel *ch) {
+  int ctl_fd = accept(listener_fd, NULL, NULL);
+  if (ctl_fd < 0) return -1;
+
+  int fds[3] = { -1, -1, -1 }; // memfd, host -> client bell, client -> host
+  fds[0] = memfd_create("clytherin-shm", MFD_CLOEXEC);
+  fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  void *map = NULL;
+  if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+      ftruncate(fds[0], (off_t) SHM_MAP_LEN) < 0 ||
+      (map = map_rings(fds[0])) == NULL ||
+      send_fds(ctl_fd, fds, 3) < 0)
+  {
+    if (map != NULL) munmap(map, SHM_MAP_LEN);
+    for (int f = 0; f < 3; f++) if (fds[f] >= 0) close(fds[f]);
+    close(ctl_fd);
+    return -1;
+  }
+  close(fds[0]); // the mapping keeps the memory alive
+  // both consumers start out asleep, the first record must ring the bell
+  atomic_store(&ring_at(map, 0)->waiting, 1);
+  atomic_store(&ring_at(map, 1)->waiting, 1);
+
+  ch->map     = map;
+  ch->tx      = ring_at(map, 0);
+  ch->rx      = ring_at(map, 1);
+  ch->tx_bell = fds[1];
+  ch->rx_bell = fds[2];
+  ch->ctl_fd  = ctl_fd;
+  return ch->rx_bell;
+}
+
+int shm_connect(const char *path, ShmChannel *ch) {
+  int ctl_fd = unix_connect(path);
+  if (ctl_fd < 0) return -1;
+
+  int fds[3];
+  void *map = NULL;
+  if (recv_fds(ctl_fd, fds, 3) < 0) {
+    close(ctl_fd);
+    return -1;
+  }
+  map = map_rings(fds[0]);
+  close(fds[0]);
+  if (map == NULL) {
+    close(fds[1]);
+    close(fds[2]);
+    close(ctl_fd);
+    return -1;
+  }
+
+  ch->map     = map;
+  ch->rx      = ring_at(map, 0);
+  ch->tx      = ring_at(map, 1);
+  ch->rx_bell = fds[1];
+  ch->tx_bell = fds[2];
+  ch->ctl_fd  = ctl_fd;
+  return ch->rx_bell;
+}
+
+static void ring_bell(int bell) {
+  const uint64_t one = 1;
+  ssize_t n = write(bell, &one, sizeof(one));
+  (void) n; // EAGAIN means the counter is already non zero, good enough
+}
+
+static bool peer_is_gone(int ctl_fd) {
+  char byte;
+  ssize_t n = recv(ctl_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+static void
+ring_copy_in(ShmRing *ring, uint32_t at, const void *src, size_t len)
+{
+  size_t off   = at & (SHM_RING_CAP - 1);
+  size_t first = len < SHM_RING_CAP - off ? len : SHM_RING_CAP - off;
+  memcpy(ring->data + off, src, first);
+  memcpy(ring->data, (const uint8_t *) src + first, len - first);
+}
+
+static void
+ring_copy_out(const ShmRing *ring, uint32_t at, void *dst, size_t len)
+{
+  size_t off   = at & (SHM_RING_CAP - 1);
+  size_t first = len < SHM_RING_CAP - off ? len : SHM_RING_CAP - off;
+  memcpy(dst, ring->data + off, first);
+  memcpy((uint8_t *) dst + first, ring->data, len - first);
+}
+
+static uint32_t record_len(size_t len) {
+  return (uint32_t) ((SHM_REC_HDR + len + 3) & ~(size_t) 3);
+}
+
+int shm_channel_write(ShmChannel *ch, const void *msg, size_t len) {
+  ShmRing *ring = ch->tx;
+  if (atomic_load_explicit(&ring->closed, memory_order_acquire)) return -1;
+
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  uint32_t need = record_len(len);
+  if (need > SHM_RING_CAP - (tail - head)) {
+    if (peer_is_gone(ch->ctl_fd)) {
+      // let our own poll loop find out and reap the channel
+      atomic_store(&ch->rx->closed, 1);
+      ring_bell(ch->rx_bell);
+    }
+    errno = EAGAIN;
+    return -1;
+  }
+
+  uint32_t len32 = (uint32_t) len;
+  ring_copy_in(ring, tail, &len32, SHM_REC_HDR);
+  ring_copy_in(ring, tail + SHM_REC_HDR, msg, len);
+
+  // seq_cst pairs with shm_channel_arm: either the consumer sees the new
+  // tail before sleeping or we see it waiting and ring the doorbell
+  atomic_store(&ring->tail, tail + need);
+  if (atomic_load(&ring->waiting)) {
+    atomic_store(&ring->waiting, 0);
+    ring_bell(ch->tx_bell);
+  }
+  return 0;
+}
+
+ssize_t shm_channel_read(ShmChannel *ch, void *buf, size_t cap) {
+  ShmRing *ring = ch->rx;
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head == tail) {
+    return atomic_load_explicit(&ring->closed, memory_order_acquire) ? -1 : 0;
+  }
+
+  // the peer writes the cursors and headers, a record that does not fit in
+  // what it published is corrupt and the channel is closed
+  uint32_t used = tail - head;
+  uint32_t len32;
+  ring_copy_out(ring, head, &len32, SHM_REC_HDR);
+  if (used > SHM_RING_CAP || len32 > SHM_RING_CAP - SHM_REC_HDR ||
+      record_len(len32) > used)
+  {
+    atomic_store(&ring->closed, 1);
+    errno = EPROTO;
+    return -1;
+  }
+  size_t len = len32 < cap ? len32 : cap; // truncate oversized records
+  ring_copy_out(ring, head + SHM_REC_HDR, buf, len);
+  atomic_store_explicit(&ring->head, head + record_len(len32),
+                        memory_order_release);
+  return (ssize_t) len;
+}
+
+// announce we are about to block on rx_bell, false if data raced in
+bool shm_channel_arm(ShmChannel *ch) {
+  ShmRing *ring = ch->rx;
+  atomic_store(&ring->waiting, 1);
+  if (atomic_load(&ring->tail) != atomic_load(&ring->head) ||
+      atomic_load(&ring->closed))
+  {
+    atomic_store(&ring->waiting, 0);
+    return false;
+  }
+  return true;
+}
+
+// the control socket hung up: what is left in rx can still be read, after
+// that shm_channel_read() returns -1
+void shm_channel_hangup(ShmChannel *ch) {
+  atomic_store(&ch->rx->closed, 1);
+  ring_bell(ch->rx_bell);
+}
+
+void shm_channel_drain_bell(ShmChannel *ch) {
+  uint64_t count;
+  ssize_t n = read(ch->rx_bell, &count, sizeof(count));
+  (void) n;
+}
+
+void shm_channel_close(ShmChannel *ch) {
+  atomic_store(&ch->tx->closed, 1);
+  ring_bell(ch->tx_bell);
+  munmap(ch->map, SHM_MAP_LEN);
+  close(ch->tx_bell);
+  close(ch->rx_bell);
+  close(ch->ctl_fd);
+}
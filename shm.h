@@ -0,0 +1,65 @@
+/*
+  Shared-memory transport for clients running on the same machine as the host.
+
+  A client connects to the host's Unix socket (--shm-path), the host answers
+  with a memfd holding two single-producer/single-consumer byte rings (one per
+  direction) and two eventfd doorbells, passed over SCM_RIGHTS. From then on
+  messages are copied straight into the peer's address space, no socket
+  syscalls involved. A doorbell is only rung when the consumer announced it is
+  about to sleep, so a busy consumer is never woken through the kernel either.
+
+  The rings live in the peer's address space too, so the reader trusts none
+  of it: a record whose length does not fit in what the peer published
+  closes the channel. A peer that dies is noticed through the control
+  socket, the host polls it for POLLHUP (CLIENT_SHM_CTL in host.h).
+ */
+
+#ifndef SHM_H_
+#define SHM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define SHM_RING_CAP  (1u << 16) // bytes per direction, power of two
+#define SHM_CACHELINE 64
+
+typedef struct {
+  _Alignas(SHM_CACHELINE) _Atomic uint32_t head;    // consumer cursor
+  _Alignas(SHM_CACHELINE) _Atomic uint32_t tail;    // producer cursor
+  _Alignas(SHM_CACHELINE) _Atomic uint32_t waiting; // consumer asleep
+  _Atomic uint32_t closed;
+  _Alignas(SHM_CACHELINE) uint8_t data[SHM_RING_CAP];
+} ShmRing;
+
+typedef struct ShmChannel {
+  ShmRing *rx;
+  ShmRing *tx;
+  int rx_bell; // eventfd we poll
+  int tx_bell; // eventfd we ring
+  int ctl_fd;  // negotiation socket, kept to notice dead peers
+  void *map;
+} ShmChannel;
+
+// AF_UNIX plumbing, also used by the host's --unix-path listener and the
+// client tools; -1 with errno set on failure
+struct sockaddr_un;
+int unix_sockaddr(const char *, struct sockaddr_un *);
+int unix_connect(const char *);
+
+// host side, the listener is a plain get_unix_listener_socket()
+int shm_accept(int, ShmChannel *);
+
+// client side
+int shm_connect(const char *, ShmChannel *);
+
+// both sides
+int shm_channel_write(ShmChannel *, const void *, size_t);
+ssize_t shm_channel_read(ShmChannel *, void *, size_t);
+bool shm_channel_arm(ShmChannel *);
+void shm_channel_hangup(ShmChannel *);
+void shm_channel_drain_bell(ShmChannel *);
+void shm_channel_close(ShmChannel *);
+
+#endif // SHM_H_
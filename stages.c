@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "pipeline.h"
+#include "config.h"
+#include "trace.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+// users only, shm clients never were checked; on unless the config says so
+static void stage_utf8(Pipeline *p, MsgBatch *b) {
+  ClientPool *pool = p->pool;
+  if (pool->cfg != NULL && !pool->cfg->validate_utf8) return;
+  for (int m = 0; m < b->n; m++) {
+    Msg *msg = &b->msgs[m];
+    if (msg->kind != CLIENT_USER) continue;
+    if (utf8_stream(&pool->clients[msg->slot].utf8, msg->data, msg->len))
+      continue;
+    LOG_FROM_WARN("dropped a frame from socket %d, not UTF-8\n", msg->fd);
+    pool->utf8_rejected++;
+    pipeline_drop(b, m);
+  }
+}
+PIPELINE_STAGE(STAGE_VALIDATE, "utf8", stage_utf8);
+
+static void stage_filter(Pipeline *p, MsgBatch *b) {
+  Filter *filter = p->pool->filter;
+  if (filter == NULL) return;
+  for (int m = 0; m < b->n; m++) {
+    if (!filter_match(filter, b->msgs[m].data, b->msgs[m].len)) continue;
+    LOG_FROM_WARN("dropped a frame from socket %d, matched the filter\n",
+                  b->msgs[m].fd);
+    pipeline_drop(b, m);
+  }
+}
+PIPELINE_STAGE(STAGE_FILTER, "filter", stage_filter);
+
+// into the outbox and the shm rings, broadcast_all() appends to the
+// history on the way
+static void stage_broadcast(Pipeline *p, MsgBatch *b) {
+  for (int m = 0; m < b->n; m++) {
+    Msg *msg = &b->msgs[m];
+    TRACE(TRACE_PARSE, msg->trace_id, msg->len);
+    trace_resume(msg->trace_id);
+    broadcast_all(p->pool, msg->fd, p->listener, msg->data,
+                  (ssize_t) msg->len);
+  }
+}
+PIPELINE_STAGE(STAGE_ROUTE, "broadcast", stage_broadcast);
+
+static void stage_relay(Pipeline *p, MsgBatch *b) {
+  if (p->relay == NULL || p->relay->n_peers == 0) return;
+  for (int m = 0; m < b->n; m++) {
+    if (b->msgs[m].kind == CLIENT_TRANSFER_NOTICE) continue; // our port
+    relay_publish(p->relay, p->scratch, b->msgs[m].data, b->msgs[m].len);
+  }
+}
+PIPELINE_STAGE(STAGE_ENCODE, "relay", stage_relay);
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE // syscall
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+// single writer (its thread), the dump only reads: head is published with
+// release after the event is filled in
+typedef struct {
+  atomic_bool used;
+  atomic_uint_fast64_t head; // events ever written, ring index is head % LEN
+  int tid;
+  TraceEvent *events;        // allocated by the first thread to claim it
+} TraceRing;
+
+bool trace_on = false;
+
+static TraceRing rings[TRACE_MAX_THREADS];
+static pthread_key_t ring_key; // hands the ring back when a thread exits
+static _Thread_local TraceRing *my_ring;
+static _Thread_local bool no_ring; // all taken, this thread is not traced
+static _Thread_local uint64_t current_id;
+static atomic_uint_fast64_t next_id = 1;
+
+static const char *stage_names[] = {
+  [TRACE_RECV]       = "recv",
+  [TRACE_PARSE]      = "parse",
+  [TRACE_PERSIST]    = "persist",
+  [TRACE_ENQUEUE]    = "enqueue",
+  [TRACE_FIRST_SEND] = "first send",
+  [TRACE_LAST_SEND]  = "last send",
+  [TRACE_DROPPED]    = "dropped",
+  [TRACE_COMMAND]    = "command",
+};
+
+static void release_ring(void *arg) {
+  TraceRing *ring = arg;
+  atomic_store(&ring->used, false);
+}
+
+int trace_init(bool enabled) {
+  if (pthread_key_create(&ring_key, release_ring) != 0) return -1;
+  trace_on = enabled;
+  if (enabled) LOG_FROM_SUCC("message tracing on, SIGUSR2 dumps it\n");
+  return 0;
+}
+
+static TraceRing *claim_ring(void) {
+  for (int r = 0; r < TRACE_MAX_THREADS; r++) {
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&rings[r].used, &expected, true))
+      continue;
+    TraceRing *ring = &rings[r];
+    if (ring->events == NULL) {
+      ring->events = calloc(TRACE_RING_LEN, sizeof(TraceEvent));
+      if (ring->events == NULL) {
+        atomic_store(&ring->used, false);
+        return NULL;
+      }
+    }
+    atomic_store(&ring->head, 0); // a previous thread's events go
+    ring->tid = (int) syscall(SYS_gettid);
+    pthread_setspecific(ring_key, ring);
+    return ring;
+  }
+  return NULL;
+}
+
+// a new message id, also remembered as this thread's current message
+uint64_t trace_begin(void) {
+  if (!trace_on) return 0;
+  current_id = atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed);
+  return current_id;
+}
+
+// the message trace_begin() started on this thread, once; messages that did
+// not come through recv (shm, relay, uploads) get a fresh id instead
+uint64_t trace_take(void) {
+  uint64_t id = current_id;
+  current_id = 0;
+  return id != 0 ? id : trace_begin();
+}
+
+// makes id current again for the trace_take() of a message that was set
+// aside in between, see pipeline.h
+void trace_resume(uint64_t id) {
+  current_id = id;
+}
+
+void trace_event(trace_stage_t stage, uint64_t id, uint32_t arg) {
+  if (my_ring == NULL) {
+    if (no_ring) return;
+    my_ring = claim_ring();
+    if (my_ring == NULL) {
+      no_ring = true;
+      LOG_FROM_WARN("no free trace ring, thread not traced\n");
+      return;
+    }
+  }
+  uint64_t head = atomic_load_explicit(&my_ring->head, memory_order_relaxed);
+  TraceEvent *event = &my_ring->events[head % TRACE_RING_LEN];
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  event->ts_ns = (uint64_t) ts.tv_sec * 1000000000ull
+               + (uint64_t) ts.tv_nsec;
+  event->id = id;
+  event->arg = arg;
+  event->stage = (uint32_t) stage;
+  atomic_store_explicit(&my_ring->head, head + 1, memory_order_release);
+}
+
+// Chrome trace event format: one async slice per message (recv .. last
+// send, dropped or command), the stages in between as async instants. Rings of other threads are
+// read while they keep writing, an event overwritten during the dump may
+// come out torn; fine for a diagnostic. Returns the events written or -1.
+int trace_dump(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    LOG_FROM_ERR("cannot open trace file %s\n", path);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+  int pid = (int) getpid();
+  int written = 0;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (int r = 0; r < TRACE_MAX_THREADS; r++) {
+    TraceRing *ring = &rings[r];
+    if (ring->events == NULL) continue;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t first = head > TRACE_RING_LEN ? head - TRACE_RING_LEN : 0;
+    for (uint64_t e = first; e < head; e++) {
+      TraceEvent event = ring->events[e % TRACE_RING_LEN];
+      if (event.stage > TRACE_COMMAND) continue;
+      bool ends = event.stage >= TRACE_LAST_SEND;
+      const char *ph = event.stage == TRACE_RECV ? "b" : ends ? "e" : "n";
+      const char *name = event.stage == TRACE_RECV || ends
+                       ? "message" : stage_names[event.stage];
+      fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"msg\",\"ph\":\"%s\","
+              "\"id\":\"%#llx\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"stage\":\"%s\",\"arg\":%u}}\n",
+              written > 0 ? "," : "", name, ph,
+              (unsigned long long) event.id,
+              (unsigned long long) (event.ts_ns / 1000),
+              (unsigned long long) (event.ts_ns % 1000),
+              pid, ring->tid, stage_names[event.stage], event.arg);
+      written++;
+    }
+  }
+  fprintf(file, "]}\n");
+  if (fclose(file) != 0) return -1;
+  LOG_FROM_SUCC("wrote %d trace events to %s\n", written, path);
+  return written;
+}
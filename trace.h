@@ -0,0 +1,65 @@
+/*
+  Opt-in lifecycle tracing of chat messages. Each message read from a user
+  gets an id and is stamped at every stage it passes:
+
+    recv -> parse -> persist (history) -> enqueue (outbox)
+         -> first send -> last send (end of the fan-out)
+
+  Events go into a ring per thread (no locks, no syscalls besides
+  clock_gettime), the oldest are overwritten. With tracing off every
+  TRACE() is a single predictable branch on trace_on.
+
+    ./build/run 9001 --trace --trace-path trace.json
+    kill -USR2 <pid> # writes the rings as Chrome trace JSON
+
+  Open the file in chrome://tracing or ui.perfetto.dev: every message is an
+  async slice from recv to last send with the other stages as instants, so
+  queueing delay and fan-out tails show up directly on the timeline. A frame
+  a pipeline stage drops ends in a "dropped" event instead, a /sync or block
+  command in a "command" event, so no slice is left open.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_RING_LEN    16384 // events per thread, a power of two
+#define TRACE_MAX_THREADS 32    // rings, released when their thread exits
+#define TRACE_PATH_DEFAULT "trace.json"
+
+typedef enum {
+  TRACE_RECV,
+  TRACE_PARSE,
+  TRACE_PERSIST,
+  TRACE_ENQUEUE,
+  TRACE_FIRST_SEND,
+  TRACE_LAST_SEND,
+  TRACE_DROPPED, // ends the slice like TRACE_LAST_SEND, arg: bytes
+  TRACE_COMMAND, // same, for a frame that was a command
+} trace_stage_t;
+
+typedef struct {
+  uint64_t ts_ns; // CLOCK_MONOTONIC
+  uint64_t id;    // message
+  uint32_t arg;   // socket or bytes, depends on the stage
+  uint32_t stage;
+} TraceEvent;
+
+extern bool trace_on;
+
+#define TRACE(stage, id, arg)                            \
+do {                                                     \
+  if (__builtin_expect(trace_on, 0))                     \
+    trace_event((stage), (id), (uint32_t) (arg));        \
+} while (0)
+
+int trace_init(bool);
+uint64_t trace_begin(void);
+uint64_t trace_take(void);
+void trace_resume(uint64_t);
+void trace_event(trace_stage_t, uint64_t, uint32_t);
+int trace_dump(const char *);
+
+#endif // TRACE_H_
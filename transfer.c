@@ -0,0 +1,483 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+
+#include "transfer.h"
+#include "lowlat.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+// <spool>/blobs/<sha256> is the longest path we build
+#define TRANSFER_PATH_MAX (CONFIG_MAX_PATH + 8 + SHA256_HEX_LEN)
+
+typedef struct {
+  Transfer *transfer;
+  int fd;
+  int slot; // in transfer->slots, also its lowlat_pin_helper() index
+} TransferConn;
+
+static bool valid_name(const char *name) {
+  return strchr(name, '/') == NULL && name[0] != '.';
+}
+
+static bool valid_hash(const char *hash) {
+  if (strlen(hash) != SHA256_HEX_LEN) return false;
+  for (const char *c = hash; *c != '\0'; c++) {
+    if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f'))) return false;
+  }
+  return true;
+}
+
+// `PUT name size`, `HAVE sha256 name size` or `GET id [offset [length]]`,
+// returns -1 when malformed
+int transfer_parse_request(const char *line, TransferRequest *req) {
+  char op[4], extra; // op holds the first 3 letters, enough to tell apart
+  long long a = 0, b = -1;
+  memset(req, 0, sizeof(*req));
+  req->length = -1;
+  if (sscanf(line, "%3s", op) != 1) return -1;
+
+  if (strcmp(op, "PUT") == 0) {
+    if (sscanf(line, "PUT %64s %lld %c", req->name, &a, &extra) != 2)
+      return -1;
+    if (a < 0 || a > TRANSFER_MAX_SIZE || !valid_name(req->name)) return -1;
+    req->op = TRANSFER_PUT;
+    req->size = (off_t) a;
+    return 0;
+  }
+  if (strcmp(op, "HAV") == 0) {
+    if (sscanf(line, "HAVE %64s %64s %lld %c",
+               req->hash, req->name, &a, &extra) != 3)
+      return -1;
+    if (a < 0 || a > TRANSFER_MAX_SIZE || !valid_name(req->name)) return -1;
+    if (!valid_hash(req->hash)) return -1;
+    req->op = TRANSFER_HAVE;
+    req->size = (off_t) a;
+    return 0;
+  }
+  if (strcmp(op, "GET") == 0) {
+    unsigned long id;
+    int n = sscanf(line, "GET %lu %lld %lld %c", &id, &a, &b, &extra);
+    if (n < 1 || n > 3 || id == 0 || id > UINT32_MAX) return -1;
+    if (a < 0 || (n == 3 && b < 0)) return -1;
+    req->op = TRANSFER_GET;
+    req->id = (uint32_t) id;
+    req->size = (off_t) a;
+    req->length = (off_t) b;
+    return 0;
+  }
+  return -1;
+}
+
+// continues numbering after the highest upload already in the spool, so a
+// restarted host never hands out an id twice
+static uint32_t highest_spooled_id(const char *spool) {
+  DIR *dir = opendir(spool);
+  if (dir == NULL) return 0;
+  uint32_t highest = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    unsigned long id = strtoul(entry->d_name, NULL, 10);
+    if (id > highest && id <= UINT32_MAX) highest = (uint32_t) id;
+  }
+  closedir(dir);
+  return highest;
+}
+
+int transfer_init(Transfer *transfer, const HostConfig *cfg, ClientPool *pool)
+{
+  memset(transfer, 0, sizeof(*transfer));
+  pthread_mutex_init(&transfer->lock, NULL);
+  transfer->listener_fd = -1;
+  transfer->notice_fd = -1;
+  if (cfg->transfer_port == 0) return 0;
+
+  transfer->port = cfg->transfer_port;
+  strcpy(transfer->spool, cfg->spool_dir);
+  if (mkdir(transfer->spool, 0755) < 0 && errno != EEXIST) {
+    LOG_FROM_ERR("cannot create spool directory %s\n", transfer->spool);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+  atomic_init(&transfer->next_id, highest_spooled_id(transfer->spool) + 1);
+  char blobs[TRANSFER_PATH_MAX];
+  snprintf(blobs, sizeof(blobs), "%s/blobs", transfer->spool);
+  if (mkdir(blobs, 0755) < 0 && errno != EEXIST) {
+    LOG_FROM_ERR("cannot create blob directory %s\n", blobs);
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (!mpsc_init(&transfer->notices, TRANSFER_NOTICES)) return -1;
+  transfer->notice_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (transfer->notice_fd < 0) return -1;
+
+  transfer->listener_fd = get_listener_socket(transfer->port);
+  client_add_as(pool, transfer->listener_fd, POLLIN,
+                CLIENT_TRANSFER_LISTENER);
+  client_add_as(pool, transfer->notice_fd, POLLIN, CLIENT_TRANSFER_NOTICE);
+  LOG_FROM_SUCC("file transfers on port %u, spooled in %s\n",
+                transfer->port, transfer->spool);
+  return 0;
+}
+
+// CLOCK_MONOTONIC second by which bytes more must have moved
+static time_t deadline_for(off_t bytes) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + TRANSFER_IO_TIMEOUT + (time_t) (bytes / TRANSFER_MIN_RATE);
+}
+
+static bool past(time_t deadline) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec > deadline;
+}
+
+static void reply(int fd, const char *fmt, long long val) {
+  char line[TRANSFER_LINE_MAX];
+  int len = snprintf(line, sizeof(line), fmt, val);
+  send(fd, line, (size_t) len, MSG_NOSIGNAL);
+}
+
+static void reply_err(int fd, const char *reason) {
+  char line[TRANSFER_LINE_MAX];
+  int len = snprintf(line, sizeof(line), "ERR %s\n", reason);
+  send(fd, line, (size_t) len, MSG_NOSIGNAL);
+}
+
+// Reads exactly up to the newline, the payload behind it stays queued.
+// Bytes before the newline are taken for real as they come, so every peek
+// blocks (up to the socket's SO_RCVTIMEO) until something new arrives
+// instead of finding the same partial line again.
+int transfer_read_line(int fd, char *line, size_t cap) {
+  time_t deadline = deadline_for(0);
+  size_t have = 0;
+  while (have < cap - 1 && !past(deadline)) {
+    ssize_t peeked = recv(fd, line + have, cap - 1 - have, MSG_PEEK);
+    if (peeked <= 0) return -1;
+    char *nl = memchr(line + have, '\n', (size_t) peeked);
+    size_t take = nl != NULL ? (size_t) (nl - (line + have)) + 1
+                             : (size_t) peeked;
+    if (recv(fd, line + have, take, MSG_WAITALL) != (ssize_t) take)
+      return -1;
+    have += take;
+    if (nl != NULL) {
+      line[have - 1] = '\0';
+      return 0;
+    }
+  }
+  return -1; // no newline in sight, or too slow
+}
+
+static void announce(Transfer *transfer, uint32_t id, const char *name,
+                     off_t size)
+{
+  char *text = malloc(TRANSFER_LINE_MAX + TRANSFER_MAX_NAME);
+  if (text == NULL) return;
+  snprintf(text, TRANSFER_LINE_MAX + TRANSFER_MAX_NAME,
+           "* file %u `%s` (%lld bytes), GET %u on port %u\n",
+           id, name, (long long) size, id, transfer->port);
+  if (!mpsc_push(&transfer->notices, text)) {
+    LOG_FROM_WARN("transfer notices full, file %u not announced\n", id);
+    free(text);
+    return;
+  }
+  uint64_t one = 1;
+  if (write(transfer->notice_fd, &one, sizeof(one)) < 0) {
+    LOG_FROM_WARN("failed to ring the transfer notice eventfd\n");
+  }
+}
+
+// makes attachment id a hard link to the blob, the blob's link count is its
+// reference count
+static int link_attachment(Transfer *transfer, const char *blob, uint32_t id)
+{
+  char path[TRANSFER_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%u", transfer->spool, id);
+  if (link(blob, path) < 0) { // one call, see log.h
+    LOG_FROM_ERR("failed to link attachment %u: %s\n", id, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static void blob_path(const Transfer *transfer, const char *hash,
+                      char path[TRANSFER_PATH_MAX])
+{
+  snprintf(path, TRANSFER_PATH_MAX, "%s/blobs/%s", transfer->spool, hash);
+}
+
+// receives the body into <id>.part while hashing it, then files it under its
+// hash unless that blob already exists. A non-NULL expect (HAVE) must match.
+static void handle_upload(Transfer *transfer, int fd,
+                          const TransferRequest *req, const char *expect)
+{
+  uint32_t id = atomic_fetch_add(&transfer->next_id, 1);
+  char part[TRANSFER_PATH_MAX], blob[TRANSFER_PATH_MAX];
+  snprintf(part, sizeof(part), "%s/%u.part", transfer->spool, id);
+
+  int file = open(part, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (file < 0) {
+    reply_err(fd, "spool unavailable");
+    return;
+  }
+  Sha256 sha;
+  sha256_init(&sha);
+  char buf[64 * 1024];
+  off_t left = req->size;
+  time_t deadline = deadline_for(req->size);
+  while (left > 0 && !past(deadline)) {
+    size_t want = left < (off_t) sizeof(buf) ? (size_t) left : sizeof(buf);
+    ssize_t n = recv(fd, buf, want, 0);
+    if (n <= 0 || write(file, buf, (size_t) n) != n) break;
+    sha256_update(&sha, buf, (size_t) n);
+    left -= n;
+    atomic_fetch_add(&transfer->bytes_in, (uint64_t) n);
+  }
+  close(file);
+  if (left > 0) {
+    LOG_FROM_WARN("upload %u cut short, %lld bytes missing\n",
+                  id, (long long) left);
+    unlink(part);
+    reply_err(fd, "short upload");
+    return;
+  }
+
+  uint8_t digest[SHA256_LEN];
+  char hash[SHA256_HEX_LEN + 1];
+  sha256_final(&sha, digest);
+  sha256_hex(digest, hash);
+  if (expect != NULL && strcmp(hash, expect) != 0) {
+    unlink(part);
+    reply_err(fd, "hash mismatch");
+    return;
+  }
+  blob_path(transfer, hash, blob);
+  if (link(part, blob) < 0) {
+    if (errno != EEXIST) {
+      unlink(part);
+      reply_err(fd, "spool unavailable");
+      return;
+    }
+    // same content arrived before (or concurrently), keep the first copy
+    atomic_fetch_add(&transfer->dedup_hits, 1);
+    atomic_fetch_add(&transfer->dedup_bytes, (uint64_t) req->size);
+  }
+  unlink(part);
+  if (link_attachment(transfer, blob, id) < 0) {
+    reply_err(fd, "spool unavailable");
+    return;
+  }
+  reply(fd, "OK %lld\n", id);
+  LOG_FROM_SUCC("spooled file %u `%s`, %lld bytes, sha256 %.12s\n",
+                id, req->name, (long long) req->size, hash);
+  announce(transfer, id, req->name, req->size);
+}
+
+// the client hashed first: link a blob we already have, or ask for the body
+static void handle_have(Transfer *transfer, int fd, const TransferRequest *req)
+{
+  char blob[TRANSFER_PATH_MAX];
+  blob_path(transfer, req->hash, blob);
+  struct stat st;
+  if (stat(blob, &st) < 0) {
+    send(fd, "SEND\n", 5, MSG_NOSIGNAL);
+    handle_upload(transfer, fd, req, req->hash);
+    return;
+  }
+  if (st.st_size != req->size) {
+    reply_err(fd, "size does not match the stored blob");
+    return;
+  }
+  uint32_t id = atomic_fetch_add(&transfer->next_id, 1);
+  if (link_attachment(transfer, blob, id) < 0) {
+    reply_err(fd, "spool unavailable");
+    return;
+  }
+  atomic_fetch_add(&transfer->dedup_hits, 1);
+  atomic_fetch_add(&transfer->dedup_bytes, (uint64_t) st.st_size);
+  reply(fd, "OK %lld\n", id);
+  LOG_FROM_SUCC("linked file %u `%s` to blob %.12s, %lu references\n",
+                id, req->name, req->hash, (unsigned long) st.st_nlink);
+  announce(transfer, id, req->name, req->size);
+}
+
+static void handle_get(Transfer *transfer, int fd, const TransferRequest *req)
+{
+  char path[TRANSFER_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%u", transfer->spool, req->id);
+  int file = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (file < 0 || fstat(file, &st) < 0) {
+    reply_err(fd, "no such file");
+    if (file >= 0) close(file);
+    return;
+  }
+  off_t offset = req->size;
+  if (offset > st.st_size) {
+    reply_err(fd, "offset past end of file");
+    close(file);
+    return;
+  }
+  off_t length = st.st_size - offset;
+  if (req->length >= 0 && req->length < length) length = req->length;
+  reply(fd, "OK %lld\n", (long long) length);
+
+  time_t deadline = deadline_for(length);
+  while (length > 0 && !past(deadline)) { // page cache to socket, no copy
+    ssize_t n = sendfile(fd, file, &offset, (size_t) length);
+    if (n <= 0) break;
+    length -= n;
+    atomic_fetch_add(&transfer->bytes_out, (uint64_t) n);
+  }
+  close(file);
+}
+
+// a free slot for a connection from addr, -1 when all are taken or addr
+// has TRANSFER_MAX_PER_IP of them
+static int claim_slot(Transfer *transfer, const uint8_t addr[16]) {
+  int free_slot = -1, same = 0;
+  pthread_mutex_lock(&transfer->lock);
+  for (int s = 0; s < TRANSFER_MAX_ACTIVE; s++) {
+    if (!transfer->slots[s].used) {
+      if (free_slot < 0) free_slot = s;
+    } else if (memcmp(transfer->slots[s].addr, addr, 16) == 0) {
+      same++;
+    }
+  }
+  if (same >= TRANSFER_MAX_PER_IP) free_slot = -1;
+  if (free_slot >= 0) {
+    transfer->slots[free_slot].used = true;
+    memcpy(transfer->slots[free_slot].addr, addr, 16);
+    atomic_fetch_add(&transfer->active, 1);
+  }
+  pthread_mutex_unlock(&transfer->lock);
+  return free_slot;
+}
+
+static void release_slot(Transfer *transfer, int slot) {
+  pthread_mutex_lock(&transfer->lock);
+  transfer->slots[slot].used = false;
+  atomic_fetch_sub(&transfer->active, 1);
+  pthread_mutex_unlock(&transfer->lock);
+}
+
+// the peer's address as 16 bytes, IPv4 mapped into IPv6
+static void addr_key(const struct sockaddr_storage *addr, uint8_t key[16]) {
+  memset(key, 0, 16);
+  if (addr->ss_family == AF_INET6) {
+    memcpy(key, &((const struct sockaddr_in6 *) addr)->sin6_addr, 16);
+  } else if (addr->ss_family == AF_INET) {
+    key[10] = key[11] = 0xff;
+    memcpy(key + 12, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+  }
+}
+
+static void *transfer_worker(void *arg) {
+  TransferConn *conn = arg;
+  char line[TRANSFER_LINE_MAX];
+  TransferRequest req;
+  lowlat_pin_helper(1 + conn->slot); // 0 is the watchdog
+  if (transfer_read_line(conn->fd, line, sizeof(line)) < 0) {
+    reply_err(conn->fd, "bad request line");
+  } else if (transfer_parse_request(line, &req) < 0) {
+    reply_err(conn->fd, "expected PUT, HAVE or GET");
+  } else {
+    switch (req.op) {
+    case TRANSFER_PUT:
+      handle_upload(conn->transfer, conn->fd, &req, NULL);
+      break;
+    case TRANSFER_HAVE: handle_have(conn->transfer, conn->fd, &req); break;
+    case TRANSFER_GET: handle_get(conn->transfer, conn->fd, &req); break;
+    }
+  }
+  close(conn->fd);
+  release_slot(conn->transfer, conn->slot);
+  free(conn);
+  return NULL;
+}
+
+void transfer_accept(Transfer *transfer) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd = accept4(transfer->listener_fd, (struct sockaddr *) &addr,
+                   &addr_len, SOCK_CLOEXEC);
+  if (fd == -1) {
+    LOG_FROM_ERR("failed to accept transfer connection\n");
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return;
+  }
+  uint8_t key[16];
+  addr_key(&addr, key);
+  int slot = claim_slot(transfer, key);
+  if (slot < 0) {
+    reply_err(fd, "busy");
+    close(fd);
+    return;
+  }
+  // a stalled peer gives its thread back instead of holding it forever
+  struct timeval tv = { .tv_sec = TRANSFER_IO_TIMEOUT };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  TransferConn *conn = malloc(sizeof(TransferConn));
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (conn == NULL) {
+    reply_err(fd, "out of memory");
+    close(fd);
+    release_slot(transfer, slot);
+  } else {
+    conn->transfer = transfer;
+    conn->fd = fd;
+    conn->slot = slot;
+    int rv = pthread_create(&thread, &attr, transfer_worker, conn);
+    if (rv != 0) {
+      LOG_FROM_ERR("failed to start transfer thread\n");
+      LOG_APPEND("errno: %s\n", strerror(rv));
+      reply_err(fd, "busy");
+      close(fd);
+      free(conn);
+      release_slot(transfer, slot);
+    }
+  }
+  pthread_attr_destroy(&attr);
+}
+
+// event loop side: hands finished uploads to the pipeline as messages from
+// slot, the notice eventfd's, to be filtered and announced like chat
+void transfer_on_notice(Transfer *transfer, Pipeline *pipeline, int slot) {
+  uint64_t count;
+  if (read(transfer->notice_fd, &count, sizeof(count)) < 0) return;
+  void *text;
+  while (mpsc_pop(&transfer->notices, &text)) {
+    size_t len = strlen(text);
+    memcpy(pipeline_reserve(pipeline, len), text, len);
+    pipeline_push(pipeline, slot, len);
+    free(text);
+  }
+}
+
+void transfer_destroy(Transfer *transfer) {
+  if (transfer->listener_fd < 0) return;
+  close(transfer->listener_fd);
+  close(transfer->notice_fd);
+  void *text;
+  while (mpsc_pop(&transfer->notices, &text)) free(text);
+  mpsc_destroy(&transfer->notices);
+  pthread_mutex_destroy(&transfer->lock);
+}
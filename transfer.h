@@ -0,0 +1,103 @@
+/*
+  Bulk file transfer next to the chat. Files travel on their own TCP
+  connections to `transfer-port`, one thread per connection, so a large
+  upload never stalls the event loop or goes through the chat data_buffer:
+
+    PUT <name> <size>\n<size bytes>   -> OK <id>\n
+    HAVE <sha256> <name> <size>\n     -> OK <id>\n, the host has the body
+                                      -> SEND\n, then like PUT
+    GET <id> [<offset> [<length>]]\n  -> OK <length>\n<length bytes>
+    anything that goes wrong          -> ERR <reason>\n
+
+  Bodies are stored once, content-addressed, as <spool-dir>/blobs/<sha256>,
+  and every upload id is a hard link <spool-dir>/<id> to its blob: reposting
+  a file the host already has costs neither disk nor upload time, the link
+  count of a blob is its reference count. Clients that hash before sending
+  (HAVE) skip the transfer entirely, plain PUTs are hashed on arrival and
+  dropped in favour of an existing blob. Bodies land in <id>.part first so a
+  GET never sees half a file. Every finished upload is announced in chat:
+
+    * file 7 `notes.pdf` (81234 bytes), GET 7 on port 9401
+
+  Announcements go through the message pipeline like chat lines, so the
+  filter applies to file names too.
+
+  One address holds TRANSFER_MAX_PER_IP of the TRANSFER_MAX_ACTIVE threads
+  at most. Each connection has a deadline besides the per-call timeout: the
+  request line within TRANSFER_IO_TIMEOUT, a body at TRANSFER_MIN_RATE or
+  better on top of that, so trickling a byte at a time does not keep a
+  thread either.
+
+  Downloads are served with sendfile() straight from the page cache, and
+  offset/length pick a range, e.g. to resume an interrupted download:
+
+    ./build/run 9001 --transfer-port 9401 --spool-dir /var/spool/host
+    printf 'GET 7 4096\n' | nc localhost 9401 > rest-of-notes
+ */
+
+#ifndef TRANSFER_H_
+#define TRANSFER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "host.h"
+#include "pipeline.h"
+#include "config.h"
+#include "queue.h"
+#include "sha256.h"
+
+#define TRANSFER_MAX_ACTIVE 16 // concurrent transfer threads
+#define TRANSFER_MAX_PER_IP 4  // ... of them for one client address
+#define TRANSFER_MAX_NAME   64
+#define TRANSFER_MAX_SIZE   (1ll << 32) // per uploaded file
+#define TRANSFER_LINE_MAX   192 // request line, newline included
+#define TRANSFER_IO_TIMEOUT 30  // seconds a stalled peer keeps its thread
+#define TRANSFER_MIN_RATE   (64 * 1024) // bytes/s a body must average
+#define TRANSFER_NOTICES    64  // announcements waiting for the event loop
+
+typedef enum {
+  TRANSFER_PUT,
+  TRANSFER_HAVE,
+  TRANSFER_GET,
+} transfer_op_t;
+
+typedef struct {
+  transfer_op_t op;
+  char name[TRANSFER_MAX_NAME + 1]; // PUT and HAVE
+  char hash[SHA256_HEX_LEN + 1];    // HAVE only
+  uint32_t id;                      // GET only
+  off_t size;   // PUT and HAVE: bytes of the body, GET: offset
+  off_t length; // GET only, -1: up to the end
+} TransferRequest;
+
+typedef struct {
+  int listener_fd;
+  int notice_fd; // eventfd, readable while notices are queued
+  uint16_t port;
+  char spool[CONFIG_MAX_PATH];
+  MpscQueue notices; // char * announcements from the workers
+  _Atomic uint32_t next_id;
+  pthread_mutex_t lock; // slots, taken by accept, given back by the worker
+  struct {
+    bool used;
+    uint8_t addr[16]; // IPv6, or IPv4-mapped
+  } slots[TRANSFER_MAX_ACTIVE];
+  _Atomic int active;
+  _Atomic uint64_t bytes_in;
+  _Atomic uint64_t bytes_out;
+  _Atomic uint64_t dedup_hits;  // uploads linked to a blob already stored
+  _Atomic uint64_t dedup_bytes; // bytes those did not add to the spool
+} Transfer;
+
+int transfer_init(Transfer *, const HostConfig *, ClientPool *);
+void transfer_accept(Transfer *);
+void transfer_on_notice(Transfer *, Pipeline *, int);
+void transfer_destroy(Transfer *);
+
+int transfer_read_line(int, char *, size_t);
+int transfer_parse_request(const char *, TransferRequest *);
+
+#endif // TRANSFER_H_
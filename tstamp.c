@@ -0,0 +1,171 @@
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "tstamp.h"
+
+#define SUB_SHIFT __builtin_ctz(TSTAMP_SUB)
+
+int64_t tstamp_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts); // the clock the kernel stamps with
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t ns_of(const struct timespec *ts) {
+  return (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+// software RX and TX stamps, TX ones keyed by byte offset and without the
+// packet; -1 (errno set) when the kernel does not have them
+int tstamp_enable(int fd) {
+  int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+              SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+              SOF_TIMESTAMPING_OPT_TSONLY;
+  return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+// index: exact below TSTAMP_SUB, then TSTAMP_SUB per power of two
+static int bucket_of(uint64_t ns) {
+  if (ns < TSTAMP_SUB) return (int) ns;
+  int msb = 63 - __builtin_clzll(ns);
+  int sub = (int) (ns >> (msb - SUB_SHIFT)) & (TSTAMP_SUB - 1);
+  return (msb - SUB_SHIFT + 1) * TSTAMP_SUB + sub;
+}
+
+// largest value that falls into bucket b
+static uint64_t bucket_top(int b) {
+  if (b < TSTAMP_SUB) return (uint64_t) b;
+  int msb = b / TSTAMP_SUB + SUB_SHIFT - 1;
+  uint64_t width = 1ull << (msb - SUB_SHIFT);
+  uint64_t low = (uint64_t) (TSTAMP_SUB + b % TSTAMP_SUB) * width;
+  return low + width - 1;
+}
+
+void hist_add(LatencyHist *h, uint64_t ns) {
+  h->counts[bucket_of(ns)]++;
+  h->n++;
+  if (ns > h->max_ns) h->max_ns = ns;
+}
+
+// p in [0, 1]; 0 when empty
+uint64_t hist_percentile(const LatencyHist *h, double p) {
+  if (h->n == 0) return 0;
+  uint64_t rank = (uint64_t) (p * (double) h->n);
+  if (rank >= h->n) rank = h->n - 1;
+  uint64_t seen = 0;
+  for (int b = 0; b < TSTAMP_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen > rank) {
+      uint64_t top = bucket_top(b);
+      return top < h->max_ns ? top : h->max_ns;
+    }
+  }
+  return h->max_ns;
+}
+
+// the software stamp among the control messages, 0 when there is none
+static int64_t stamp_of(struct msghdr *msg) {
+  for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm != NULL;
+       cm = CMSG_NXTHDR(msg, cm))
+  {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_TIMESTAMPING)
+      continue;
+    struct scm_timestamping stamps;
+    memcpy(&stamps, CMSG_DATA(cm), sizeof(stamps));
+    return ns_of(&stamps.ts[0]);
+  }
+  return 0;
+}
+
+// recv() that also puts how long the data waited in the socket into rx
+ssize_t tstamp_recv(int fd, void *buf, size_t len, LatencyHist *rx) {
+  union {
+    char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct cmsghdr align;
+  } ctrl;
+  struct iovec iov = { buf, len };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = ctrl.buf,
+    .msg_controllen = sizeof(ctrl.buf),
+  };
+  ssize_t n = recvmsg(fd, &msg, 0);
+  if (n <= 0) return n;
+  int64_t stamp = stamp_of(&msg);
+  int64_t delay = tstamp_now_ns() - stamp;
+  if (stamp != 0 && delay >= 0) hist_add(rx, (uint64_t) delay);
+  return n;
+}
+
+// a send()-like call that started at sent_ns handed len more bytes to the
+// socket; the stamp may be taken before the call returns
+void tstamp_sent(TstampTx *tx, size_t len, int64_t sent_ns) {
+  if (len == 0) return;
+  tx->bytes += (uint32_t) len;
+  if (tx->n == TSTAMP_PENDING) { // its stamp is overdue, give up on it
+    tx->head = (uint8_t) ((tx->head + 1) % TSTAMP_PENDING);
+    tx->n--;
+  }
+  TstampSend *s = &tx->pending[(tx->head + tx->n) % TSTAMP_PENDING];
+  s->end = tx->bytes - 1;
+  s->sent_ns = sent_ns;
+  tx->n++;
+}
+
+// the send a TX stamp for byte offset key belongs to, and the ones before
+// it (TCP stamps in order, theirs are not coming) are done
+static void match(TstampTx *tx, uint32_t key, int64_t stamp,
+                  LatencyHist *hist)
+{
+  for (int i = 0; i < tx->n; i++) {
+    const TstampSend *s = &tx->pending[(tx->head + i) % TSTAMP_PENDING];
+    if (s->end != key) continue;
+    if (stamp >= s->sent_ns) hist_add(hist, (uint64_t) (stamp - s->sent_ns));
+    tx->head = (uint8_t) ((tx->head + i + 1) % TSTAMP_PENDING);
+    tx->n = (uint8_t) (tx->n - i - 1);
+    return;
+  }
+}
+
+// empties fd's error queue of TX stamps into tx_hist; how many it read,
+// 0 means the POLLERR is a real socket error
+int tstamp_drain(int fd, TstampTx *tx, LatencyHist *tx_hist) {
+  int drained = 0;
+  for (;;) {
+    union {
+      char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+               CMSG_SPACE(sizeof(struct sock_extended_err) +
+                          sizeof(struct sockaddr_in6))];
+      struct cmsghdr align;
+    } ctrl;
+    char data[64];
+    struct iovec iov = { data, sizeof(data) };
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctrl.buf,
+      .msg_controllen = sizeof(ctrl.buf),
+    };
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return drained;
+    drained++;
+    int64_t stamp = stamp_of(&msg);
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+         cm = CMSG_NXTHDR(&msg, cm))
+    {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      struct sock_extended_err err;
+      memcpy(&err, CMSG_DATA(cm), sizeof(err));
+      if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+          err.ee_info == SCM_TSTAMP_SND && stamp != 0)
+        match(tx, err.ee_data, stamp, tx_hist);
+    }
+  }
+}
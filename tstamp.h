@@ -0,0 +1,66 @@
+/*
+  Kernel socket timestamps on TCP clients (SO_TIMESTAMPING, software), to
+  tell time spent in the kernel from time spent in the host:
+
+    ./build/run 9001 --timestamps
+    kill -USR1 <pid> # prints both histograms
+
+  rx: packet stamped by the kernel on arrival -> our recv() returned it,
+      the wait in the socket's receive queue, i.e. mostly the loop being
+      busy elsewhere
+  tx: our send()/writev()/splice() -> packet stamped on its way to the
+      device, the wait in the send buffer behind cwnd, Nagle or a corked
+      socket
+
+  RX stamps come with the data (recvmsg() control messages). TX stamps
+  come later on the socket's error queue, which makes poll() report
+  POLLERR until tstamp_drain() empties it; each carries the offset of the
+  last byte of the call it belongs to (SOF_TIMESTAMPING_OPT_ID), matched
+  against the calls each client keeps in its TstampTx. Calls coalesced
+  into one packet (Nagle, cork) share a stamp, only the last of them is
+  measured. Stamps are CLOCK_REALTIME, so are the times we take to compare
+  them with.
+
+  Histograms have TSTAMP_SUB buckets per power of two nanoseconds,
+  percentiles are read back as the upper bound of their bucket.
+ */
+
+#ifndef TSTAMP_H_
+#define TSTAMP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TSTAMP_PENDING 16 // sends per client waiting for their TX stamp
+#define TSTAMP_SUB     4  // buckets per power of two, a power of two
+#define TSTAMP_BUCKETS (64 * TSTAMP_SUB)
+
+typedef struct {
+  uint64_t n;
+  uint64_t max_ns;
+  uint64_t counts[TSTAMP_BUCKETS];
+} LatencyHist;
+
+typedef struct {
+  uint32_t end; // offset of the call's last byte, what the stamp carries
+  int64_t sent_ns;
+} TstampSend;
+
+// per client: bytes sent since timestamps were enabled, the recent calls
+typedef struct {
+  uint32_t bytes;
+  uint8_t head;
+  uint8_t n;
+  TstampSend pending[TSTAMP_PENDING];
+} TstampTx;
+
+int tstamp_enable(int);
+ssize_t tstamp_recv(int, void *, size_t, LatencyHist *);
+void tstamp_sent(TstampTx *, size_t, int64_t);
+int tstamp_drain(int, TstampTx *, LatencyHist *);
+int64_t tstamp_now_ns(void);
+void hist_add(LatencyHist *, uint64_t);
+uint64_t hist_percentile(const LatencyHist *, double);
+
+#endif // TSTAMP_H_
@@ -54,10 +54,10 @@ void stdscr_border(void) {
   refresh();
 }
 
-char *handle_input(WINDOW *w_input) {
-  char input_buffer[280];
+// edits into the caller's buffer, returns it on ENTER or NULL on cancel
+char *handle_input(WINDOW *w_input, char *input_buffer, size_t cap) {
   size_t i = 0;
-  memset(input_buffer, 0, sizeof(input_buffer)); // zero out
+  memset(input_buffer, 0, cap); // zero out
 
   wmove(w_input, 0, 0);
   wclrtoeol(w_input);
@@ -67,15 +67,10 @@ char *handle_input(WINDOW *w_input) {
     int key = wgetch(w_input);
     switch (key) {
     case KEY_F(1): case KEY_ESC: return NULL;
-    case '\n': {
-      char *input_str = (char *) malloc(i + 1);
-      if (input_str == NULL) return NULL;
-      memcpy(input_str, input_buffer, i + 1);
-      return input_str;
-    }
+    case '\n': return input_buffer;
     case KEY_BACKSPACE:
     case KEY_DEL: if (i > 0) input_buffer[--i] = '\0'; break;
-    default: if (i < sizeof(input_buffer) - 1) input_buffer[i++] = (char) key;
+    default: if (i < cap - 1) input_buffer[i++] = (char) key;
     }
     wmove(w_input, 0, 0);
     wclrtoeol(w_input);
@@ -5,7 +5,8 @@
 void init_ncurses(void);
 void init_colors(void);
 void stdscr_border(void);
-char *handle_input(WINDOW *);
+char *handle_input(WINDOW *, char *, size_t);
+#define INPUT_MAX_LEN 280
 void msg_post_to_feed(WINDOW *, const char *, int);
 
 WINDOW *create_master_win(void);
@@ -5,8 +5,891 @@ do {                                                   \
   client_add(client_pool, 0, POLLIN | POLLOUT);        \
   client_add(client_pool, 0, POLLIN | POLLOUT);        \
   client_add(client_pool, 0, POLLIN | POLLOUT);        \
+  assert(client_remove(client_pool, -1) == -1);        \
+  assert(client_pool->n_clients == 3);                 \
   client_remove(client_pool, 0);                       \
   client_remove(client_pool, -100);                    \
   client_remove(client_pool, 0);                       \
   clients_destroy(client_pool);                        \
 } while(0)
+
+#define UNIT_CONFIG_ARGS()                                              \
+do {                                                                    \
+  HostConfig cfg;                                                       \
+  char *good[] = { "run", "9001", "--rcvbuf", "4096", "--profile",      \
+                   "latency", "--sndbuf", "65536", "--trace",           \
+                   "--relay-port", "9101", "--cork", "off" };           \
+  config_defaults(&cfg);                                                \
+  assert(config_from_args(&cfg, 13, good) == 0);                        \
+  assert(cfg.nodelay && !cfg.cork && cfg.busy_poll == 50);              \
+  assert(cfg.rcvbuf == 16 * 1024); /* the profile came after */         \
+  assert(cfg.sndbuf == 65536);     /* ... and this after the profile */ \
+  assert(cfg.trace);                                                    \
+  char *bad[][3] = {                                                    \
+    { "run", "--no-such-flag", "1" },                                   \
+    { "run", "--rcvbuf", "-5" },                                        \
+    { "run", "--read-frames", "lots" },                                 \
+    { "run", "--trace", "maybe" },                                      \
+    { "run", "--profile", "fastest" },                                  \
+    { "run", "--peer", "--trace" },                                     \
+    { "run", "9001", "stray" },                                         \
+  };                                                                    \
+  for (size_t b = 0; b < sizeof(bad) / sizeof(*bad); b++) {             \
+    config_defaults(&cfg);                                              \
+    assert(config_from_args(&cfg, 3, bad[b]) == -1);                    \
+  }                                                                     \
+  FILE *file = fopen("build/unit.conf", "w");                           \
+  fputs("profile = throughput # full segments\nrcvbuf = 8192\n", file); \
+  fclose(file);                                                         \
+  char *with_file[] = { "run", "--config", "build/unit.conf",           \
+                        "--sndbuf", "4096" };                           \
+  config_defaults(&cfg);                                                \
+  assert(config_from_args(&cfg, 5, with_file) == 0);                    \
+  assert(cfg.cork && cfg.rcvbuf == 8192 && cfg.sndbuf == 4096);         \
+  file = fopen("build/unit.conf", "a");                                 \
+  fputs("cork = sometimes\n", file);                                    \
+  fclose(file);                                                         \
+  config_defaults(&cfg);                                                \
+  assert(config_from_args(&cfg, 5, with_file) == -1);                   \
+  unlink("build/unit.conf");                                            \
+} while(0)
+
+#define UNIT_RELAY_HEADER()                                   \
+do {                                                          \
+  uint8_t frame[RELAY_HEADER_LEN];                            \
+  RelayHeader in = { RELAY_MSG, 42, 0xdeadbeef, 1ull << 60 }; \
+  RelayHeader out;                                            \
+  relay_encode_header(frame, &in);                            \
+  relay_decode_header(frame, &out);                           \
+  assert(out.type == in.type && out.len == in.len);           \
+  assert(out.origin == in.origin && out.seq == in.seq);       \
+} while(0)
+
+#define UNIT_RELAY_FORWARD()                                            \
+do {                                                                    \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);                  \
+  Relay relay;                                                          \
+  Arena scratch;                                                        \
+  int user[2], link[2];                                                 \
+  uint8_t frame[RELAY_HEADER_LEN + 3], got[256];                        \
+  RelayHeader hdr = { RELAY_HELLO, 0, 0, 0 };                           \
+  char *argv[] = { "unit" };                                            \
+  arena_init(&scratch, "unit", 4096);                                   \
+  relay_init(&relay, 1);                                                \
+  relay_setup_from_args(&relay, client_pool, 1, argv);                  \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, user);                            \
+  client_add(client_pool, user[0], POLLIN);                             \
+  relay.listener_fd = get_unix_listener_socket("build/unit.relay");     \
+  for (int p = 0; p < 2; p++) { /* hosts 2 and 3 dial us */             \
+    link[p] = unix_connect("build/unit.relay");                         \
+    relay_accept(&relay, client_pool);                                  \
+    assert(recv(link[p], got, sizeof(got), 0) == RELAY_HEADER_LEN);     \
+    hdr.origin = (uint32_t) (2 + p);                                    \
+    relay_encode_header(frame, &hdr);                                   \
+    send(link[p], frame, RELAY_HEADER_LEN, 0);                          \
+    relay_on_readable(&relay, client_pool, relay.peers[p].fd);          \
+  }                                                                     \
+  assert(relay.n_peers == 2);                                           \
+  hdr = (RelayHeader) { RELAY_MSG, 3, 2, 7 };                           \
+  relay_encode_header(frame, &hdr);                                     \
+  memcpy(frame + RELAY_HEADER_LEN, "hi\n", 3);                          \
+  for (int dup = 0; dup < 2; dup++) { /* from host 2, then again */     \
+    send(link[0], frame, sizeof(frame), 0);                             \
+    relay_on_readable(&relay, client_pool, relay.peers[0].fd);          \
+  }                                                                     \
+  flush_outbox(client_pool);                                            \
+  assert(recv(user[1], got, sizeof(got), 0) == 3);                      \
+  assert(recv(user[1], got, sizeof(got), MSG_DONTWAIT) == -1);          \
+  /* delivered here once, host 3 got it from host 2 itself */           \
+  assert(recv(link[1], got, sizeof(got), MSG_DONTWAIT) == -1);          \
+  assert(relay.frames_in == 2 && relay.frames_suppressed == 1);         \
+  /* fills the table, the last would take slot 128 % 64, host 2's */    \
+  for (uint32_t o = 65; o < 65 + RELAY_MAX_ORIGINS; o++) {              \
+    RelayHeader stale = { RELAY_MSG, 3, o, 1 }; /* no link to them */   \
+    uint8_t other[sizeof(frame)];                                       \
+    memcpy(other, frame, sizeof(frame));                                \
+    relay_encode_header(other, &stale);                                 \
+    send(link[1], other, sizeof(other), 0);                             \
+    relay_on_readable(&relay, client_pool, relay.peers[1].fd);          \
+  }                                                                     \
+  send(link[0], frame, sizeof(frame), 0); /* host 2 is remembered */    \
+  relay_on_readable(&relay, client_pool, relay.peers[0].fd);            \
+  assert(relay.frames_suppressed == 2);                                 \
+  flush_outbox(client_pool);                                            \
+  while (recv(user[1], got, sizeof(got), MSG_DONTWAIT) > 0) {}          \
+  relay_publish(&relay, &scratch, "yo\n", 3); /* to every peer */       \
+  for (int p = 0; p < 2; p++) {                                         \
+    assert(recv(link[p], got, sizeof(got), 0) == sizeof(frame));        \
+    relay_decode_header(got, &hdr);                                     \
+    assert(hdr.origin == 1);                                            \
+    assert(memcmp(got + RELAY_HEADER_LEN, "yo\n", 3) == 0);             \
+  }                                                                     \
+  assert(relay.frames_out == 2);                                        \
+  relay_destroy(&relay);                                                \
+  for (int p = 0; p < 2; p++) close(link[p]);                           \
+  close(user[0]), close(user[1]);                                       \
+  unlink("build/unit.relay");                                           \
+  arena_destroy(&scratch);                                              \
+  clients_destroy(client_pool);                                         \
+} while(0)
+
+#define UNIT_SHM_RING()                                                 \
+do {                                                                    \
+  ShmChannel ch;                                                        \
+  int ctl[2];                                                           \
+  char msg[1000], got[1000];                                            \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, ctl);                             \
+  ch.map = mmap(NULL, 2 * sizeof(ShmRing), PROT_READ | PROT_WRITE,      \
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);                     \
+  ch.rx = ch.tx = ch.map; /* loopback, we read what we write */         \
+  ch.rx_bell = eventfd(0, EFD_NONBLOCK);                                \
+  ch.tx_bell = eventfd(0, EFD_NONBLOCK);                                \
+  ch.ctl_fd = ctl[0];                                                   \
+  for (int r = 0; r < 200; r++) { /* three laps, some records wrap */   \
+    memset(msg, 'a' + r % 26, sizeof(msg));                             \
+    assert(shm_channel_write(&ch, msg, sizeof(msg)) == 0);              \
+    assert(shm_channel_read(&ch, got, sizeof(got)) == sizeof(got));     \
+    assert(memcmp(msg, got, sizeof(msg)) == 0);                         \
+  }                                                                     \
+  int fits = 0;                                                         \
+  while (shm_channel_write(&ch, msg, sizeof(msg)) == 0) fits++;         \
+  assert(errno == EAGAIN && fits == SHM_RING_CAP / 1004); /* padded */  \
+  assert(shm_channel_read(&ch, got, sizeof(got)) == sizeof(got));       \
+  assert(shm_channel_write(&ch, msg, sizeof(msg)) == 0);                \
+  while (fits-- > 0)                                                    \
+    assert(shm_channel_read(&ch, got, sizeof(got)) == sizeof(got));     \
+  assert(shm_channel_read(&ch, got, sizeof(got)) == 0);                 \
+  uint32_t bad[2] = { 100, 0xfffffffc }; /* past the end, wraps to 0 */ \
+  for (int b = 0; b < 2; b++) {                                         \
+    assert(shm_channel_write(&ch, msg, 10) == 0); /* 16 bytes used */   \
+    uint32_t at = atomic_load(&ch.rx->head) & (SHM_RING_CAP - 1);       \
+    memcpy(ch.rx->data + at, &bad[b], sizeof(bad[b]));                  \
+    assert(shm_channel_read(&ch, got, sizeof(got)) == -1);              \
+    assert(errno == EPROTO && shm_channel_write(&ch, msg, 10) == -1);   \
+    atomic_store(&ch.rx->closed, 0);                                    \
+    atomic_store(&ch.rx->head, atomic_load(&ch.rx->tail));              \
+  }                                                                     \
+  assert(shm_channel_write(&ch, msg, 10) == 0);                         \
+  close(ctl[1]); /* the peer dies */                                    \
+  struct pollfd pfd = { ctl[0], 0, 0 };                                 \
+  assert(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLHUP));             \
+  shm_channel_hangup(&ch);                                              \
+  assert(shm_channel_read(&ch, got, sizeof(got)) == 10); /* left */     \
+  assert(shm_channel_read(&ch, got, sizeof(got)) == -1);                \
+  shm_channel_close(&ch);                                               \
+} while(0)
+
+#define UNIT_UNIX_LISTENER()                                            \
+do {                                                                    \
+  char path[200];                                                       \
+  memset(path, 'x', sizeof(path) - 1);                                  \
+  path[sizeof(path) - 1] = '\0';                                        \
+  assert(get_unix_listener_socket(path) == -1); /* too long */          \
+  assert(unix_connect(path) == -1 && errno == ENAMETOOLONG);            \
+  FILE *file = fopen("build/unit.sock", "w"); /* not ours to replace */ \
+  fclose(file);                                                         \
+  assert(get_unix_listener_socket("build/unit.sock") == -1);            \
+  assert(access("build/unit.sock", F_OK) == 0);                         \
+  unlink("build/unit.sock");                                            \
+  for (int run = 0; run < 2; run++) { /* then over a stale one */       \
+    int listener_fd = get_unix_listener_socket("build/unit.sock");      \
+    assert(listener_fd >= 0);                                           \
+    int fd = unix_connect("build/unit.sock");                           \
+    int peer_fd = accept(listener_fd, NULL, NULL);                      \
+    assert(fd >= 0 && peer_fd >= 0);                                    \
+    assert(send(fd, "hi", 2, 0) == 2);                                  \
+    assert(recv(peer_fd, path, 2, 0) == 2);                             \
+    close(fd), close(peer_fd), close(listener_fd);                      \
+  }                                                                     \
+  assert(unix_connect("build/unit.sock") == -1); /* nobody listens */   \
+  unlink("build/unit.sock");                                            \
+} while(0)
+
+#define UNIT_ALLOC_BOUNDS()                                \
+do {                                                       \
+  SlabPool slab;                                           \
+  void *objs[4];                                           \
+  slab_init(&slab, "unit", 24, 4);                         \
+  for (int o = 0; o < 4; o++) objs[o] = slab_alloc(&slab);  \
+  assert(objs[0] && objs[1] && objs[2] && objs[3]);        \
+  assert(slab_alloc(&slab) == NULL && slab.failures == 1); \
+  for (int o = 0; o < 4; o++) slab_free(&slab, objs[o]);   \
+  assert(slab_alloc(&slab) != NULL);                       \
+  slab_destroy(&slab);                                     \
+  Arena arena;                                             \
+  arena_init(&arena, "unit", 64);                          \
+  assert(arena_alloc(&arena, 40) != NULL);                 \
+  assert(arena_alloc(&arena, 40) == NULL);                 \
+  arena_reset(&arena);                                     \
+  assert(arena_alloc(&arena, 40) && arena.overflows == 1); \
+  arena_destroy(&arena);                                   \
+} while(0)
+
+#define UNIT_QUEUE_FIFO()                                     \
+do {                                                          \
+  SpscQueue spsc;                                             \
+  MpscQueue mpsc;                                             \
+  void *out[8];                                               \
+  assert(spsc_init(&spsc, 8) && mpsc_init(&mpsc, 8));         \
+  for (uintptr_t i = 1; i <= 10; i++) {                       \
+    assert(spsc_push(&spsc, (void *) i) == (i <= 8));         \
+    assert(mpsc_push(&mpsc, (void *) i) == (i <= 8));         \
+  }                                                           \
+  assert(spsc_pop_batch(&spsc, out, 8) == 8);                 \
+  assert(out[0] == (void *) 1 && out[7] == (void *) 8);       \
+  assert(mpsc_pop_batch(&mpsc, out, 8) == 8);                 \
+  assert(out[0] == (void *) 1 && out[7] == (void *) 8);       \
+  assert(!spsc_pop(&spsc, out) && !mpsc_pop(&mpsc, out));     \
+  spsc_destroy(&spsc);                                        \
+  mpsc_destroy(&mpsc);                                        \
+} while(0)
+
+#define UNIT_OUTBOX_COALESCE()                                 \
+do {                                                           \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);         \
+  int alice[2], bob[2];                                        \
+  char got[16];                                                \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, alice);                  \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, bob);                    \
+  client_add(client_pool, alice[0], POLLIN);                   \
+  client_add(client_pool, bob[0], POLLIN);                     \
+  broadcast_all(client_pool, alice[0], -1, "hi ", 3);          \
+  broadcast_all(client_pool, bob[0], -1, "yo ", 3);            \
+  broadcast_all(client_pool, alice[0], -1, "bye", 3);          \
+  flush_outbox(client_pool);                                   \
+  assert(client_pool->outbox->writes == 2);                    \
+  assert(recv(bob[1], got, sizeof(got), 0) == 6);              \
+  assert(memcmp(got, "hi bye", 6) == 0);                       \
+  assert(recv(alice[1], got, sizeof(got), 0) == 3);            \
+  assert(memcmp(got, "yo ", 3) == 0);                          \
+  for (int s = 0; s < 2; s++) close(alice[s]), close(bob[s]);  \
+  clients_destroy(client_pool);                                \
+} while(0)
+
+#define UNIT_SPLICE_TEE()                                               \
+do {                                                                    \
+  ClientPool *client_pool = clients_init(4);                            \
+  int sv[4][2]; /* sender, plain, sequenced, slow */                    \
+  static char payload[6000], got[6100], sink[1 << 20];                  \
+  char copy[4096];                                                      \
+  for (size_t i = 0; i < sizeof(payload); i++)                          \
+    payload[i] = (char) ('a' + i % 26);                                 \
+  for (int u = 0; u < 4; u++) {                                         \
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv[u]);                         \
+    client_add(client_pool, sv[u][0], POLLIN); /* slot u */             \
+  }                                                                     \
+  client_pool->clients[2].sequenced = true;                             \
+  fcntl(sv[3][0], F_SETFL, O_NONBLOCK);                                 \
+  struct iovec iov = { sink, 4096 };                                    \
+  size_t filled = 0;                                                    \
+  ssize_t n;                                                            \
+  for (; client_pool->clients[3].outq.len == 0; filled += 4096)         \
+    assert(client_send(client_pool, 3, &iov, 1) == 0); /* backlog */    \
+  send(sv[0][1], payload, sizeof(payload), 0);                          \
+  assert(splice_pending(client_pool, 0, 1024) == sizeof(payload));      \
+  assert(splice_pending(client_pool, 0, 0) == 0); /* disabled */        \
+  assert(splice_broadcast(client_pool, 0, sizeof(payload), NULL, 0)     \
+         == sizeof(payload)); /* no copy */                             \
+  assert(recv(sv[1][1], got, sizeof(payload), MSG_WAITALL)              \
+         == sizeof(payload));                                           \
+  assert(memcmp(got, payload, sizeof(payload)) == 0);                   \
+  assert(recv(sv[2][1], got, 8 + sizeof(payload), MSG_WAITALL)          \
+         == 8 + sizeof(payload));                                       \
+  assert(memcmp(got, "#0 6000\n", 8) == 0); /* framed, seq 0 */         \
+  assert(memcmp(got + 8, payload, sizeof(payload)) == 0);               \
+  assert(client_pool->clients[3].outq.len >= sizeof(payload));          \
+  assert(client_pool->pfds[3].events & POLLOUT);                        \
+  size_t drained = 0;                                                   \
+  while (drained < filled + sizeof(payload)) {                          \
+    n = recv(sv[3][1], sink + drained, sizeof(sink) - drained, 0);      \
+    assert(n > 0);                                                      \
+    drained += (size_t) n;                                              \
+    client_on_writable(client_pool, 3);                                 \
+  }                                                                     \
+  assert(memcmp(sink + filled, payload, sizeof(payload)) == 0);         \
+  send(sv[0][1], payload, 3000, 0);                                     \
+  assert(splice_broadcast(client_pool, 0, 3000, copy, sizeof(copy))     \
+         == 3000); /* copied for shm and relay */                       \
+  assert(memcmp(copy, payload, 3000) == 0);                             \
+  assert(recv(sv[1][1], got, 3000, MSG_WAITALL) == 3000);               \
+  assert(memcmp(got, payload, 3000) == 0);                              \
+  assert(recv(sv[3][1], got, 3000, MSG_WAITALL) == 3000);               \
+  assert(client_pool->spliced == sizeof(payload) + 3000);               \
+  for (int u = 0; u < 4; u++) close(sv[u][0]), close(sv[u][1]);         \
+  clients_destroy(client_pool);                                         \
+} while(0)
+
+#define UNIT_TRANSFER_PARSE()                                      \
+do {                                                               \
+  TransferRequest req;                                             \
+  assert(transfer_parse_request("PUT a.txt 12", &req) == 0);       \
+  assert(req.op == TRANSFER_PUT && req.size == 12);                \
+  assert(strcmp(req.name, "a.txt") == 0);                          \
+  assert(transfer_parse_request("GET 7", &req) == 0);              \
+  assert(req.id == 7 && req.size == 0 && req.length == -1);        \
+  assert(transfer_parse_request("GET 7 10 20", &req) == 0);        \
+  assert(req.size == 10 && req.length == 20);                      \
+  assert(transfer_parse_request("PUT ../etc 1", &req) < 0);        \
+  assert(transfer_parse_request("PUT a/b 1", &req) < 0);           \
+  assert(transfer_parse_request("PUT a -1", &req) < 0);            \
+  assert(transfer_parse_request("GET 0", &req) < 0);               \
+  assert(transfer_parse_request("GET 1 2 3 4", &req) < 0);         \
+  assert(transfer_parse_request("DEL 1", &req) < 0);               \
+  assert(transfer_parse_request("HAVE 00 a 1", &req) < 0);         \
+  assert(transfer_parse_request("HAVE 9f86d081884c7d659a2feaa0c55" \
+                                "ad015a3bf4f1b2b0b822cd15d6c15b0" \
+                                "f00a08 a.txt 4", &req) == 0);    \
+  assert(req.op == TRANSFER_HAVE && req.size == 4);                \
+} while(0)
+
+#define UNIT_TRANSFER_LINE()                                            \
+do {                                                                    \
+  int sv[2];                                                            \
+  char line[TRANSFER_LINE_MAX], rest[8];                                \
+  struct timeval tv = { .tv_usec = 300000 }; /* instead of 30 s */      \
+  struct rusage before, after;                                          \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);                              \
+  setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));          \
+  send(sv[1], "GET ", 4, 0);                                            \
+  send(sv[1], "7\nBODY", 6, 0);                                         \
+  assert(transfer_read_line(sv[0], line, sizeof(line)) == 0);           \
+  assert(strcmp(line, "GET 7") == 0);                                   \
+  assert(recv(sv[0], rest, sizeof(rest), 0) == 4); /* still queued */   \
+  send(sv[1], "PUT abc", 7, 0); /* never finished */                    \
+  getrusage(RUSAGE_SELF, &before);                                      \
+  assert(transfer_read_line(sv[0], line, sizeof(line)) == -1);          \
+  getrusage(RUSAGE_SELF, &after);                                       \
+  long cpu_us = (after.ru_utime.tv_sec - before.ru_utime.tv_sec         \
+                 + after.ru_stime.tv_sec - before.ru_stime.tv_sec)      \
+                * 1000000L                                              \
+              + after.ru_utime.tv_usec - before.ru_utime.tv_usec        \
+              + after.ru_stime.tv_usec - before.ru_stime.tv_usec;       \
+  assert(cpu_us < 100000); /* waited out the timeout, no spinning */    \
+  close(sv[0]), close(sv[1]);                                           \
+} while(0)
+
+#define UNIT_SHA256_VECTORS()                                            \
+do {                                                                     \
+  Sha256 sha;                                                            \
+  uint8_t digest[SHA256_LEN];                                            \
+  char hex[SHA256_HEX_LEN + 1];                                          \
+  sha256_init(&sha);                                                     \
+  sha256_update(&sha, "abc", 3);                                         \
+  sha256_final(&sha, digest);                                            \
+  sha256_hex(digest, hex);                                               \
+  assert(strcmp(hex, "ba7816bf8f01cfea414140de5dae2223"                  \
+                     "b00361a396177a9cb410ff61f20015ad") == 0);          \
+  sha256_init(&sha); /* 56 bytes, fed unevenly, padding needs 2 blocks */ \
+  const char *msg = "abcdbcdecdefdefgefghfghighijhijkijkljklm"           \
+                    "klmnlmnomnopnopq";                                  \
+  sha256_update(&sha, msg, 5);                                           \
+  sha256_update(&sha, msg + 5, 51);                                      \
+  sha256_final(&sha, digest);                                            \
+  sha256_hex(digest, hex);                                               \
+  assert(strcmp(hex, "248d6a61d20638b8e5c026930c3e6039"                  \
+                     "a33ce45964ff2167f6ecedd419db06c1") == 0);          \
+} while(0)
+
+#define UNIT_HISTORY_RING()                                          \
+do {                                                                 \
+  History *history = malloc(sizeof(History));                        \
+  char msg[MAX_DATA_LEN_CEIL] = {0};                                 \
+  uint64_t after, first;                                             \
+  history_init(history);                                             \
+  first = history_append(history, "a", 1, NULL);                     \
+  assert(history_append(history, "b", 1, NULL) == first + 1);        \
+  for (int m = 0; m < HISTORY_MAX_MSGS; m++)                         \
+    history_append(history, msg, 1, NULL);                           \
+  assert(history->n == HISTORY_MAX_MSGS);                            \
+  assert(history->entries[history->head].seq == first + 2);          \
+  for (int m = 0; m < 100; m++) /* wraps the data ring */            \
+    history_append(history, msg, sizeof(msg), NULL);                 \
+  assert(history->data_used <= HISTORY_DATA_LEN);                    \
+  assert(history->n == HISTORY_DATA_LEN / sizeof(msg));              \
+  assert(history_parse_sync("/sync 42\n", 9, &after) && after == 42); \
+  assert(!history_parse_sync("/sync x\n", 8, &after));               \
+  assert(!history_parse_sync("hello\n", 6, &after));                 \
+  free(history);                                                     \
+} while(0)
+
+#define UNIT_TOKEN_BUCKET()                                   \
+do {                                                          \
+  TokenBucket bucket;                                         \
+  bucket_init(&bucket, 10, 0); /* 10/s, starts with 10 */     \
+  assert(bucket_available(&bucket, 0) == 10);                 \
+  bucket_take(&bucket, 15);    /* oversized: 5 in debt */     \
+  assert(bucket_wait_us(&bucket, 1) == 600001);               \
+  assert(bucket_available(&bucket, 500000) == 0);             \
+  assert(bucket_available(&bucket, 60000000) == 10);          \
+  bucket_init(&bucket, 0, 0);  /* unlimited */                \
+  bucket_take(&bucket, 1e9);                                  \
+  assert(bucket_wait_us(&bucket, 1e9) == 0);                  \
+} while(0)
+
+#define UNIT_BACKPRESSURE()                                          \
+do {                                                                 \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);               \
+  HostConfig cfg;                                                    \
+  config_defaults(&cfg);                                             \
+  cfg.queue_high = 64 * 1024;                                        \
+  cfg.queue_low = 16 * 1024;                                         \
+  client_pool->cfg = &cfg;                                           \
+  int slow[2], busy[2];                                              \
+  static char chunk[4096];                                           \
+  struct iovec iov = { chunk, sizeof(chunk) };                       \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, slow);                         \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, busy);                         \
+  fcntl(slow[0], F_SETFL, O_NONBLOCK);                               \
+  client_add(client_pool, slow[0], POLLIN); /* slot 0 */             \
+  client_add(client_pool, busy[0], POLLIN); /* slot 1 */             \
+  while (client_pool->out_queued <= cfg.queue_high)                  \
+    assert(client_send(client_pool, 0, &iov, 1) == 0);               \
+  assert(client_pool->pfds[0].events & POLLOUT);                     \
+  client_pool->clients[1].recent_in = 4096; /* the busy producer */  \
+  backpressure_update(client_pool, 0);                               \
+  assert(client_pool->clients[1].held);                              \
+  assert(!client_pool->clients[0].held);                             \
+  assert(!(client_pool->pfds[1].events & POLLIN));                   \
+  while (client_pool->out_queued > 0) { /* the reader catches up */  \
+    while (recv(slow[1], chunk, sizeof(chunk), MSG_DONTWAIT) > 0) {} \
+    client_on_writable(client_pool, 0);                              \
+  }                                                                  \
+  assert(client_pool->pfds[0].events == POLLIN);                     \
+  backpressure_update(client_pool, 0);                               \
+  assert(client_pool->n_held == 0);                                  \
+  assert(client_pool->pfds[1].events == POLLIN);                     \
+  assert(client_pool->clients[0].outq.data == NULL); /* freed */     \
+  uint64_t allocs = client_pool->outq_slab.allocs;                   \
+  for (int round = 0; round < 2; round++) { /* falls behind a bit */ \
+    while (client_pool->out_queued == 0)                             \
+      assert(client_send(client_pool, 0, &iov, 1) == 0);             \
+    OutQueue *q = &client_pool->clients[0].outq;                     \
+    assert(slab_owns(&client_pool->outq_slab, q->data));             \
+    while (client_pool->out_queued > 0) {                            \
+      while (recv(slow[1], chunk, 4096, MSG_DONTWAIT) > 0) {}        \
+      client_on_writable(client_pool, 0);                            \
+    }                                                                \
+    assert(q->data != NULL); /* the block stays with the slot */     \
+  }                                                                  \
+  assert(client_pool->outq_slab.allocs == allocs + 1);               \
+  for (int s = 0; s < 2; s++) close(slow[s]), close(busy[s]);        \
+  clients_destroy(client_pool);                                      \
+} while(0)
+
+#define UNIT_READ_FAIRNESS()                                            \
+do {                                                                    \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);                  \
+  for (int pass = 0; pass < 2 * MAX_CLIENTS; pass++) /* rotates */      \
+    assert(clients_rr_first(client_pool) == pass % MAX_CLIENTS);        \
+  int heavy[2], light[2];                                               \
+  static char flood[4096];                                              \
+  char buf[256];                                                        \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, heavy);                           \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, light);                           \
+  fcntl(light[0], F_SETFL, O_NONBLOCK);                                 \
+  send(heavy[1], flood, sizeof(flood), 0);                              \
+  send(light[1], "hi\n", 3, 0);                                         \
+  struct { int fd, frames; size_t bytes, got; bool spent; } pass[] = {  \
+    { heavy[0], 8, 1000, 1000, true },  /* cut off at read-budget */    \
+    { heavy[0], 2, 1000, 512, true },   /* ... at read-frames */        \
+    { light[0], 8, 1000, 3, false },    /* drained, budget left */      \
+  };                                                                    \
+  for (size_t p = 0; p < sizeof(pass) / sizeof(*pass); p++) {           \
+    ReadBudget budget;                                                  \
+    size_t want, got = 0;                                               \
+    ssize_t n;                                                          \
+    read_budget_init(&budget, pass[p].frames, pass[p].bytes);           \
+    while ((want = read_budget_want(&budget, sizeof(buf))) > 0 &&       \
+           (n = recv(pass[p].fd, buf, want, 0)) > 0)                    \
+    {                                                                   \
+      got += (size_t) n;                                                \
+      read_budget_charge(&budget, (size_t) n);                          \
+    }                                                                   \
+    assert(got == pass[p].got);                                         \
+    assert(read_budget_spent(&budget) == pass[p].spent);                \
+  }                                                                     \
+  for (int s = 0; s < 2; s++) close(heavy[s]), close(light[s]);         \
+  clients_destroy(client_pool);                                         \
+} while(0)
+
+#define UNIT_CAPTURE_ROUNDTRIP()                                        \
+do {                                                                    \
+  Capture cap;                                                          \
+  CaptureRecord rec;                                                    \
+  char got[16];                                                         \
+  assert(capture_create(&cap, "build/unit.cap") == 0);                  \
+  assert(capture_write(&cap, 7, CAPTURE_OPEN, NULL, 0) == 0);           \
+  assert(capture_write(&cap, 7, CAPTURE_FRAME, "hello", 5) == 0);       \
+  assert(capture_write(&cap, 7, CAPTURE_CLOSE, NULL, 0) == 0);          \
+  capture_close(&cap);                                                  \
+  assert(capture_open(&cap, "build/unit.cap") == 0);                    \
+  assert(capture_next(&cap, &rec, got, sizeof(got)) == 1);              \
+  assert(rec.conn == 7 && rec.kind == CAPTURE_OPEN && rec.len == 0);    \
+  uint64_t opened = rec.ts_ns;                                          \
+  assert(capture_next(&cap, &rec, got, sizeof(got)) == 1);              \
+  assert(rec.kind == CAPTURE_FRAME && rec.len == 5);                    \
+  assert(memcmp(got, "hello", 5) == 0 && rec.ts_ns >= opened);          \
+  assert(capture_next(&cap, &rec, got, 4) == 1);                        \
+  assert(rec.kind == CAPTURE_CLOSE);                                    \
+  assert(capture_next(&cap, &rec, got, sizeof(got)) == 0);              \
+  capture_close(&cap);                                                  \
+  unlink("build/unit.cap");                                             \
+} while(0)
+
+#define UNIT_SCAN_KERNELS()                                             \
+do {                                                                    \
+  static const struct { const char *s; bool ok; } vec[] = {             \
+    { "plain ascii", true },     { "caf\xc3\xa9", true },               \
+    { "\xe2\x82\xac", true },    { "\xf0\x9f\x98\x80", true },          \
+    { "\xf4\x8f\xbf\xbf", true }, { "\xc0\xaf", false },                \
+    { "\xe0\x80\xaf", false },   { "\xed\xa0\x80", false },             \
+    { "\xf4\x90\x80\x80", false }, { "\xf5\x80\x80\x80", false },       \
+    { "\x80", false },           { "\xc3", false },                     \
+    { "\xe2\x82", false },       { "\xc3\xa9\xa9", false },             \
+  };                                                                    \
+  const char *isas[] = { "scalar", "sse2", "avx2" };                    \
+  char buf[96];                                                         \
+  for (size_t k = 0; k < sizeof(isas) / sizeof(*isas); k++) {           \
+    if (!scan_init(isas[k])) continue;                                  \
+    for (size_t v = 0; v < sizeof(vec) / sizeof(*vec); v++) {           \
+      size_t len = strlen(vec[v].s);                                    \
+      assert(utf8_valid(vec[v].s, len) == vec[v].ok);                   \
+      for (size_t at = 0; at + len <= sizeof(buf); at += 7) {           \
+        /* every offset class, across 16 and 32 byte blocks */          \
+        memset(buf, 'a', sizeof(buf));                                  \
+        memcpy(buf + at, vec[v].s, len);                                \
+        assert(utf8_valid(buf, sizeof(buf)) == vec[v].ok);              \
+      }                                                                 \
+    }                                                                   \
+    memset(buf, 'a', sizeof(buf));                                      \
+    buf[40] = buf[70] = buf[95] = '\n';                                 \
+    assert(scan_find(buf, sizeof(buf), '\n') == 40);                    \
+    assert(scan_find(buf, 40, '\n') == 40);                             \
+    assert(scan_count(buf, sizeof(buf), '\n') == 3);                    \
+    assert(scan_find_any(buf, sizeof(buf), (const uint8_t *) "x\n", 2)  \
+           == 40);                                                      \
+    assert(scan_find_any(buf, 40, (const uint8_t *) "xyz", 3) == 40);   \
+  }                                                                     \
+  scan_init("auto");                                                    \
+  Utf8State st = { {0}, 0 };                                            \
+  assert(utf8_stream(&st, "ab\xf0\x9f", 4) && st.len == 2);             \
+  assert(utf8_stream(&st, "\x98", 1) && st.len == 3);                   \
+  assert(utf8_stream(&st, "\x80z", 2) && st.len == 0);                  \
+  assert(utf8_stream(&st, "\xe2", 1) && st.len == 1);                   \
+  assert(!utf8_stream(&st, "a", 1) && st.len == 0);                     \
+  assert(!utf8_stream(&st, "\xe0\x80", 2));                             \
+} while(0)
+
+#define UNIT_FILTER_MATCH()                                             \
+do {                                                                    \
+  FILE *file = fopen("build/unit.filter", "w");                         \
+  fputs("# comment\n\nhe\nShe\nhers\nbit.ly/\n", file);                \
+  fclose(file);                                                         \
+  Filter *f = filter_load("build/unit.filter");                         \
+  assert(f != NULL && f->n_patterns == 4 && f->n_first > 0);            \
+  assert(filter_match(f, "ushers", 6));                                 \
+  assert(filter_match(f, "SHE", 3));                                    \
+  assert(!filter_match(f, "# comment", 9));                             \
+  assert(!filter_match(f, "bit.ly", 6));                                \
+  char buf[100];                                                        \
+  memset(buf, 'x', sizeof(buf));                                        \
+  assert(!filter_match(f, buf, sizeof(buf)));                           \
+  memcpy(buf + 61, "BIT.LY/", 7); /* past a few vector blocks */        \
+  assert(filter_match(f, buf, sizeof(buf)));                            \
+  assert(f->hits == 3);                                                 \
+  filter_free(f);                                                       \
+  file = fopen("build/unit.filter", "w"); /* no prefilter */            \
+  for (char c = 'a'; c <= 'z'; c++) fprintf(file, "%czz\n", c);         \
+  fclose(file);                                                         \
+  f = filter_load("build/unit.filter");                                 \
+  assert(f != NULL && f->n_first == 0);                                 \
+  assert(filter_match(f, "buzz", 4) && !filter_match(f, "zaz", 3));     \
+  filter_free(f);                                                       \
+  assert(filter_load("build/missing.filter") == NULL);                  \
+  unlink("build/unit.filter");                                          \
+} while(0)
+
+#define UNIT_BLOCK_MASKS()                                              \
+do {                                                                    \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);                  \
+  int sv[3][2];                                                         \
+  char got[32], name[NICK_MAX + 1];                                     \
+  assert(block_parse("/nick alice\n", 12, name) == BLOCK_NICK);         \
+  assert(strcmp(name, "alice") == 0);                                   \
+  assert(block_parse("/mute bob\r\n", 11, name) == BLOCK_MUTE);         \
+  assert(block_parse("/nick \n", 7, name) == BLOCK_NONE);               \
+  assert(block_parse("/nick a b\n", 10, name) == BLOCK_NONE);           \
+  assert(block_parse("hi /mute bob\n", 13, name) == BLOCK_NONE);        \
+  for (int u = 0; u < 3; u++) {                                         \
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv[u]);                         \
+    client_add(client_pool, sv[u][0], POLLIN); /* slot u */             \
+  }                                                                     \
+  assert(block_apply(client_pool, 0, BLOCK_NICK, "alice") == 0);        \
+  assert(block_apply(client_pool, 1, BLOCK_NICK, "bob") == 0);          \
+  assert(block_apply(client_pool, 2, BLOCK_NICK, "carol") == 0);        \
+  assert(block_apply(client_pool, 1, BLOCK_NICK, "alice") == -1);       \
+  block_apply(client_pool, 0, BLOCK_MUTE, "bob");                       \
+  block_apply(client_pool, 0, BLOCK_BLOCK, "carol");                    \
+  broadcast_all(client_pool, sv[1][0], -1, "bob ", 4);                  \
+  broadcast_all(client_pool, sv[0][0], -1, "alice ", 6);                \
+  broadcast_all(client_pool, sv[2][0], -1, "carol ", 6);                \
+  flush_outbox(client_pool);                                            \
+  assert(recv(sv[0][1], got, sizeof(got), MSG_DONTWAIT) == -1);         \
+  assert(recv(sv[1][1], got, sizeof(got), 0) == 12);                    \
+  assert(memcmp(got, "alice carol ", 12) == 0);                         \
+  assert(recv(sv[2][1], got, sizeof(got), 0) == 4);                     \
+  block_apply(client_pool, 0, BLOCK_LIFT, "bob");                       \
+  broadcast_all(client_pool, sv[1][0], -1, "bob ", 4);                  \
+  flush_outbox(client_pool);                                            \
+  assert(recv(sv[0][1], got, sizeof(got), 0) == 4);                     \
+  History *history = malloc(sizeof(History));                           \
+  history_init(history);                                                \
+  client_pool->history = history;                                       \
+  block_apply(client_pool, 0, BLOCK_MUTE, "bob");                       \
+  broadcast_all(client_pool, sv[1][0], -1, "bob ", 4);                  \
+  broadcast_all(client_pool, sv[2][0], -1, "carol ", 6);                \
+  flush_outbox(client_pool);                                            \
+  for (int u = 1; u < 3; u++) recv(sv[u][1], got, sizeof(got), 0);      \
+  assert(history_replay(history, 0, client_pool, 0) == 0);              \
+  assert(history_replay(history, 0, client_pool, 1) == 2);              \
+  block_apply(client_pool, 0, BLOCK_LIFT, "carol"); /* lists now */     \
+  assert(history_replay(history, 0, client_pool, 0) == 1);              \
+  assert(recv(sv[0][1], got, sizeof(got), 0) > 6); /* carol's */        \
+  client_remove(client_pool, sv[0][0]); /* alice's list goes with her */ \
+  assert(bitset_count(client_pool->blocked_by,                          \
+                      MAX_CLIENTS * client_pool->mask_words) == 0);     \
+  for (int u = 0; u < 3; u++) close(sv[u][0]), close(sv[u][1]);         \
+  free(history);                                                        \
+  clients_destroy(client_pool);                                         \
+} while(0)
+
+typedef struct { int fd; size_t len; char buf[16]; } UnitEcho;
+
+static int unit_echo(Coro *co) {
+  UnitEcho *e = co->arg;
+  CORO_BEGIN(co);
+  for (;;) {
+    CORO_RECV(co, e->fd, e->buf, sizeof(e->buf));
+    if (co->result <= 0) break;
+    e->len = (size_t) co->result;
+    CORO_SEND(co, e->fd, e->buf, e->len);
+    if (co->result < 0) break;
+  }
+  e->fd = -1; // tells the test the handler ran to its end
+  CORO_END(co);
+}
+
+static int unit_sleeper(Coro *co) {
+  int *woke = co->arg;
+  CORO_BEGIN(co);
+  CORO_SLEEP_MS(co, 5);
+  (*woke)++;
+  CORO_END(co);
+}
+
+// spawns a sleeper from inside a handler, then yields once
+static int unit_spawner(Coro *co) {
+  int *woke = co->arg;
+  CORO_BEGIN(co);
+  assert(coro_spawn(co->sched, unit_sleeper, woke) != NULL);
+  CORO_YIELD(co);
+  (*woke)++;
+  CORO_END(co);
+}
+
+#define UNIT_CORO_SCHED()                                               \
+do {                                                                    \
+  CoroSched sched;                                                      \
+  int sv[2], woke = 0;                                                  \
+  char got[16];                                                         \
+  assert(coro_sched_init(&sched) == 0);                                 \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);                              \
+  UnitEcho echo = { sv[0], 0, { 0 } };                                  \
+  assert(coro_spawn(&sched, unit_echo, &echo) != NULL);                 \
+  assert(sched.n == 1 && sched.coros[0]->fd == sv[0]);                  \
+  assert(coro_sched_run_once(&sched, 0) == 0); /* nothing to read */    \
+  send(sv[1], "ping", 4, 0);                                            \
+  assert(coro_sched_run_once(&sched, 1000) == 1);                       \
+  assert(recv(sv[1], got, sizeof(got), 0) == 4);                        \
+  assert(memcmp(got, "ping", 4) == 0);                                  \
+  assert(coro_spawn(&sched, unit_spawner, &woke) != NULL);              \
+  assert(sched.n == 3 && woke == 0); /* echo, spawner, its sleeper */   \
+  coro_sched_run_once(&sched, 1000); /* the yield returns at once */    \
+  assert(woke == 1 && sched.n == 2);                                    \
+  int64_t start = coro_now_us();                                        \
+  coro_sched_run_once(&sched, 1000);                                    \
+  assert(woke == 2 && coro_now_us() - start >= 5000);                   \
+  close(sv[1]); /* hang up, the echo handler finishes */                \
+  coro_sched_run_once(&sched, 1000);                                    \
+  assert(sched.n == 0 && echo.fd == -1);                                \
+  assert(coro_sched_run_once(&sched, -1) == 0); /* drained, no wait */  \
+  close(sv[0]);                                                         \
+  coro_sched_destroy(&sched);                                           \
+} while(0)
+
+static int unit_stage_calls = 0, unit_stage_msgs = 0;
+
+// registered for the test binary only, drops what starts with '#'
+static void unit_stage(Pipeline *p, MsgBatch *b) {
+  (void) p;
+  unit_stage_calls++;
+  unit_stage_msgs += b->n;
+  for (int m = 0; m < b->n; m++)
+    if (b->msgs[m].data[0] == '#') pipeline_drop(b, m);
+}
+PIPELINE_STAGE(STAGE_DECODE, "unit", unit_stage);
+
+#define UNIT_PIPELINE_STAGES()                                          \
+do {                                                                    \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);                  \
+  Pipeline pipeline;                                                    \
+  int sv[2][2];                                                         \
+  char got[64];                                                         \
+  const char *lines[] = { "hi\n", "#skip\n", "\xff\n", "bye\n" };       \
+  for (int s = 1; s < pipeline_n_stages; s++)                           \
+    assert(pipeline_stages[s - 1].phase <= pipeline_stages[s].phase);   \
+  assert(strcmp(pipeline_stages[0].name, "unit") == 0);                 \
+  for (int u = 0; u < 2; u++) {                                         \
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv[u]);                         \
+    client_add(client_pool, sv[u][0], POLLIN); /* slot u */             \
+  }                                                                     \
+  assert(pipeline_init(&pipeline, client_pool, NULL, NULL, -1) == 0);   \
+  for (int l = 0; l < 4; l++) {                                         \
+    size_t len = strlen(lines[l]);                                      \
+    memcpy(pipeline_reserve(&pipeline, len), lines[l], len);            \
+    pipeline_push(&pipeline, 0, len);                                   \
+  }                                                                     \
+  pipeline_run(&pipeline);                                              \
+  assert(unit_stage_calls == 1 && unit_stage_msgs == 4);                \
+  assert(client_pool->utf8_rejected == 1);                              \
+  flush_outbox(client_pool);                                            \
+  assert(recv(sv[1][1], got, sizeof(got), 0) == 7);                     \
+  assert(memcmp(got, "hi\nbye\n", 7) == 0);                             \
+  assert(recv(sv[0][1], got, sizeof(got), MSG_DONTWAIT) == -1);         \
+  for (int l = 0; l <= PIPELINE_BATCH_MAX; l++) { /* one run when full */ \
+    memcpy(pipeline_reserve(&pipeline, 2), "#\n", 2);                   \
+    pipeline_push(&pipeline, 1, 2);                                     \
+  }                                                                     \
+  assert(pipeline.batches == 2 && pipeline.batch->n == 1);              \
+  pipeline_run(&pipeline);                                              \
+  assert(unit_stage_msgs == 4 + PIPELINE_BATCH_MAX + 1);                \
+  assert(pipeline_stages[0].dropped == 1 + PIPELINE_BATCH_MAX + 1);     \
+  char bulk[4096]; /* above the splice threshold, matches the filter */ \
+  memset(bulk, 'x', sizeof(bulk));                                      \
+  memcpy(bulk + 3000, "bit.ly/", 7);                                    \
+  FILE *file = fopen("build/unit.filter", "w");                         \
+  fputs("bit.ly/\n", file);                                             \
+  fclose(file);                                                         \
+  assert(send(sv[0][1], bulk, sizeof(bulk), 0) == sizeof(bulk));        \
+  assert(splice_pending(client_pool, 0, 1024) == sizeof(bulk));         \
+  client_pool->filter = filter_load("build/unit.filter");               \
+  assert(splice_pending(client_pool, 0, 1024) == 0); /* recv instead */ \
+  char *buf = pipeline_reserve(&pipeline, sizeof(bulk));                \
+  assert(recv(sv[0][0], buf, sizeof(bulk), 0) == sizeof(bulk));         \
+  pipeline_push(&pipeline, 0, sizeof(bulk));                            \
+  pipeline_run(&pipeline);                                              \
+  flush_outbox(client_pool);                                            \
+  assert(recv(sv[1][1], got, sizeof(got), MSG_DONTWAIT) == -1);         \
+  assert(client_pool->filter->hits == 1);                               \
+  filter_free(client_pool->filter);                                     \
+  client_pool->filter = NULL;                                           \
+  unlink("build/unit.filter");                                          \
+  pipeline_destroy(&pipeline);                                          \
+  for (int u = 0; u < 2; u++) close(sv[u][0]), close(sv[u][1]);         \
+  clients_destroy(client_pool);                                         \
+} while(0)
+
+#define UNIT_TRACE_SLICES()                                             \
+do {                                                                    \
+  ClientPool *client_pool = clients_init(MAX_CLIENTS);                  \
+  Pipeline pipeline;                                                    \
+  int sv[2];                                                            \
+  char text[4096];                                                      \
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);                              \
+  client_add(client_pool, sv[0], POLLIN); /* slot 0 */                  \
+  assert(pipeline_init(&pipeline, client_pool, NULL, NULL, -1) == 0);   \
+  assert(trace_init(true) == 0);                                        \
+  TRACE(TRACE_RECV, trace_begin(), sv[0]); /* dropped by utf8 */        \
+  memcpy(pipeline_reserve(&pipeline, 2), "\xff\n", 2);                  \
+  pipeline_push(&pipeline, 0, 2);                                       \
+  pipeline_run(&pipeline);                                              \
+  TRACE(TRACE_RECV, trace_begin(), sv[0]); /* a command, as in main */  \
+  TRACE(TRACE_COMMAND, trace_take(), 6);                                \
+  trace_on = false;                                                     \
+  assert(trace_dump("build/unit.trace") == 4);                          \
+  FILE *file = fopen("build/unit.trace", "r");                          \
+  size_t n = fread(text, 1, sizeof(text) - 1, file);                    \
+  fclose(file);                                                         \
+  unlink("build/unit.trace");                                           \
+  text[n] = '\0';                                                       \
+  int opened = 0, closed = 0;                                           \
+  for (char *at = text; (at = strstr(at, "\"ph\":")) != NULL; at++) {   \
+    opened += at[6] == 'b';                                             \
+    closed += at[6] == 'e';                                             \
+  }                                                                     \
+  assert(opened == 2 && closed == 2);                                   \
+  assert(strstr(text, "\"stage\":\"dropped\",\"arg\":2") != NULL);      \
+  assert(strstr(text, "\"stage\":\"command\",\"arg\":6") != NULL);      \
+  pipeline_destroy(&pipeline);                                          \
+  close(sv[1]);                                                         \
+  clients_destroy(client_pool);                                         \
+} while(0)
+
+#define UNIT_WATCHDOG_STALL()                                           \
+do {                                                                    \
+  WatchdogStats stalls;                                                 \
+  assert(!watchdog_stats(&stalls)); /* off until started */            \
+  assert(watchdog_start(20) == 0);                                      \
+  watchdog_beat(ratelimit_now_us());                                    \
+  WATCHDOG_STAGE("unit");                                               \
+  int64_t busy_until = ratelimit_now_us() + 120000;                     \
+  while (ratelimit_now_us() < busy_until) {} /* the signal lands here */ \
+  WATCHDOG_STAGE(NULL);                                                 \
+  usleep(40000); /* idle, the watchdog closes the stall */              \
+  assert(watchdog_stats(&stalls));                                      \
+  assert(stalls.stalls == 1 && stalls.n_stages == 1);                   \
+  assert(strcmp(stalls.stages[0].name, "unit") == 0);                   \
+  assert(stalls.max_us >= 100000 && stalls.max_us < 1000000);           \
+  watchdog_stop();                                                      \
+} while(0)
+
+#define UNIT_TSTAMP_DELAYS()                                            \
+do {                                                                    \
+  LatencyHist hist = {0};                                               \
+  for (uint64_t ns = 1; ns <= 100; ns++) hist_add(&hist, ns * 1000);    \
+  assert(hist.n == 100 && hist.max_ns == 100000);                       \
+  uint64_t p50 = hist_percentile(&hist, 0.5);                           \
+  assert(p50 >= 51000 && p50 < 51000 * 5 / 4); /* a quarter octave */   \
+  assert(hist_percentile(&hist, 1.0) == 100000);                        \
+  struct sockaddr_in addr = { .sin_family = AF_INET };                  \
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);                        \
+  socklen_t addr_len = sizeof(addr);                                    \
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);                            \
+  bind(lfd, (struct sockaddr *) &addr, sizeof(addr));                   \
+  listen(lfd, 1);                                                       \
+  getsockname(lfd, (struct sockaddr *) &addr, &addr_len);               \
+  int peer = socket(AF_INET, SOCK_STREAM, 0);                           \
+  assert(connect(peer, (struct sockaddr *) &addr, sizeof(addr)) == 0);  \
+  int fd = accept(lfd, NULL, NULL);                                     \
+  assert(tstamp_enable(fd) == 0);                                       \
+  TstampTx tx = {0};                                                    \
+  LatencyHist rx_delay = {0}, tx_delay = {0};                           \
+  for (int s = 0; s < 3; s++) { /* three stamps for three calls */     \
+    int64_t t = tstamp_now_ns();                                        \
+    tstamp_sent(&tx, (size_t) send(fd, "ping", 4, 0), t);               \
+    struct pollfd pfd = { fd, 0, 0 };                                   \
+    assert(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLERR));        \
+    assert(tstamp_drain(fd, &tx, &tx_delay) == 1);                      \
+  }                                                                     \
+  assert(tx_delay.n == 3 && tx.n == 0 && tx.bytes == 12);               \
+  char got[16];                                                         \
+  /* the kernel turns RX stamping on asynchronously, the first packets */ \
+  /* after the setsockopt() may go without */                           \
+  for (int r = 0; r < 100 && rx_delay.n == 0; r++) {                    \
+    send(peer, "pong", 4, 0);                                           \
+    assert(tstamp_recv(fd, got, sizeof(got), &rx_delay) == 4);          \
+    if (rx_delay.n == 0) usleep(1000);                                  \
+  }                                                                     \
+  assert(rx_delay.n == 1 && rx_delay.max_ns < 1000000000);              \
+  close(fd), close(peer), close(lfd);                                   \
+} while(0)
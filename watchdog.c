@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+
+#include "watchdog.h"
+#include "ratelimit.h"
+#include "lowlat.h"
+#include "log.h" // LOG_IMPLEMENTION defined in main.c
+
+_Atomic(const char *) watchdog_stage_now = NULL;
+
+static struct {
+  bool on;
+  int threshold_ms;
+  pthread_t loop;
+  pthread_t thread;
+  atomic_bool run;
+  _Atomic uint64_t beat;    // loop passes
+  _Atomic int64_t beat_us;  // when the current one started
+  // backtrace of the loop thread, filled by its signal handler
+  void *frames[WATCHDOG_FRAMES];
+  atomic_int depth;         // 0 until the handler ran
+  pthread_mutex_t lock;     // stats, the loop reads them on SIGUSR1
+  WatchdogStats stats;
+} wd = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// a new loop pass begins at now_us, see ratelimit_now_us()
+void watchdog_beat(int64_t now_us) {
+  atomic_store_explicit(&wd.beat_us, now_us, memory_order_relaxed);
+  atomic_fetch_add_explicit(&wd.beat, 1, memory_order_release);
+}
+
+static void on_watchdog_signal(int sig) {
+  (void) sig;
+  int saved = errno;
+  atomic_store(&wd.depth, backtrace(wd.frames, WATCHDOG_FRAMES));
+  errno = saved;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = { ms / 1000, (long) (ms % 1000) * 1000000 };
+  nanosleep(&ts, NULL);
+}
+
+// stage, total and longest stall; names are literals, compared by address
+// first
+static void account(const char *stage, uint64_t us) {
+  pthread_mutex_lock(&wd.lock);
+  WatchdogStats *st = &wd.stats;
+  st->stalls++;
+  st->total_us += us;
+  if (us > st->max_us) st->max_us = us;
+  int s = 0;
+  while (s < st->n_stages && st->stages[s].name != stage &&
+         strcmp(st->stages[s].name, stage) != 0)
+  {
+    s++;
+  }
+  if (s == st->n_stages && s < WATCHDOG_STAGES_MAX)
+    st->stages[st->n_stages++] = (WatchdogStage) { stage, 0, 0, 0 };
+  if (s < st->n_stages) {
+    st->stages[s].stalls++;
+    st->stages[s].total_us += us;
+    if (us > st->stages[s].max_us) st->stages[s].max_us = us;
+  }
+  pthread_mutex_unlock(&wd.lock);
+}
+
+// stage and backtrace of the loop thread, straight to stderr
+static void report(const char *stage, int64_t busy_us) {
+  char line[160];
+  int len = snprintf(line, sizeof(line),
+                     "\n[STALL] event loop busy for %ld ms in stage `%s`\n",
+                     (long) (busy_us / 1000), stage);
+  if (write(STDERR_FILENO, line, (size_t) len) < 0) return;
+  atomic_store(&wd.depth, 0);
+  if (pthread_kill(wd.loop, WATCHDOG_SIGNAL) != 0) return;
+  for (int waited = 0; atomic_load(&wd.depth) == 0 && waited < 100; waited++)
+    sleep_ms(1);
+  int depth = atomic_load(&wd.depth);
+  if (depth > 1) // the first frame is the signal handler
+    backtrace_symbols_fd(wd.frames + 1, depth - 1, STDERR_FILENO);
+}
+
+static void *watch(void *arg) {
+  (void) arg;
+  lowlat_pin_helper(0); // off the loop's CPU, it must run while that stalls
+  const int period_ms = wd.threshold_ms / 4 > 0 ? wd.threshold_ms / 4 : 1;
+  uint64_t seen = atomic_load(&wd.beat);
+  const char *stalled = NULL; // stage of the stall going on
+  int64_t stall_from = 0;
+  while (atomic_load(&wd.run)) {
+    sleep_ms(period_ms);
+    int64_t now = ratelimit_now_us();
+    uint64_t beat = atomic_load_explicit(&wd.beat, memory_order_acquire);
+    const char *stage = atomic_load_explicit(&watchdog_stage_now,
+                                             memory_order_relaxed);
+    if (beat != seen || stage == NULL) { // the pass is over
+      if (stalled != NULL) account(stalled, (uint64_t) (now - stall_from));
+      stalled = NULL;
+      seen = beat;
+      continue;
+    }
+    int64_t from = atomic_load_explicit(&wd.beat_us, memory_order_relaxed);
+    if (stalled == NULL && now - from >= (int64_t) wd.threshold_ms * 1000) {
+      stalled = stage;
+      stall_from = from;
+      report(stage, now - from);
+    }
+  }
+  return NULL;
+}
+
+// starts watching the calling thread, which must be the event loop;
+// threshold_ms 0 leaves the watchdog off
+int watchdog_start(int threshold_ms) {
+  if (threshold_ms <= 0) return 0;
+  wd.threshold_ms = threshold_ms;
+  wd.loop = pthread_self();
+  // backtrace() loads libgcc on first use, not something to do in a
+  // signal handler
+  void *prime[1];
+  backtrace(prime, 1);
+  struct sigaction sa = { .sa_handler = on_watchdog_signal };
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(WATCHDOG_SIGNAL, &sa, NULL) < 0) {
+    LOG_FROM_ERR("failed to install the watchdog signal\n");
+    LOG_APPEND("errno: %s\n", strerror(errno));
+    return -1;
+  }
+  atomic_store(&wd.run, true);
+  int rv = pthread_create(&wd.thread, NULL, watch, NULL);
+  if (rv != 0) {
+    LOG_FROM_ERR("failed to start the watchdog thread\n");
+    LOG_APPEND("errno: %s\n", strerror(rv));
+    return -1;
+  }
+  wd.on = true;
+  LOG_FROM_SUCC("watchdog reports loop passes busy for over %d ms\n",
+                threshold_ms);
+  return 0;
+}
+
+void watchdog_stop(void) {
+  if (!wd.on) return;
+  atomic_store(&wd.run, false);
+  pthread_join(wd.thread, NULL);
+  wd.on = false;
+}
+
+// a copy of the stats; false when the watchdog is off
+bool watchdog_stats(WatchdogStats *out) {
+  if (!wd.on) return false;
+  pthread_mutex_lock(&wd.lock);
+  *out = wd.stats;
+  pthread_mutex_unlock(&wd.lock);
+  return true;
+}
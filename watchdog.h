@@ -0,0 +1,64 @@
+/*
+  Stall watchdog for the event loop. Anything that blocks inside a loop
+  pass (a send() on a blocking socket, a fprintf() to a full pipe, a slow
+  disk) freezes every client of the host; the watchdog makes that visible.
+
+    ./build/run 9001 --watchdog-ms 100
+
+  The loop beats once per pass (watchdog_beat()) and names the stage it
+  is in as it goes (WATCHDOG_STAGE(), a relaxed store). A thread of its own
+  looks at both every threshold / 4 ms; when one pass has been busy for
+  longer than the threshold it reports, once per stall, on stderr:
+
+    [STALL] event loop busy for 212 ms in stage `broadcast`
+    ... backtrace of the loop thread ...
+
+  The backtrace is taken on the loop thread itself, by WATCHDOG_SIGNAL
+  (installed with SA_RESTART, a blocking socket call carries on; a sleep
+  it interrupts returns early). The report is written with write(), not
+  log.h: the loop may be stuck inside a fprintf() holding the stream.
+  Waiting in poll() is idle, stage NULL, and never counts.
+
+  SIGUSR1 prints the stalls, their total and longest duration, and the
+  same per stage. Durations are accurate to the check period.
+ */
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <signal.h>
+
+#define WATCHDOG_SIGNAL     (SIGRTMIN + 1)
+#define WATCHDOG_FRAMES     32 // of the loop thread's backtrace
+#define WATCHDOG_STAGES_MAX 32 // distinct stage names with stats
+
+typedef struct {
+  const char *name;
+  uint64_t stalls;
+  uint64_t total_us;
+  uint64_t max_us;
+} WatchdogStage;
+
+typedef struct {
+  uint64_t stalls;
+  uint64_t total_us;
+  uint64_t max_us;
+  int n_stages;
+  WatchdogStage stages[WATCHDOG_STAGES_MAX];
+} WatchdogStats;
+
+// the stage the loop is in, NULL while it waits for events
+extern _Atomic(const char *) watchdog_stage_now;
+
+#define WATCHDOG_STAGE(name) \
+  atomic_store_explicit(&watchdog_stage_now, (name), memory_order_relaxed)
+
+int watchdog_start(int);
+void watchdog_stop(void);
+void watchdog_beat(int64_t);
+bool watchdog_stats(WatchdogStats *);
+
+#endif // WATCHDOG_H_